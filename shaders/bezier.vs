@@ -0,0 +1,11 @@
+#version 400
+
+// Passes the control points of bicubic Bezier patches to bezier.tcs
+layout (location = 0) in vec3 vPos;
+
+out vec3 controlPoint;
+
+void main()
+{
+   controlPoint = vPos;
+}
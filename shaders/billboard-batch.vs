@@ -0,0 +1,34 @@
+#version 400
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec4 vOffsetSize;  // per instance: xyz offset, w size
+layout (location = 2) in vec4 vColor;       // per instance
+
+uniform vec3 CameraPos;
+uniform float Rot;
+uniform mat4 MVP;
+
+out vec4 color;
+out vec2 uv;
+
+void main()
+{
+  color = vColor;
+  uv = vPosition.xy;
+
+  vec3 offset = vOffsetSize.xyz;
+  float size = vOffsetSize.w;
+
+  vec3 z = normalize(CameraPos - offset);
+  vec3 x = normalize(cross(vec3(0,1,0), z));
+  vec3 y = normalize(cross(z, x));
+  mat3 R = mat3(x, y, z);
+
+  x = vec3(cos(Rot), -sin(Rot), 0);
+  y = vec3(sin(Rot), cos(Rot), 0);
+  z = vec3(0,0,1);
+  mat3 M = mat3(x, y, z);
+
+  vec3 eyePos = M * R * size * (vPosition - vec3(0.5, 0.5, 0.0)) + offset;
+  gl_Position = MVP * vec4(eyePos, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 400
+
+// A triangle that covers the viewport, drawn by Renderer::fullscreen()
+// without vertex attributes
+out vec2 uv;
+
+void main()
+{
+   uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+   gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
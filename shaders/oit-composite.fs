@@ -0,0 +1,32 @@
+#version 400
+
+// Resolves weighted blended transparency (see Renderer::compositeTransparency)
+// as the weighted average color, blended over the target with the coverage
+// as alpha, or over the Opaque texture when HasOpaque is set
+uniform sampler2D Accum;     // sum of weighted premultiplied colors, weights
+uniform sampler2D Coverage;  // 1 - product of (1 - alpha)
+uniform sampler2D Opaque;    // the scene behind the transparent surfaces
+uniform bool HasOpaque;
+
+out vec4 FragColor;
+
+void main()
+{
+   ivec2 texel = ivec2(gl_FragCoord.xy);
+   float coverage = texelFetch(Coverage, texel, 0).r;
+   vec4 opaque = HasOpaque ? texelFetch(Opaque, texel, 0) : vec4(0.0);
+   if (coverage < 0.0001) {
+      if (!HasOpaque) discard;
+      FragColor = opaque;
+      return;
+   }
+
+   vec4 accum = texelFetch(Accum, texel, 0);
+   // Half floats overflow when many bright layers overlap
+   if (isinf(max(max(accum.r, accum.g), max(accum.b, accum.a)))) {
+      accum.rgb = vec3(accum.a);
+   }
+   vec3 color = accum.rgb / max(accum.a, 0.00001);
+   FragColor = HasOpaque ? vec4(mix(opaque.rgb, color, coverage), opaque.a) :
+      vec4(color, coverage);
+}
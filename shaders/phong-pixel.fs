@@ -1,14 +1,52 @@
 #version 400
 
+#ifdef OIT
+layout (location = 0) out vec4 Accum;
+layout (location = 1) out vec4 Coverage;
+#else
 out vec4 FragColor;
+#endif
 
 in vec3 fn;
 in vec3 vertPos;
+#ifdef TEXTURED
 in vec2 uv;
+#endif
+#ifdef SHADOWED
+in vec4 shadowCoord;
+#endif
 
-uniform sampler2D Image;
+// Features (defined by Renderer when compiling a variant):
+//   TEXTURED   sample the Skins texture array at layer SkinLayer
+//   TINT_MASK  replace the mid-tones of the texture with diffuseColor
+//   SHADOWED   darken the direct light using the depth map ShadowMap
+//   CLUSTERED  add the point and spot lights binned by LightClusters
+//   OIT        write weighted blended transparency with diffuseColor.a as
+//              opacity (draw with Renderer blendMode OIT)
+#ifdef TEXTURED
+uniform sampler2DArray Skins;
+uniform int SkinLayer = 0;
+#endif
+#ifdef SHADOWED
+uniform sampler2DShadow ShadowMap;
+
+// Fraction of the light reaching this fragment, averaged over 3x3 texels
+float shadowVisibility()
+{
+   vec3 coord = shadowCoord.xyz / shadowCoord.w;
+   if (coord.z > 1.0) return 1.0;  // beyond the light's far plane
+
+   vec2 texel = 1.0 / vec2(textureSize(ShadowMap, 0));
+   float visible = 0.0;
+   for (int x = -1; x <= 1; x++) {
+      for (int y = -1; y <= 1; y++) {
+         visible += texture(ShadowMap, vec3(coord.xy + vec2(x, y) * texel, coord.z));
+      }
+   }
+   return visible / 9.0;
+}
+#endif
 
-uniform bool text;
 uniform vec4 diffuseColor;
 uniform vec3 lightDirection = vec3(-1.0, -0.25, 0.0);
 
@@ -32,6 +70,51 @@ float phongShininess)
    return color;
 }
 
+#ifdef CLUSTERED
+uniform samplerBuffer ClusterLights;    // 3 texels per light, view space
+uniform usamplerBuffer ClusterRanges;   // offset and count per cluster
+uniform usamplerBuffer ClusterIndices;  // light indices of all clusters
+uniform vec3 ClusterGrid;               // tiles in x and y, depth slices
+uniform vec2 ClusterFocal;              // projection[0][0], projection[1][1]
+uniform vec2 ClusterDepth;              // near plane, slices / log(far / near)
+
+// Light from the point and spot lights that reach this fragment's cluster
+vec3 clusterLighting(vec3 viewDir, vec3 n, vec3 albedo)
+{
+   float depth = -vertPos.z;
+   vec2 ndc = ClusterFocal * vertPos.xy / depth;
+   vec3 cell = vec3(ClusterGrid.xy * (ndc * 0.5 + 0.5),
+      log(depth / ClusterDepth.x) * ClusterDepth.y);
+   ivec3 grid = ivec3(ClusterGrid);
+   ivec3 c = clamp(ivec3(cell), ivec3(0), grid - 1);
+   uvec2 range = texelFetch(ClusterRanges, (c.z * grid.y + c.y) * grid.x + c.x).xy;
+
+   vec3 radiance = vec3(0.0);
+   for (uint i = range.x; i < range.x + range.y; i++) {
+      int light = 3 * int(texelFetch(ClusterIndices, int(i)).x);
+      vec4 posRadius = texelFetch(ClusterLights, light);
+      vec4 colorOuter = texelFetch(ClusterLights, light + 1);  // outer cos
+      vec4 dirInner = texelFetch(ClusterLights, light + 2);    // inner cos
+
+      vec3 toLight = posRadius.xyz - vertPos;
+      float dist = length(toLight);
+      if (dist >= posRadius.w) continue;
+      vec3 lightDir = toLight / dist;
+
+      // Inverse square falloff, windowed to reach zero at the radius
+      float window = 1.0 - pow(dist / posRadius.w, 4.0);
+      float falloff = window * window / (dist * dist + 1.0);
+      float cone = smoothstep(colorOuter.w, dirInner.w, dot(-lightDir, dirInner.xyz));
+      float irradiance = max(dot(lightDir, n), 0.0) * falloff * cone;
+      if (irradiance > 0.0) {
+         vec3 brdf = phongBRDF(lightDir, viewDir, n, albedo, specularColor.rgb, shininess);
+         radiance += brdf * irradiance * colorOuter.rgb;
+      }
+   }
+   return radiance;
+}
+#endif
+
 void main()
 {
    vec3 lightDir = normalize(-lightDirection);
@@ -39,30 +122,48 @@ void main()
    vec3 n = normalize(fn);
    
    vec4 tColor = diffuseColor;
-   if (text)
+#ifdef TEXTURED
+   tColor = texture(Skins, vec3(uv, SkinLayer));
+#ifdef TINT_MASK
+   if ((tColor.r < 0.9) && (tColor.g < 0.9) && (tColor.b < 0.9) &&
+   (tColor.r > 0.1) && (tColor.g > 0.1) && (tColor.b > 0.1))
    {
-      tColor = texture(Image, uv);
-      if ((tColor.r < 0.9) && (tColor.g < 0.9) && (tColor.b < 0.9) &&
-      (tColor.r > 0.1) && (tColor.g > 0.1) && (tColor.b > 0.1))
-      {
-         tColor = vec4(
-            diffuseColor.r,
-            diffuseColor.g,
-            diffuseColor.b,
-            1.0f
-         );
-      }
+      tColor = vec4(
+         diffuseColor.r,
+         diffuseColor.g,
+         diffuseColor.b,
+         1.0f
+      );
    }
+#endif
+#endif
    // was ambientColor
    vec3 radiance = (tColor.rgb * 0.2);
 
    float irradiance = max(dot(lightDir, n), 0.0) * irradiPerp;
+#ifdef SHADOWED
+   if(irradiance > 0.0) irradiance *= shadowVisibility();
+#endif
    if(irradiance > 0.0) {
       vec3 brdf = phongBRDF(lightDir, viewDir, n, tColor.rgb, specularColor.rgb, shininess);
       radiance += brdf * irradiance * lightColor.rgb;
    }
+#ifdef CLUSTERED
+   radiance += clusterLighting(viewDir, n, tColor.rgb);
+#endif
    radiance = pow(radiance, vec3(1.0 / 2.2));
 
+#ifdef OIT
+   // Nearer and more opaque layers weigh more in the average (McGuire and
+   // Bavoil 2013, equation 9)
+   float alpha = diffuseColor.a;
+   float z = -vertPos.z;
+   float weight = alpha * clamp(
+      10.0 / (0.00001 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)), 0.01, 3000.0);
+   Accum = vec4(radiance * alpha, alpha) * weight;
+   Coverage = vec4(alpha);
+#else
    FragColor.rgb = radiance;
    FragColor.a = 1.0;
+#endif
 }
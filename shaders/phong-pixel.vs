@@ -7,14 +7,27 @@ layout (location = 2) in vec2 vUV;
 uniform mat3 NormalMatrix;
 uniform mat4 ModelViewMatrix;
 uniform mat4 MVP;
-uniform bool HasUV;
+#ifdef SHADOWED
+uniform mat4 ModelMatrix;
+uniform mat4 ShadowMatrix;  // world to shadow map coordinates
+#endif
 
 out vec3 fn;
 out vec3 vertPos;
+#ifdef TEXTURED
 out vec2 uv;
+#endif
+#ifdef SHADOWED
+out vec4 shadowCoord;
+#endif
 void main()
 {
+#ifdef TEXTURED
    uv = vUV;
+#endif
+#ifdef SHADOWED
+   shadowCoord = ShadowMatrix * ModelMatrix * vec4(vPos, 1.0);
+#endif
    fn = normalize(NormalMatrix * vNormals);
    vec4 vertPos4 = ModelViewMatrix * vec4(vPos, 1.0);
    vertPos = vec3(vertPos4) / vertPos4.w;
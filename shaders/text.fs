@@ -3,11 +3,13 @@
 in vec4 color;
 in vec2 uv;
 
-uniform sampler2D fontTexture;
+uniform sampler2D fontTexture;  // signed distance field, 0.5 on the edge
 out vec4 FragColor;
 
 void main()
 {
-  vec4 c = color * texture(fontTexture, uv);
-  FragColor = c; //vec4(1,0,0,1);
+  float dist = texture(fontTexture, uv).r;
+  float w = max(fwidth(dist), 0.0001);
+  float alpha = smoothstep(0.5 - w, 0.5 + w, dist);
+  FragColor = vec4(color.rgb, color.a * alpha);
 }
@@ -0,0 +1,15 @@
+#version 400
+
+// Stretches the reduced resolution image of DynamicResolution over the
+// viewport
+uniform sampler2D Image;
+uniform vec2 UvScale;  // part of the texture that was drawn
+uniform vec2 UvMax;    // centers of the last drawn texels
+
+in vec2 uv;
+out vec4 FragColor;
+
+void main()
+{
+   FragColor = vec4(texture(Image, min(uv * UvScale, UvMax)).rgb, 1.0);
+}
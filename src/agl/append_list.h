@@ -0,0 +1,90 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_APPEND_LIST_H_
+#define AGL_APPEND_LIST_H_
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace agl {
+
+/**
+ * @brief A list that only grows, whose copies share storage
+ *
+ * Copying a list copies a pointer and a count, so a copy is a snapshot of
+ * the elements added so far no matter how many there are. Elements are
+ * stored in chunks that double in size and never move, so push_back()
+ * doesn't touch anything a copy can see.
+ *
+ * One thread appends to the original, and any thread may read copies it
+ * received through a synchronizing hand-off, such as SnapshotBuffer.
+ * Appending to a copy asserts.
+ * ```
+ * // update(), input thread
+ * _placed.push_back(thing);
+ * _scene.placed = _placed;
+ *
+ * // draw(), render thread
+ * for (size_t i = 0; i < scene.placed.size(); i++) draw(scene.placed[i]);
+ * ```
+ * @see SnapshotBuffer
+ */
+template <typename T>
+class AppendList {
+ public:
+  AppendList() : _storage(std::make_shared<Storage>()), _size(0) {}
+
+  /**
+   * @brief Add a value at the end (original list only)
+   */
+  void push_back(const T& value) {
+    assert(_size == _storage->size && "append to a copy of an AppendList");
+    size_t offset;
+    int chunk = locate(_size, &offset);
+    if (!_storage->chunks[chunk]) {
+      _storage->chunks[chunk].reset(new T[FirstChunk << chunk]);
+    }
+    _storage->chunks[chunk][offset] = value;
+    _storage->size = ++_size;
+  }
+
+  /** @brief Return the number of elements */
+  size_t size() const { return _size; }
+
+  const T& operator[](size_t i) const {
+    assert(i < _size);
+    size_t offset;
+    int chunk = locate(i, &offset);
+    return _storage->chunks[chunk][offset];
+  }
+
+ private:
+  static const size_t FirstChunk = 64;
+  static const int MaxChunks = 32;  // holds 64 * (2^32 - 1) elements
+
+  struct Storage {
+    std::unique_ptr<T[]> chunks[MaxChunks];  // chunk k holds 64 << k
+    size_t size = 0;  // elements added to the original list
+  };
+
+  // Chunk holding element i, and the position of i in it
+  static int locate(size_t i, size_t* offset) {
+    int chunk = 0;
+    size_t chunkSize = FirstChunk;
+    while (i >= chunkSize) {
+      i -= chunkSize;
+      chunkSize <<= 1;
+      chunk++;
+    }
+    assert(chunk < MaxChunks);
+    *offset = i;
+    return chunk;
+  }
+
+  std::shared_ptr<Storage> _storage;
+  size_t _size;
+};
+
+}  // namespace agl
+#endif  // AGL_APPEND_LIST_H_
@@ -0,0 +1,169 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/bezier_patches.h"
+#include <algorithm>
+#include <cassert>
+#include "agl/primitive_cache.h"
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
+#include "agl/shader.h"
+
+namespace agl {
+
+int BezierPatches::MaxLevel = 32;
+
+static const int PatchPoints = 16;
+static const int VertexFloats = 8;  // position, normal, uv
+
+BezierPatches::BezierPatches() :
+  _loaded(false),
+  _numPoints(0),
+  _maxLevel(0),
+  _shader(0),
+  _patchVao(0),
+  _patchVbo(0),
+  _feedback(0),
+  _outputVao(0),
+  _outputVbo(0),
+  _query(0),
+  _queryPending(false),
+  _triangles(0) {
+}
+
+BezierPatches::~BezierPatches() {
+  cleanup();
+}
+
+bool BezierPatches::load(const std::vector<GLfloat>& points) {
+  AGL_PROFILE_SCOPE("BezierPatches::load");
+  assert(!_loaded);
+  assert(points.size() % (3 * PatchPoints) == 0);
+
+  _shader = new Shader();
+  try {
+    _shader->compileShader("../shaders/bezier.vs");
+    _shader->compileShader("../shaders/bezier.tcs");
+    _shader->compileShader("../shaders/bezier.tes");
+    const char* varyings[] = {"Position", "Normal", "TexCoord"};
+    glTransformFeedbackVaryings(_shader->getHandle(), 3, varyings,
+        GL_INTERLEAVED_ATTRIBS);
+    _shader->link();
+  } catch (const GLSLProgramException&) {
+    delete _shader;
+    _shader = 0;
+    return false;
+  }
+
+  GLint driverMax = 0;
+  glGetIntegerv(GL_MAX_TESS_GEN_LEVEL, &driverMax);
+  _maxLevel = std::max(1, std::min(MaxLevel, static_cast<int>(driverMax)));
+  _numPoints = static_cast<int>(points.size() / 3);
+
+  glGenVertexArrays(1, &_patchVao);
+  glGenBuffers(1, &_patchVbo);
+  glBindVertexArray(_patchVao);
+  glBindBuffer(GL_ARRAY_BUFFER, _patchVbo);
+  glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(GLfloat),
+      points.data(), GL_STATIC_DRAW);
+  RenderStats::countBuffer(points.size() * sizeof(GLfloat));
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(0);  // Control point
+
+  // A quad patch with every level at most L has at most 2 L^2 triangles
+  size_t patches = _numPoints / PatchPoints;
+  size_t maxVertices = patches * 2 * _maxLevel * _maxLevel * 3;
+  glGenVertexArrays(1, &_outputVao);
+  glGenBuffers(1, &_outputVbo);
+  glBindVertexArray(_outputVao);
+  glBindBuffer(GL_ARRAY_BUFFER, _outputVbo);
+  glBufferData(GL_ARRAY_BUFFER, maxVertices * VertexFloats * sizeof(GLfloat),
+      nullptr, GL_DYNAMIC_COPY);
+  GLsizei stride = VertexFloats * sizeof(GLfloat);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+  glEnableVertexAttribArray(0);  // Vertex position
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<void*>(3 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(1);  // Normal
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<void*>(6 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(2);  // Tex coord
+  glBindVertexArray(0);
+
+  glGenTransformFeedbacks(1, &_feedback);
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, _feedback);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, _outputVbo);
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+  glGenQueries(1, &_query);
+  _loaded = true;
+  return true;
+}
+
+void BezierPatches::draw(const glm::mat4& modelView,
+    const glm::mat4& projection, float viewportHeight, Shader* shader) {
+  AGL_PROFILE_SCOPE("BezierPatches::draw");
+  assert(_loaded);
+
+  // Tessellate into the output buffer, without rasterizing
+  _shader->use();
+  _shader->setUniform("ModelViewMatrix", modelView);
+  _shader->setUniform("PixelScale", 0.5f * viewportHeight * projection[1][1]);
+  _shader->setUniform("Perspective", projection[2][3] != 0);
+  _shader->setUniform("PixelsPerSegment", PrimitiveCache::PixelsPerSegment);
+  _shader->setUniform("MaxLevel", static_cast<float>(_maxLevel));
+
+  // Count the triangles of an earlier capture once the GPU has finished it
+  bool measure = !_queryPending;
+  if (_queryPending) {
+    GLint available = 0;
+    glGetQueryObjectiv(_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      glGetQueryObjectuiv(_query, GL_QUERY_RESULT, &_triangles);
+      measure = true;
+    }
+  }
+
+  glEnable(GL_RASTERIZER_DISCARD);
+  glPatchParameteri(GL_PATCH_VERTICES, PatchPoints);
+  glBindVertexArray(_patchVao);
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, _feedback);
+  if (measure) {
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, _query);
+  }
+  glBeginTransformFeedback(GL_TRIANGLES);
+  glDrawArrays(GL_PATCHES, 0, _numPoints);
+  RenderStats::countDraw(GL_PATCHES, _numPoints);
+  glEndTransformFeedback();
+  if (measure) {
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    _queryPending = true;
+  }
+  glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  // Draw the captured triangles with the caller's shader
+  shader->use();
+  glBindVertexArray(_outputVao);
+  glDrawTransformFeedback(GL_TRIANGLES, _feedback);
+  RenderStats::countDraw(GL_TRIANGLES, 3 * _triangles);
+  glBindVertexArray(0);
+}
+
+void BezierPatches::cleanup() {
+  if (_loaded) {
+    glDeleteVertexArrays(1, &_patchVao);
+    glDeleteBuffers(1, &_patchVbo);
+    glDeleteVertexArrays(1, &_outputVao);
+    glDeleteBuffers(1, &_outputVbo);
+    glDeleteTransformFeedbacks(1, &_feedback);
+    glDeleteQueries(1, &_query);
+    _patchVao = _patchVbo = _outputVao = _outputVbo = _feedback = _query = 0;
+    _queryPending = false;
+    _triangles = 0;
+    _loaded = false;
+  }
+  delete _shader;
+  _shader = 0;
+}
+
+}  // namespace agl
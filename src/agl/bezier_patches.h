@@ -0,0 +1,83 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_BEZIER_PATCHES_H_
+#define AGL_BEZIER_PATCHES_H_
+
+#include <vector>
+#include "agl/agl.h"
+#include "agl/aglm.h"
+
+namespace agl {
+
+class Shader;
+
+/**
+ * @brief Bicubic Bezier patches tessellated on the GPU
+ *
+ * Only the control points are uploaded. Each draw runs the tessellation
+ * shaders (shaders/bezier.tcs and bezier.tes), which choose a level for
+ * every patch edge from its length on screen, and captures the resulting
+ * triangles with transform feedback. The triangles are then drawn with
+ * the current shader like any other mesh (position, normal and uv in
+ * attributes 0, 1 and 2), so every shader works with tessellated patches.
+ *
+ * Users do not need to use this class directly.
+ * @see Renderer::teapot()
+ */
+class BezierPatches {
+ public:
+  BezierPatches();
+  ~BezierPatches();
+
+  /**
+   * @brief Compile the shaders and upload the control points
+   * @param points 16 points (x, y, z) per patch, row by row
+   * @return Returns false if the shaders can't be used; nothing is drawn
+   */
+  bool load(const std::vector<GLfloat>& points);
+
+  /** @brief Return whether load() succeeded */
+  bool loaded() const { return _loaded; }
+
+  /**
+   * @brief Tessellate the patches for the given view and draw them
+   * @param modelView Transform from patch to eye coordinates
+   * @param projection The projection (used to measure edges in pixels)
+   * @param viewportHeight The height of the target in pixels
+   * @param shader The shader to draw with; it is active again afterwards
+   */
+  void draw(const glm::mat4& modelView, const glm::mat4& projection,
+      float viewportHeight, Shader* shader);
+
+  /**
+   * @brief Delete the shaders and buffers
+   */
+  void cleanup();
+
+  /**
+   * @brief Highest tessellation level of a patch edge
+   *
+   * Output buffer memory grows with its square (6 MB for 32 teapot
+   * patches at level 32). Set it before load().
+   */
+  static int MaxLevel;
+
+ private:
+  bool _loaded;
+  int _numPoints;
+  int _maxLevel;  // MaxLevel, limited by the driver
+  Shader* _shader;
+  GLuint _patchVao, _patchVbo;
+  GLuint _feedback, _outputVao, _outputVbo;
+
+  // Triangles written by the last capture, read without waiting for it
+  GLuint _query;
+  bool _queryPending;
+  GLuint _triangles;
+
+  BezierPatches(const BezierPatches&) = delete;
+  BezierPatches& operator=(const BezierPatches&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_BEZIER_PATCHES_H_
@@ -0,0 +1,289 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/bvh.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+#include "agl/profiler.h"
+
+namespace agl {
+
+using glm::vec3;
+
+int Bvh::MaxLeafSize = 4;
+
+static const int Bins = 12;
+static const float Infinity = std::numeric_limits<float>::infinity();
+
+static float halfArea(const vec3& min, const vec3& max) {
+  vec3 d = max - min;
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Entry distance of a ray into a node, or infinity if it misses the node
+// before maxT. The origin may be inside.
+static float nodeEntry(const vec3& min, const vec3& max, const vec3& origin,
+    const vec3& invDir, float maxT) {
+  vec3 t0 = (min - origin) * invDir;
+  vec3 t1 = (max - origin) * invDir;
+  vec3 tNear = glm::min(t0, t1);
+  vec3 tFar = glm::max(t0, t1);
+  float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+  float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+  return enter <= exit ? enter : Infinity;
+}
+
+Bvh::Bvh() {
+}
+
+void Bvh::build(const std::vector<Box>& boxes) {
+  _boxes = boxes;
+  rebuild();
+}
+
+void Bvh::insert(const Box& box) {
+  int id = size();
+  _boxes.push_back(box);
+  _trees.emplace_back();
+  _trees.back().leafIds.push_back(id);
+  buildTree(&_trees.back());
+
+  // Like carrying in a binary counter: merge the newest tree into the one
+  // before it until each tree is more than twice the size of the next
+  while (_trees.size() > 1) {
+    Tree& newest = _trees[_trees.size() - 1];
+    Tree& previous = _trees[_trees.size() - 2];
+    if (2 * newest.leafIds.size() < previous.leafIds.size()) break;
+    previous.leafIds.insert(previous.leafIds.end(),
+        newest.leafIds.begin(), newest.leafIds.end());
+    _trees.pop_back();
+    buildTree(&_trees.back());
+  }
+}
+
+void Bvh::clear() {
+  _boxes.clear();
+  _trees.clear();
+}
+
+void Bvh::rebuild() {
+  _trees.clear();
+  if (_boxes.empty()) return;
+  _trees.emplace_back();
+  std::vector<int>& ids = _trees.back().leafIds;
+  ids.resize(_boxes.size());
+  std::iota(ids.begin(), ids.end(), 0);
+  buildTree(&_trees.back());
+}
+
+void Bvh::buildTree(Tree* tree) {
+  AGL_PROFILE_SCOPE("Bvh::buildTree");
+  int n = static_cast<int>(tree->leafIds.size());
+  _centers.resize(_boxes.size());
+  for (int id : tree->leafIds) {
+    _centers[id] = 0.5f * (_boxes[id].min + _boxes[id].max);
+  }
+
+  // Node 1 is unused so that each pair of children starts at an even index
+  tree->nodes.clear();
+  tree->nodes.resize(2);
+  buildNode(tree, 0, 0, n, 0);
+
+  tree->leafBoxes.resize(n);
+  for (int i = 0; i < n; i++) {
+    tree->leafBoxes[i] = _boxes[tree->leafIds[i]];
+  }
+}
+
+void Bvh::buildNode(Tree* tree, int index, int begin, int end, int depth) {
+  vec3 min(Infinity), max(-Infinity);
+  for (int i = begin; i < end; i++) {
+    const Box& box = _boxes[tree->leafIds[i]];
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+  tree->nodes[index] = Node{min, begin, max, end - begin};
+  if (end - begin <= MaxLeafSize) return;
+
+  int mid;
+  splitNode(&tree->leafIds, begin, end, depth, &mid);
+  int child = static_cast<int>(tree->nodes.size());
+  tree->nodes.resize(child + 2);
+  tree->nodes[index].first = child;
+  tree->nodes[index].count = 0;
+  buildNode(tree, child, begin, mid, depth + 1);
+  buildNode(tree, child + 1, mid, end, depth + 1);
+}
+
+void Bvh::splitNode(std::vector<int>* ids, int begin, int end, int depth,
+    int* mid) {
+  std::vector<int>& leafIds = *ids;
+  vec3 cmin(Infinity), cmax(-Infinity);
+  for (int i = begin; i < end; i++) {
+    cmin = glm::min(cmin, _centers[leafIds[i]]);
+    cmax = glm::max(cmax, _centers[leafIds[i]]);
+  }
+  vec3 extent = cmax - cmin;
+
+  // Binned surface area heuristic: the cost of a split is the area of
+  // each side times the number of boxes in it
+  int bestAxis = -1;
+  int bestBin = 0;
+  float bestCost = Infinity;
+  for (int axis = 0; axis < 3 && depth < MaxDepth; axis++) {
+    if (extent[axis] <= 0) continue;
+
+    struct Bin {
+      vec3 min = vec3(Infinity);
+      vec3 max = vec3(-Infinity);
+      int count = 0;
+    } bins[Bins];
+    float scale = Bins / extent[axis];
+    for (int i = begin; i < end; i++) {
+      int id = leafIds[i];
+      int b = std::min(Bins - 1,
+          static_cast<int>((_centers[id][axis] - cmin[axis]) * scale));
+      bins[b].min = glm::min(bins[b].min, _boxes[id].min);
+      bins[b].max = glm::max(bins[b].max, _boxes[id].max);
+      bins[b].count++;
+    }
+
+    // Cost of everything right of each split, then sweep from the left
+    float rightCost[Bins];
+    vec3 min(Infinity), max(-Infinity);
+    int count = 0;
+    for (int b = Bins - 1; b > 0; b--) {
+      min = glm::min(min, bins[b].min);
+      max = glm::max(max, bins[b].max);
+      count += bins[b].count;
+      rightCost[b] = count > 0 ? halfArea(min, max) * count : 0;
+    }
+    min = vec3(Infinity);
+    max = vec3(-Infinity);
+    count = 0;
+    for (int b = 1; b < Bins; b++) {
+      min = glm::min(min, bins[b - 1].min);
+      max = glm::max(max, bins[b - 1].max);
+      count += bins[b - 1].count;
+      float cost = (count > 0 ? halfArea(min, max) * count : 0) + rightCost[b];
+      if (count > 0 && count < end - begin && cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  if (bestAxis >= 0) {
+    float scale = Bins / extent[bestAxis];
+    float low = cmin[bestAxis];
+    int* split = std::partition(&leafIds[begin], &leafIds[0] + end,
+        [&](int id) {
+          int b = std::min(Bins - 1,
+              static_cast<int>((_centers[id][bestAxis] - low) * scale));
+          return b < bestBin;
+        });
+    *mid = static_cast<int>(split - &leafIds[0]);
+    if (*mid > begin && *mid < end) return;
+  }
+
+  // Too deep, or every center coincides: split at the median of the
+  // widest axis, which bounds the depth
+  int axis = 0;
+  if (extent.y > extent[axis]) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+  *mid = (begin + end) / 2;
+  std::nth_element(&leafIds[begin], &leafIds[*mid], &leafIds[0] + end,
+      [&](int a, int b) { return _centers[a][axis] < _centers[b][axis]; });
+}
+
+void Bvh::testBox(const Box& box, int id, const vec3& origin,
+    const vec3& invDir, float* bestT, int* bestId) const {
+  vec3 t0 = (box.min - origin) * invDir;
+  vec3 t1 = (box.max - origin) * invDir;
+  vec3 tNear = glm::min(t0, t1);
+  vec3 tFar = glm::max(t0, t1);
+  float enter = std::max(std::max(tNear.x, tNear.y), tNear.z);
+  float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+  if (enter >= 0 && enter <= exit && enter < *bestT) {
+    *bestT = enter;
+    *bestId = id;
+  }
+}
+
+void Bvh::traverse(const Tree& tree, const vec3& origin,
+    const vec3& invDir, float* bestT, int* bestId) const {
+  const std::vector<Node>& nodes = tree.nodes;
+  if (nodeEntry(nodes[0].min, nodes[0].max, origin, invDir, *bestT) ==
+      Infinity) {
+    return;
+  }
+
+  // Visit the nearer child first and skip nodes beyond the best hit
+  std::pair<int, float> stack[2 * MaxDepth];
+  int top = 0;
+  int node = 0;
+  while (true) {
+    const Node& n = nodes[node];
+    if (n.count > 0) {
+      for (int i = n.first; i < n.first + n.count; i++) {
+        testBox(tree.leafBoxes[i], tree.leafIds[i], origin, invDir,
+            bestT, bestId);
+      }
+    } else {
+      int first = n.first;
+      int second = n.first + 1;
+      float tNear = nodeEntry(nodes[first].min, nodes[first].max,
+          origin, invDir, *bestT);
+      float tFar = nodeEntry(nodes[second].min, nodes[second].max,
+          origin, invDir, *bestT);
+      if (tFar < tNear) {
+        std::swap(first, second);
+        std::swap(tNear, tFar);
+      }
+      if (tNear < Infinity) {
+        if (tFar < Infinity) stack[top++] = std::make_pair(second, tFar);
+        node = first;
+        continue;
+      }
+    }
+
+    node = -1;
+    while (top > 0) {
+      --top;
+      if (stack[top].second < *bestT) {
+        node = stack[top].first;
+        break;
+      }
+    }
+    if (node < 0) break;
+  }
+}
+
+bool Bvh::closestHit(const vec3& origin, const vec3& direction, Hit* hit,
+    float maxT) const {
+  vec3 invDir = 1.0f / direction;
+  float bestT = maxT;
+  int bestId = -1;
+  for (const Tree& tree : _trees) {
+    traverse(tree, origin, invDir, &bestT, &bestId);
+  }
+
+  if (bestId < 0) return false;
+
+  // The face is on the axis where the ray entered last
+  const Box& box = _boxes[bestId];
+  vec3 tNear = glm::min((box.min - origin) * invDir,
+      (box.max - origin) * invDir);
+  int axis = 0;
+  if (tNear.y > tNear[axis]) axis = 1;
+  if (tNear.z > tNear[axis]) axis = 2;
+  hit->id = bestId;
+  hit->t = bestT;
+  hit->normal = vec3(0);
+  hit->normal[axis] = direction[axis] > 0 ? -1.0f : 1.0f;
+  return true;
+}
+
+}  // namespace agl
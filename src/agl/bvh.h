@@ -0,0 +1,130 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_BVH_H_
+#define AGL_BVH_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "agl/aglm.h"
+
+namespace agl {
+
+/**
+ * @brief Bounding volume hierarchy over axis-aligned boxes, for ray picking
+ *
+ * Boxes are identified by the order in which they were added (0, 1, ...).
+ * closestHit() returns the first box along a ray without testing every
+ * box.
+ *
+ * Trees are built top-down, splitting each node where the surface area
+ * heuristic (estimated from 12 bins of box centers per axis) is lowest.
+ * Nodes are 32 bytes and stored in one array per tree, with the children
+ * of a node next to each other so that both are fetched together, and the
+ * boxes of each leaf are stored contiguously.
+ *
+ * insert() builds a tree for the new box, then merges the newest tree into
+ * the previous one, rebuilding it, until each tree is more than twice the
+ * size of the next. There are at most about log2(n) trees, and each box is
+ * rebuilt O(log n) times, so adding boxes one at a time costs O(log^2 n)
+ * amortized whatever their order. Only a merge into the largest tree
+ * rebuilds most boxes, and that happens each time n about doubles. A
+ * query searches every tree, which is O(log^2 n) in the worst case; most
+ * trees are small.
+ * ```
+ * Bvh bvh;
+ * bvh.insert(Bvh::Box{vec3(-1), vec3(1)});
+ * Bvh::Hit hit;
+ * if (bvh.closestHit(eye, direction, &hit)) {
+ *   vec3 point = eye + hit.t * direction;  // on the face with hit.normal
+ * }
+ * ```
+ */
+class Bvh {
+ public:
+  struct Box {
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  struct Hit {
+    int id;            // index of the box
+    float t;           // ray parameter of the hit point
+    glm::vec3 normal;  // outward normal of the face that was hit
+  };
+
+  Bvh();
+
+  /**
+   * @brief Replace all boxes and build the tree
+   */
+  void build(const std::vector<Box>& boxes);
+
+  /**
+   * @brief Add a box; its id is the number of boxes before it
+   */
+  void insert(const Box& box);
+
+  /**
+   * @brief Remove all boxes
+   */
+  void clear();
+
+  /** @brief Return the number of boxes */
+  int size() const { return static_cast<int>(_boxes.size()); }
+
+  /**
+   * @brief Find the first box hit by a ray
+   * @param origin The start of the ray
+   * @param direction The direction of the ray (need not be normalized)
+   * @param hit Receives the closest hit, if any
+   * @param maxT Ignore hits further than origin + maxT * direction
+   * @return Returns false if the ray misses every box
+   *
+   * Boxes containing the origin are not hit.
+   */
+  bool closestHit(const glm::vec3& origin, const glm::vec3& direction,
+      Hit* hit, float maxT = std::numeric_limits<float>::infinity()) const;
+
+  /**
+   * @brief Largest number of boxes in a leaf
+   */
+  static int MaxLeafSize;
+
+ private:
+  struct Node {
+    glm::vec3 min;
+    int32_t first;  // leaf: first box in leafBoxes; inner: first child
+    glm::vec3 max;
+    int32_t count;  // boxes in a leaf, 0 for inner nodes
+  };
+
+  // One tree over some of the boxes
+  struct Tree {
+    std::vector<Node> nodes;     // root first, then pairs of children
+    std::vector<Box> leafBoxes;  // boxes in leaf order
+    std::vector<int> leafIds;    // id of each box in leafBoxes
+  };
+
+  void rebuild();
+  void buildTree(Tree* tree);
+  void buildNode(Tree* tree, int index, int begin, int end, int depth);
+  void splitNode(std::vector<int>* ids, int begin, int end, int depth,
+      int* mid);
+  void traverse(const Tree& tree, const glm::vec3& origin,
+      const glm::vec3& invDir, float* bestT, int* bestId) const;
+  void testBox(const Box& box, int id, const glm::vec3& origin,
+      const glm::vec3& invDir, float* bestT, int* bestId) const;
+
+  // Deeper nodes are split at the median
+  static const int MaxDepth = 64;
+
+  std::vector<Box> _boxes;   // by id
+  std::vector<Tree> _trees;  // largest first
+
+  // Build scratch, by id
+  std::vector<glm::vec3> _centers;
+};
+
+}  // namespace agl
+#endif  // AGL_BVH_H_
@@ -0,0 +1,242 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/dynamic_resolution.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include "agl/render_stats.h"
+#include "agl/renderer.h"
+
+namespace agl {
+
+const float DynamicResolution::Step = 0.05f;
+const float DynamicResolution::Headroom = 0.85f;
+
+static int toLevel(float scale) {
+  int level = static_cast<int>(std::round(scale / DynamicResolution::Step));
+  return std::max(1, level);
+}
+
+DynamicResolution::DynamicResolution(float budgetMs) :
+  _enabled(true),
+  _active(false),
+  _warmingUp(true),
+  _budget(budgetMs),
+  _level(toLevel(1.0f)),
+  _minLevel(toLevel(0.25f)),
+  _maxLevel(toLevel(1.0f)),
+  _gpuTime(0),
+  _fixedTime(0),
+  _otherLevel(0),
+  _otherTime(0),
+  _nextTiming(0),
+  _currentTiming(-1),
+  _fbo(0),
+  _colorTex(0),
+  _depthBuffer(0),
+  _width(0),
+  _height(0),
+  _scaledWidth(0),
+  _scaledHeight(0),
+  _screenFbo(0) {
+  for (Timing& timing : _timings) {
+    timing = Timing{0, 0, _level, false};
+  }
+}
+
+DynamicResolution::~DynamicResolution() {
+  cleanup();
+}
+
+void DynamicResolution::setEnabled(bool enabled) {
+  assert(!_active);
+  if (enabled && !_enabled) _warmingUp = true;
+  _enabled = enabled;
+}
+
+void DynamicResolution::setScaleRange(float minScale, float maxScale) {
+  _minLevel = toLevel(minScale);
+  _maxLevel = std::max(_minLevel, toLevel(maxScale));
+  _level = std::max(_minLevel, std::min(_maxLevel, _level));
+}
+
+void DynamicResolution::cleanup() {
+  if (_timings[0].begin != 0) {
+    for (Timing& timing : _timings) {
+      glDeleteQueries(1, &timing.begin);
+      glDeleteQueries(1, &timing.end);
+      timing = Timing{0, 0, _level, false};
+    }
+  }
+  if (_fbo != 0) {
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteTextures(1, &_colorTex);
+    glDeleteRenderbuffers(1, &_depthBuffer);
+    _fbo = _colorTex = _depthBuffer = 0;
+    _width = _height = 0;
+  }
+}
+
+void DynamicResolution::begin() {
+  assert(!_active);
+  if (!_enabled) return;
+  _active = true;
+
+  if (_timings[0].begin == 0) {
+    for (Timing& timing : _timings) {
+      glGenQueries(1, &timing.begin);
+      glGenQueries(1, &timing.end);
+    }
+  }
+  collect();
+
+  glGetIntegerv(GL_VIEWPORT, _viewport);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_screenFbo);
+  if (_viewport[2] != _width || _viewport[3] != _height) {
+    resizeTarget(_viewport[2], _viewport[3]);
+  }
+  _scaledWidth = std::max(1, static_cast<int>(_width * scale() + 0.5f));
+  _scaledHeight = std::max(1, static_cast<int>(_height * scale() + 0.5f));
+
+  // Skip measuring when every query is still waiting for the GPU
+  Timing& timing = _timings[_nextTiming];
+  _currentTiming = -1;
+  if (!timing.pending) {
+    glQueryCounter(timing.begin, GL_TIMESTAMP);
+    timing.level = _level;
+    _currentTiming = _nextTiming;
+    _nextTiming = (_nextTiming + 1) % MaxTimings;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  RenderStats::countFramebuffer();
+  glViewport(0, 0, _scaledWidth, _scaledHeight);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DynamicResolution::end(Renderer& renderer, int slot) {
+  if (!_active) return;
+  _active = false;
+
+  if (_currentTiming >= 0) {
+    Timing& timing = _timings[_currentTiming];
+    glQueryCounter(timing.end, GL_TIMESTAMP);
+    timing.pending = true;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _screenFbo);
+  RenderStats::countFramebuffer();
+  glViewport(_viewport[0], _viewport[1], _viewport[2], _viewport[3]);
+
+  glActiveTexture(GL_TEXTURE0 + slot);
+  glBindTexture(GL_TEXTURE_2D, _colorTex);
+  RenderStats::countTexture();
+
+  // Stop at the centers of the outermost drawn texels, so filtering never
+  // reaches the undrawn part of the target
+  glm::vec2 size(_width, _height);
+  glm::vec2 drawn(_scaledWidth, _scaledHeight);
+  renderer.beginShader("upscale");
+  renderer.setUniform("Image", slot);
+  renderer.setUniform("UvScale", drawn / size);
+  renderer.setUniform("UvMax", (drawn - 0.5f) / size);
+  renderer.fullscreen();
+  renderer.endShader();
+}
+
+void DynamicResolution::collect() {
+  // Frames finish in order, so stop at the first one still in flight
+  for (int i = 0; i < MaxTimings; i++) {
+    Timing& timing = _timings[(_nextTiming + i) % MaxTimings];
+    if (!timing.pending) continue;
+
+    GLint available = 0;
+    glGetQueryObjectiv(timing.end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) break;
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(timing.begin, GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(timing.end, GL_QUERY_RESULT, &end);
+    timing.pending = false;
+    if (_warmingUp) {
+      _warmingUp = false;
+    } else {
+      adjust(timing.level, static_cast<float>(end - begin) * 1e-6f);
+    }
+  }
+}
+
+void DynamicResolution::adjust(int level, float ms) {
+  _gpuTime = ms;
+  if (ms <= 0) return;
+
+  // Frame time is modeled as a fixed part (e.g. shadow maps) plus a part
+  // proportional to the pixel count, i.e. to the square of the scale. Two
+  // samples at different scales give the fixed part.
+  float area = static_cast<float>(level * level);
+  if (_otherLevel > 0 && _otherLevel != level) {
+    float otherArea = static_cast<float>(_otherLevel * _otherLevel);
+    float perArea = (ms - _otherTime) / (area - otherArea);
+    if (perArea > 0) {
+      float fixed = std::max(0.0f, std::min(ms, ms - perArea * area));
+      _fixedTime = 0.5f * (_fixedTime + fixed);
+    }
+  }
+  _otherLevel = level;
+  _otherTime = ms;
+
+  float fixed = std::min(_fixedTime, 0.9f * ms);
+  float target = Headroom * _budget;
+  if (ms > _budget) {
+    // Drop straight to the largest scale predicted to fit
+    int fitLevel = _minLevel;
+    if (target > fixed) {
+      float fit = level * std::sqrt((target - fixed) / (ms - fixed));
+      fitLevel = static_cast<int>(std::floor(fit));
+    }
+    _level = std::max(_minLevel, std::min(_level, fitLevel));
+  } else if (level == _level && _level < _maxLevel) {
+    // Only frames drawn at the current scale say whether the next one fits
+    float ratio = static_cast<float>(level + 1) / level;
+    if (fixed + (ms - fixed) * ratio * ratio < target) _level++;
+  }
+}
+
+void DynamicResolution::resizeTarget(int width, int height) {
+  if (_fbo == 0) {
+    glGenFramebuffers(1, &_fbo);
+    glGenTextures(1, &_colorTex);
+    glGenRenderbuffers(1, &_depthBuffer);
+  }
+  _width = width;
+  _height = height;
+
+  glBindTexture(GL_TEXTURE_2D, _colorTex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+      GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, _colorTex, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER, _depthBuffer);
+  GLenum drawBuffer = GL_COLOR_ATTACHMENT0;
+  glDrawBuffers(1, &drawBuffer);
+
+  GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (result != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "WARNING: dynamic resolution framebuffer error: " <<
+        result << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, _screenFbo);
+}
+
+}  // namespace agl
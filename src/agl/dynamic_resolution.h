@@ -0,0 +1,143 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_DYNAMIC_RESOLUTION_H_
+#define AGL_DYNAMIC_RESOLUTION_H_
+
+#include "agl/agl.h"
+
+namespace agl {
+
+class Renderer;
+
+/**
+ * @brief Renders at a reduced resolution to hold a GPU time budget
+ *
+ * Between begin() and end(), drawing goes to an offscreen color and depth
+ * target covering a fraction of the viewport. end() stretches that image
+ * over the viewport with bilinear filtering, so anything drawn afterwards
+ * (text, overlays) is still at full resolution.
+ *
+ * The GPU time between begin() and end() is measured with timestamp
+ * queries, which are read a few frames later so that the CPU never waits
+ * for them. Frame time is modeled as a fixed part plus a part proportional
+ * to the pixel count, fitted from frames drawn at different scales. When a
+ * frame goes over the budget, the scale drops straight to the size
+ * predicted to fit. When the next step up is predicted to fit too, the
+ * scale rises one step at a time. Steps are coarse (Step), so render
+ * targets sized from the viewport don't change every frame.
+ * ```
+ * // draw()
+ * _resolution.begin();
+ * _graph.execute();              // sees a smaller viewport and screen
+ * _resolution.end(renderer, 8);  // upscales using texture unit 8
+ * renderer.text("HUD", 10, 25);  // full resolution
+ * ```
+ * The offscreen target isn't multisampled. While disabled, begin() and
+ * end() do nothing, so drawing goes straight to the current framebuffer.
+ */
+class DynamicResolution {
+ public:
+  /**
+   * @brief Create a scaler for the given GPU budget in milliseconds
+   */
+  explicit DynamicResolution(float budgetMs = 16.6f);
+  ~DynamicResolution();
+
+  /**
+   * @brief Redirect drawing to the scaled target (if enabled)
+   *
+   * The target is sized to the current viewport, and the viewport is set to
+   * its scaled part, which is cleared.
+   */
+  void begin();
+
+  /**
+   * @brief Restore the framebuffer and viewport of begin() and draw the
+   * scaled image over it
+   * @param slot The texture unit used to sample the image
+   */
+  void end(Renderer& renderer, int slot);
+
+  /**
+   * @brief Turn scaling on or off (between frames only)
+   */
+  void setEnabled(bool enabled);
+  bool enabled() const { return _enabled; }
+
+  /**
+   * @brief Set the GPU time, in milliseconds, that frames should fit in
+   */
+  void setBudget(float ms) { _budget = ms; }
+  float budget() const { return _budget; }
+
+  /**
+   * @brief Limit the scale, as fractions of the viewport size
+   *
+   * Both limits are rounded to multiples of Step.
+   */
+  void setScaleRange(float minScale, float maxScale);
+
+  /** @brief Return the fraction of the viewport width and height drawn */
+  float scale() const { return _level * Step; }
+
+  /** @brief Return the GPU time of the last measured frame, in ms */
+  float gpuTime() const { return _gpuTime; }
+
+  /**
+   * @brief Delete the target and the queries
+   */
+  void cleanup();
+
+  /** @brief Smallest change of scale */
+  static const float Step;
+
+  /**
+   * @brief Fraction of the budget that adjustments aim for
+   *
+   * Frames between this and the full budget leave the scale unchanged.
+   */
+  static const float Headroom;
+
+ private:
+  // Timestamps around one frame, and the scale it was drawn at
+  struct Timing {
+    GLuint begin, end;
+    int level;
+    bool pending;
+  };
+
+  void collect();
+  void adjust(int level, float ms);
+  void resizeTarget(int width, int height);
+
+  static const int MaxTimings = 4;  // frames in flight before skipping
+
+  bool _enabled;
+  bool _active;  // between begin() and end()
+  bool _warmingUp;  // ignore the first frame, which may compile shaders
+  float _budget;
+  int _level, _minLevel, _maxLevel;  // scale in units of Step
+  float _gpuTime;
+
+  // Cost model: estimated fixed time, and the last sample, which is at a
+  // different level whenever the level has just changed
+  float _fixedTime;
+  int _otherLevel;
+  float _otherTime;
+
+  Timing _timings[MaxTimings];
+  int _nextTiming;
+  int _currentTiming;  // -1 when this frame isn't measured
+
+  GLuint _fbo, _colorTex, _depthBuffer;
+  int _width, _height;              // target size (the full viewport)
+  int _scaledWidth, _scaledHeight;  // part drawn this frame
+  GLint _viewport[4];               // restored by end()
+  GLint _screenFbo;
+
+  DynamicResolution(const DynamicResolution&) = delete;
+  DynamicResolution& operator=(const DynamicResolution&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_DYNAMIC_RESOLUTION_H_
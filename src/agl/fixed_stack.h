@@ -0,0 +1,53 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_FIXED_STACK_H_
+#define AGL_FIXED_STACK_H_
+
+#include <cassert>
+
+namespace agl {
+
+/**
+ * @brief A stack with storage for N items allocated inline
+ *
+ * Pushing and popping never touch the heap. push() returns false instead of
+ * growing when the stack is full.
+ */
+template <typename T, int N>
+class FixedStack {
+ public:
+  FixedStack() : _size(0) {}
+
+  bool push(const T& item) {
+    if (_size == N) return false;
+    _items[_size++] = item;
+    return true;
+  }
+
+  void pop() {
+    assert(_size > 0);
+    _size--;
+  }
+
+  T& top() {
+    assert(_size > 0);
+    return _items[_size - 1];
+  }
+
+  const T& top() const {
+    assert(_size > 0);
+    return _items[_size - 1];
+  }
+
+  int size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  void clear() { _size = 0; }
+  static int capacity() { return N; }
+
+ private:
+  T _items[N];
+  int _size;
+};
+
+}  // namespace agl
+#endif  // AGL_FIXED_STACK_H_
@@ -0,0 +1,97 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/frame_arena.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef AGL_COUNT_ALLOCATIONS
+#include <atomic>
+
+static std::atomic<size_t> theAllocationCount(0);
+
+void* operator new(size_t size) {
+  theAllocationCount++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  theAllocationCount++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+#endif
+
+namespace agl {
+
+size_t heapAllocationCount() {
+#ifdef AGL_COUNT_ALLOCATIONS
+  return theAllocationCount.load();
+#else
+  return 0;
+#endif
+}
+
+FrameArena::FrameArena(size_t capacity) :
+  _data(0),
+  _capacity(capacity),
+  _offset(0),
+  _used(0) {
+  _data = static_cast<unsigned char*>(malloc(_capacity));
+}
+
+FrameArena::~FrameArena() {
+  reset();
+  free(_data);
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+  size_t start = (_offset + alignment - 1) & ~(alignment - 1);
+  _used += bytes;
+  if (start + bytes <= _capacity) {
+    _offset = start + bytes;
+    return _data + start;
+  }
+
+  // Out of room this frame: fall back to the heap and grow on reset()
+  void* p = malloc(bytes + alignment);
+  _overflow.push_back(p);
+  size_t addr = reinterpret_cast<size_t>(p);
+  return reinterpret_cast<void*>((addr + alignment - 1) & ~(alignment - 1));
+}
+
+void FrameArena::reset() {
+  if (!_overflow.empty()) {
+    for (void* p : _overflow) {
+      free(p);
+    }
+    _overflow.clear();
+
+    // Leave headroom for alignment padding
+    _capacity = _used + _used / 4;
+    free(_data);
+    _data = static_cast<unsigned char*>(malloc(_capacity));
+  }
+  _offset = 0;
+  _used = 0;
+}
+
+}  // namespace agl
@@ -0,0 +1,73 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_FRAME_ARENA_H_
+#define AGL_FRAME_ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace agl {
+
+/**
+ * @brief Linear allocator for memory that only lives for one frame
+ *
+ * Allocations bump a pointer inside one preallocated block and are all
+ * released together by reset(), which Renderer calls at the start of every
+ * frame. If a frame needs more memory than the block holds, the extra
+ * requests are served from the heap and the block grows to the high-water
+ * mark on the next reset, so steady-state frames never touch the heap.
+ *
+ * Memory from the arena is not initialized and destructors are never run;
+ * only use it for plain data.
+ * @see Renderer::frameArena()
+ */
+class FrameArena {
+ public:
+  explicit FrameArena(size_t capacity = 1 << 20);
+  ~FrameArena();
+
+  /**
+   * @brief Allocate bytes that stay valid until the next reset()
+   */
+  void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+  /**
+   * @brief Allocate an array of count uninitialized objects
+   */
+  template <typename T>
+  T* allocate(size_t count) {
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  /**
+   * @brief Release every allocation made since the last reset
+   */
+  void reset();
+
+  /** @brief Return the number of bytes allocated since the last reset */
+  size_t used() const { return _used; }
+
+  /** @brief Return the size of the preallocated block in bytes */
+  size_t capacity() const { return _capacity; }
+
+ private:
+  unsigned char* _data;
+  size_t _capacity;
+  size_t _offset;
+  size_t _used;
+  std::vector<void*> _overflow;  // heap blocks used when _data runs out
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+};
+
+/**
+ * @brief Return the number of calls to global operator new so far
+ *
+ * Only counted when built with AGL_COUNT_ALLOCATIONS; returns 0 otherwise.
+ * Window uses this to assert that steady-state frames don't allocate.
+ */
+size_t heapAllocationCount();
+
+}  // namespace agl
+#endif  // AGL_FRAME_ARENA_H_
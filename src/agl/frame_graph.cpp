@@ -0,0 +1,562 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/frame_graph.h"
+#include <cassert>
+#include <iostream>
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
+
+namespace agl {
+
+int FrameGraph::PoolLifetime = 3;
+
+static const int MaxAttachments = 8;
+
+static bool isDepth(FrameGraph::Format format) {
+  return format == FrameGraph::DEPTH24;
+}
+
+static size_t bytesPerPixel(FrameGraph::Format format) {
+  switch (format) {
+    case FrameGraph::RGBA16F: return 8;
+    default: return 4;
+  }
+}
+
+FrameGraph::Pass::Pass(FrameGraph* graph, const std::string& name,
+    const std::function<void()>& run) :
+  _graph(graph),
+  _name(name),
+  _run(run),
+  _screen(false),
+  _sideEffect(false),
+  _enabled(true),
+  _fbo(0) {
+}
+
+FrameGraph::Pass& FrameGraph::Pass::write(const std::string& name,
+    Format format, int width, int height) {
+  // The resource may already exist because it was exported or read
+  int id = _graph->resource(name);
+  Resource& res = _graph->_resources[id];
+  if (!res.declared) {
+    res.format = format;
+    res.width = width;
+    res.height = height;
+    res.declared = true;
+  }
+  _writes.push_back(id);
+  _graph->_dirty = true;
+  return *this;
+}
+
+FrameGraph::Pass& FrameGraph::Pass::read(const std::string& name,
+    int slot, bool depthCompare) {
+  _reads.push_back(Read{_graph->resource(name), slot, depthCompare});
+  _graph->_dirty = true;
+  return *this;
+}
+
+FrameGraph::Pass& FrameGraph::Pass::copy(const std::string& source,
+    const std::string& target) {
+  // The source is read (slot -1 means it isn't bound for sampling)
+  int sourceId = _graph->resource(source);
+  _reads.push_back(Read{sourceId, -1, false});
+  _copies.push_back(std::make_pair(sourceId, _graph->resource(target)));
+  _graph->_dirty = true;
+  return *this;
+}
+
+FrameGraph::Pass& FrameGraph::Pass::writeScreen() {
+  _screen = true;
+  _graph->_dirty = true;
+  return *this;
+}
+
+FrameGraph::Pass& FrameGraph::Pass::sideEffect() {
+  _sideEffect = true;
+  _graph->_dirty = true;
+  return *this;
+}
+
+FrameGraph::Pass& FrameGraph::Pass::setEnabled(bool enabled) {
+  if (enabled != _enabled) {
+    _enabled = enabled;
+    _graph->_dirty = true;
+  }
+  return *this;
+}
+
+FrameGraph::FrameGraph() :
+    _copyFbo(0), _screenFbo(0), _dirty(true), _frame(0) {
+}
+
+FrameGraph::~FrameGraph() {
+  cleanup();
+}
+
+FrameGraph::Pass& FrameGraph::addPass(const std::string& name,
+    const std::function<void()>& run) {
+  _passes.push_back(new Pass(this, name, run));
+  _dirty = true;
+  return *_passes.back();
+}
+
+int FrameGraph::resource(const std::string& name) {
+  auto it = _resourceIds.find(name);
+  if (it != _resourceIds.end()) return it->second;
+
+  Resource res;
+  res.name = name;
+  res.format = RGBA8;
+  res.width = 0;
+  res.height = 0;
+  res.imported = false;
+  res.exported = false;
+  res.declared = false;
+  res.texId = 0;
+  res.first = -1;
+  res.last = -1;
+  _resources.push_back(res);
+
+  int id = static_cast<int>(_resources.size()) - 1;
+  _resourceIds[name] = id;
+  return id;
+}
+
+void FrameGraph::importTexture(const std::string& name, GLuint texId,
+    Format format, int width, int height) {
+  Resource& res = _resources[resource(name)];
+  res.imported = true;
+  res.declared = true;
+  res.texId = texId;
+  res.format = format;
+  res.width = width;
+  res.height = height;
+  _dirty = true;
+}
+
+void FrameGraph::exportTexture(const std::string& name) {
+  _resources[resource(name)].exported = true;
+  _dirty = true;
+}
+
+GLuint FrameGraph::texture(const std::string& name) const {
+  auto it = _resourceIds.find(name);
+  if (it == _resourceIds.end()) return 0;
+  return _resources[it->second].texId;
+}
+
+void FrameGraph::compile() {
+  int numPasses = static_cast<int>(_passes.size());
+  for (Resource& res : _resources) {
+    res.writers.clear();
+    res.readers.clear();
+  }
+  for (int i = 0; i < numPasses; i++) {
+    Pass* pass = _passes[i];
+    if (!pass->_enabled) continue;
+    for (int id : pass->_writes) _resources[id].writers.push_back(i);
+    for (const Pass::Read& read : pass->_reads) {
+      _resources[read.resource].readers.push_back(i);
+    }
+  }
+
+  // A pass depends on every writer of what it reads, and on earlier
+  // writers of what it writes. Scratch arrays are members so that
+  // enabling or disabling passes every so often doesn't allocate.
+  std::vector<std::vector<int>>& deps = _deps;
+  if (deps.size() < _passes.size()) deps.resize(_passes.size());
+  for (int i = 0; i < numPasses; i++) deps[i].clear();
+  for (int i = 0; i < numPasses; i++) {
+    Pass* pass = _passes[i];
+    if (!pass->_enabled) continue;
+    for (const Pass::Read& read : pass->_reads) {
+      const Resource& res = _resources[read.resource];
+      if (res.writers.empty() && !res.imported && !res.exported) {
+        std::cout << "WARNING: pass " << pass->_name << " reads " <<
+            res.name << " but no pass writes it\n";
+      }
+      for (int writer : res.writers) {
+        if (writer != i) deps[i].push_back(writer);
+      }
+    }
+    for (int id : pass->_writes) {
+      for (int writer : _resources[id].writers) {
+        if (writer < i) deps[i].push_back(writer);
+      }
+    }
+  }
+
+  // Cull: keep passes that reach the screen, an exported or imported
+  // texture, or have side effects
+  std::vector<bool>& live = _live;
+  live.assign(numPasses, false);
+  std::vector<int>& stack = _stack;
+  stack.clear();
+  for (int i = 0; i < numPasses; i++) {
+    Pass* pass = _passes[i];
+    if (!pass->_enabled) continue;
+    bool root = pass->_screen || pass->_sideEffect;
+    for (int id : pass->_writes) {
+      root = root || _resources[id].imported || _resources[id].exported;
+    }
+    if (root) {
+      live[i] = true;
+      stack.push_back(i);
+    }
+  }
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+    for (int dep : deps[i]) {
+      if (!live[dep]) {
+        live[dep] = true;
+        stack.push_back(dep);
+      }
+    }
+  }
+
+  // Order: repeatedly run the earliest declared pass whose dependencies
+  // have all run
+  _order.clear();
+  std::vector<bool>& done = _done;
+  done.assign(numPasses, false);
+  for (int count = 0; count < numPasses; count++) {
+    int next = -1;
+    for (int i = 0; i < numPasses && next == -1; i++) {
+      if (!live[i] || done[i]) continue;
+      bool ready = true;
+      for (int dep : deps[i]) ready = ready && done[dep];
+      if (ready) next = i;
+    }
+    if (next == -1) break;
+    done[next] = true;
+    _order.push_back(next);
+  }
+  for (int i = 0; i < numPasses; i++) {
+    if (live[i] && !done[i]) {
+      std::cout << "WARNING: pass " << _passes[i]->_name <<
+          " is part of a dependency cycle\n";
+      _order.push_back(i);
+    }
+  }
+
+  // Lifetimes of transient textures, as positions in _order
+  for (Resource& res : _resources) {
+    res.first = -1;
+    res.last = -1;
+  }
+  int numOrdered = static_cast<int>(_order.size());
+  for (int i = 0; i < numOrdered; i++) {
+    Pass* pass = _passes[_order[i]];
+    auto use = [this, i](int id) {
+      Resource& res = _resources[id];
+      if (res.imported) return;
+      if (res.first == -1) res.first = i;
+      res.last = i;
+    };
+    for (int id : pass->_writes) use(id);
+    for (const Pass::Read& read : pass->_reads) use(read.resource);
+  }
+  for (Resource& res : _resources) {
+    if (res.exported && res.first != -1) res.last = numOrdered - 1;
+  }
+
+  _dirty = false;
+}
+
+void FrameGraph::acquire(Resource* res, const GLint viewport[4]) {
+  if (res->imported || res->texId != 0) return;
+
+  int width = res->width > 0 ? res->width : viewport[2];
+  int height = res->height > 0 ? res->height : viewport[3];
+  for (PooledTexture& tex : _pool) {
+    if (!tex.inUse && tex.format == res->format &&
+        tex.width == width && tex.height == height) {
+      tex.inUse = true;
+      tex.lastFrame = _frame;
+      res->texId = tex.texId;
+      return;
+    }
+  }
+
+  static const GLenum internalFormats[] = {GL_RGBA8, GL_RGBA16F,
+      GL_DEPTH_COMPONENT24};
+  GLuint texId;
+  glGenTextures(1, &texId);
+  glBindTexture(GL_TEXTURE_2D, texId);
+  glTexStorage2D(GL_TEXTURE_2D, 1, internalFormats[res->format],
+      width, height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  _pool.push_back(PooledTexture{texId, res->format, width, height,
+      true, _frame});
+  res->texId = texId;
+}
+
+void FrameGraph::release(Resource* res) {
+  if (res->imported || res->exported || res->texId == 0) return;
+
+  for (PooledTexture& tex : _pool) {
+    if (tex.texId == res->texId) {
+      tex.inUse = false;
+      break;
+    }
+  }
+  res->texId = 0;
+}
+
+void FrameGraph::bindTargets(Pass* pass, const GLint viewport[4]) {
+  // Passes without outputs (e.g. side effects only) also get the screen
+  assert(!pass->_screen || pass->_writes.empty());
+  if (pass->_writes.empty()) {
+    glBindFramebuffer(GL_FRAMEBUFFER, _screenFbo);
+    RenderStats::countFramebuffer();
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    return;
+  }
+
+  // Color attachments in declaration order, then the depth attachment
+  GLuint textures[MaxAttachments + 1] = {0};
+  int numColors = 0;
+  const Resource* sizeFrom = 0;
+  for (int id : pass->_writes) {
+    const Resource& res = _resources[id];
+    if (isDepth(res.format)) {
+      textures[MaxAttachments] = res.texId;
+    } else if (numColors < MaxAttachments) {
+      textures[numColors++] = res.texId;
+    }
+    if (!sizeFrom) sizeFrom = &res;
+  }
+
+  bool changed = pass->_fboTextures.size() != MaxAttachments + 1;
+  for (int i = 0; !changed && i <= MaxAttachments; i++) {
+    changed = pass->_fboTextures[i] != textures[i];
+  }
+
+  if (changed) {
+    // Pooled textures were reassigned (e.g. the window was resized)
+    if (pass->_fbo != 0) glDeleteFramebuffers(1, &pass->_fbo);
+    glGenFramebuffers(1, &pass->_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, pass->_fbo);
+    RenderStats::countFramebuffer();
+
+    GLenum drawBuffers[MaxAttachments];
+    for (int i = 0; i < numColors; i++) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+          GL_TEXTURE_2D, textures[i], 0);
+      drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+    if (textures[MaxAttachments] != 0) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+          GL_TEXTURE_2D, textures[MaxAttachments], 0);
+    }
+    if (numColors > 0) {
+      glDrawBuffers(numColors, drawBuffers);
+    } else {
+      GLenum none = GL_NONE;
+      glDrawBuffers(1, &none);
+    }
+
+    GLenum result = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (result != GL_FRAMEBUFFER_COMPLETE) {
+      std::cout << "Framebuffer error in pass " << pass->_name << ": " <<
+          result << std::endl;
+    }
+    pass->_fboTextures.assign(textures, textures + MaxAttachments + 1);
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER, pass->_fbo);
+    RenderStats::countFramebuffer();
+  }
+
+  int width = sizeFrom->width > 0 || sizeFrom->imported ?
+      sizeFrom->width : viewport[2];
+  int height = sizeFrom->height > 0 || sizeFrom->imported ?
+      sizeFrom->height : viewport[3];
+  glViewport(0, 0, width, height);
+}
+
+void FrameGraph::execute() {
+  if (_dirty) compile();
+
+  // "The screen" is whatever was bound, e.g. a Renderer render texture
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint screenFbo = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screenFbo);
+  _screenFbo = screenFbo;
+
+  int numOrdered = static_cast<int>(_order.size());
+  for (int i = 0; i < numOrdered; i++) {
+    Pass* pass = _passes[_order[i]];
+    AGL_PROFILE_GPU_SCOPE(Profiler::intern(pass->_name));
+
+    for (int id : pass->_writes) acquire(&_resources[id], viewport);
+    for (const Pass::Read& read : pass->_reads) {
+      acquire(&_resources[read.resource], viewport);
+    }
+    bindTargets(pass, viewport);
+
+    // Pooled memory holds whatever the last user left, so clear targets
+    // the first time they are written this frame unless they are copied
+    int color = 0;
+    for (int id : pass->_writes) {
+      const Resource& res = _resources[id];
+      bool depth = isDepth(res.format);
+      bool copied = false;
+      for (const auto& copy : pass->_copies) copied = copied || copy.second == id;
+      if (res.first == i && !copied) {
+        if (depth) {
+          GLfloat one = 1.0f;
+          glClearBufferfv(GL_DEPTH, 0, &one);
+        } else {
+          GLfloat zero[] = {0, 0, 0, 0};
+          glClearBufferfv(GL_COLOR, color, zero);
+        }
+      }
+      if (!depth) color++;
+    }
+
+    for (const auto& copy : pass->_copies) {
+      copyTexture(pass, _resources[copy.first], _resources[copy.second]);
+    }
+
+    for (const Pass::Read& read : pass->_reads) {
+      const Resource& res = _resources[read.resource];
+      if (read.slot < 0) continue;
+      glActiveTexture(GL_TEXTURE0 + read.slot);
+      glBindTexture(GL_TEXTURE_2D, res.texId);
+      RenderStats::countTexture();
+      if (isDepth(res.format)) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+            read.depthCompare ? GL_COMPARE_REF_TO_TEXTURE : GL_NONE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+      }
+    }
+
+    if (pass->_run) pass->_run();
+
+    for (int id : pass->_writes) {
+      if (_resources[id].last == i) release(&_resources[id]);
+    }
+    for (const Pass::Read& read : pass->_reads) {
+      if (_resources[read.resource].last == i) {
+        release(&_resources[read.resource]);
+      }
+    }
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _screenFbo);
+  RenderStats::countFramebuffer();
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+  // Release pooled textures that have gone unused, e.g. after a resize
+  for (size_t i = 0; i < _pool.size();) {
+    PooledTexture& tex = _pool[i];
+    if (!tex.inUse && _frame - tex.lastFrame > PoolLifetime) {
+      glDeleteTextures(1, &tex.texId);
+      _pool[i] = _pool.back();
+      _pool.pop_back();
+    } else {
+      if (tex.inUse) tex.lastFrame = _frame;
+      i++;
+    }
+  }
+  _frame++;
+}
+
+void FrameGraph::copyTexture(Pass* pass, const Resource& source,
+    const Resource& target) {
+  if (_copyFbo == 0) glGenFramebuffers(1, &_copyFbo);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  int width = viewport[2];
+  int height = viewport[3];
+
+  bool depth = isDepth(source.format);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, _copyFbo);
+  RenderStats::countFramebuffer();
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER,
+      depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, source.texId, 0);
+  if (!depth) {
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    // Only copy into the target's attachment
+    int index = 0;
+    for (int id : pass->_writes) {
+      if (&_resources[id] == &target) break;
+      if (!isDepth(_resources[id].format)) index++;
+    }
+    GLenum drawBuffer = GL_COLOR_ATTACHMENT0 + index;
+    glDrawBuffers(1, &drawBuffer);
+  }
+
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+      depth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER,
+      depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, 0, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, pass->_fbo);
+  RenderStats::countFramebuffer();
+
+  if (!depth) {
+    // Restore the pass's draw buffers
+    GLenum drawBuffers[MaxAttachments];
+    int numColors = 0;
+    for (int id : pass->_writes) {
+      if (!isDepth(_resources[id].format) && numColors < MaxAttachments) {
+        drawBuffers[numColors] = GL_COLOR_ATTACHMENT0 + numColors;
+        numColors++;
+      }
+    }
+    glDrawBuffers(numColors, drawBuffers);
+  }
+}
+
+size_t FrameGraph::pooledBytes() const {
+  size_t bytes = 0;
+  for (const PooledTexture& tex : _pool) {
+    bytes += bytesPerPixel(tex.format) * tex.width * tex.height;
+  }
+  return bytes;
+}
+
+void FrameGraph::clear() {
+  for (Pass* pass : _passes) {
+    if (pass->_fbo != 0) glDeleteFramebuffers(1, &pass->_fbo);
+    delete pass;
+  }
+  _passes.clear();
+
+  // Exported textures still belong to the pool
+  for (Resource& res : _resources) {
+    res.exported = false;
+    release(&res);
+  }
+  _resources.clear();
+  _resourceIds.clear();
+  _order.clear();
+  _dirty = true;
+}
+
+void FrameGraph::cleanup() {
+  clear();
+  for (PooledTexture& tex : _pool) {
+    glDeleteTextures(1, &tex.texId);
+  }
+  _pool.clear();
+  if (_copyFbo != 0) {
+    glDeleteFramebuffers(1, &_copyFbo);
+    _copyFbo = 0;
+  }
+}
+
+}  // namespace agl
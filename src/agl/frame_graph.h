@@ -0,0 +1,247 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_FRAME_GRAPH_H_
+#define AGL_FRAME_GRAPH_H_
+
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief Sequences multi-pass frames and pools their render targets
+ *
+ * Each pass declares the textures it renders into and the textures it
+ * samples, plus a function that issues its draw calls. When executed, the
+ * graph:
+ *
+ * - culls passes whose results are never used by the screen, an exported
+ *   texture, or a pass marked with sideEffect()
+ * - orders the remaining passes so that every texture is written before it
+ *   is read (ties keep declaration order)
+ * - assigns each transient texture a physical texture from a pool for the
+ *   span of passes that use it, so targets whose lifetimes don't overlap
+ *   share the same GPU memory
+ * - binds a framebuffer for each pass's outputs, sets the viewport, binds
+ *   sampled textures to their slots, and clears outputs when they are first
+ *   written
+ *
+ * Passes are usually declared once in setup() and executed every frame.
+ * Pooled textures that go unused for a few frames are released.
+ *
+ * ```
+ * _graph.addPass("shadow", [this]() { drawCasters(); })
+ *     .write("shadowMap", FrameGraph::DEPTH24, 2048, 2048);
+ * _graph.addPass("scene", [this]() { drawScene(); })
+ *     .read("shadowMap", 5, true)
+ *     .writeScreen();
+ * ...
+ * _graph.execute();  // in draw()
+ * ```
+ */
+class FrameGraph {
+ public:
+  /**
+   * @brief Internal formats for graph textures
+   */
+  enum Format {
+    RGBA8 = 0,
+    RGBA16F,
+    DEPTH24
+  };
+
+  /**
+   * @brief A pass and its declared inputs and outputs
+   */
+  class Pass {
+   public:
+    /**
+     * @brief Declare a texture that this pass renders into
+     * @param width The texture width; values <= 0 use the viewport width
+     * @param height The texture height; values <= 0 use the viewport height
+     *
+     * The first pass to write a texture declares its size and format; later
+     * writers may pass any format and size because they are ignored.
+     */
+    Pass& write(const std::string& name, Format format,
+        int width = 0, int height = 0);
+
+    /**
+     * @brief Declare a texture that this pass samples
+     * @param slot The texture unit the texture is bound to during the pass
+     * @param depthCompare For depth textures, enable compare mode so the
+     *   texture can be sampled with sampler2DShadow
+     */
+    Pass& read(const std::string& name, int slot, bool depthCompare = false);
+
+    /**
+     * @brief Start an output of this pass as a copy of another texture
+     *
+     * The copy replaces the usual clear on first write, so the pass can
+     * draw on top of cached contents (e.g. a static shadow map). Both
+     * textures must have the same format and size.
+     */
+    Pass& copy(const std::string& source, const std::string& target);
+
+    /**
+     * @brief Render this pass into the screen
+     *
+     * The screen is the framebuffer bound when execute() is called: normally
+     * the window, or a render texture (see Renderer::beginRenderTexture).
+     * Passes that write to the screen are never culled.
+     */
+    Pass& writeScreen();
+
+    /**
+     * @brief Never cull this pass, even if nothing reads its outputs
+     */
+    Pass& sideEffect();
+
+    /**
+     * @brief Skip this pass (and anything that only it feeds) when false
+     */
+    Pass& setEnabled(bool enabled);
+
+    const std::string& name() const { return _name; }
+    bool enabled() const { return _enabled; }
+
+   private:
+    friend class FrameGraph;
+    struct Read {
+      int resource;
+      int slot;
+      bool depthCompare;
+    };
+
+    Pass(FrameGraph* graph, const std::string& name,
+        const std::function<void()>& run);
+
+    FrameGraph* _graph;
+    std::string _name;
+    std::function<void()> _run;
+    std::vector<int> _writes;
+    std::vector<Read> _reads;
+    std::vector<std::pair<int, int>> _copies;  // source, target
+    bool _screen;
+    bool _sideEffect;
+    bool _enabled;
+
+    GLuint _fbo;
+    std::vector<GLuint> _fboTextures;  // textures attached to _fbo
+  };
+
+  FrameGraph();
+  ~FrameGraph();
+
+  /**
+   * @brief Add a pass that calls run when executed
+   *
+   * The returned reference stays valid until clear() is called.
+   */
+  Pass& addPass(const std::string& name, const std::function<void()>& run);
+
+  /**
+   * @brief Let passes read or write a texture that the graph doesn't own
+   *
+   * Imported textures are never pooled or cleared by the graph. Passes that
+   * write to them are not culled.
+   */
+  void importTexture(const std::string& name, GLuint texId, Format format,
+      int width, int height);
+
+  /**
+   * @brief Keep a texture's writers alive so it can be used after execute()
+   * @see texture()
+   */
+  void exportTexture(const std::string& name);
+
+  /**
+   * @brief Run all live passes in dependency order
+   */
+  void execute();
+
+  /**
+   * @brief Return the GL texture currently backing a graph texture
+   *
+   * Transient textures are only valid until the next execute().
+   */
+  GLuint texture(const std::string& name) const;
+
+  /**
+   * @brief Remove all passes and resources (pooled textures are kept)
+   */
+  void clear();
+
+  /**
+   * @brief Delete every GL object owned by the graph
+   */
+  void cleanup();
+
+  /** @brief Return the number of passes run by the last execute() */
+  int executedPasses() const { return static_cast<int>(_order.size()); }
+
+  /** @brief Return the number of passes culled by the last execute() */
+  int culledPasses() const {
+    return static_cast<int>(_passes.size() - _order.size());
+  }
+
+  /** @brief Return the number of textures in the pool */
+  int pooledTextures() const { return static_cast<int>(_pool.size()); }
+
+  /** @brief Return the estimated GPU memory used by pooled textures */
+  size_t pooledBytes() const;
+
+  /**
+   * @brief Frames a pooled texture may go unused before it is released
+   */
+  static int PoolLifetime;
+
+ private:
+  struct Resource {
+    std::string name;
+    Format format;
+    int width, height;
+    bool imported;
+    bool exported;
+    bool declared;          // format and size set by a writer or import
+    GLuint texId;           // physical texture for the current frame
+    std::vector<int> writers;  // passes in declaration order
+    std::vector<int> readers;
+    int first, last;        // lifetime in _order (transient only)
+  };
+
+  struct PooledTexture {
+    GLuint texId;
+    Format format;
+    int width, height;
+    bool inUse;
+    int lastFrame;
+  };
+
+  int resource(const std::string& name);
+  void compile();
+  void acquire(Resource* res, const GLint viewport[4]);
+  void release(Resource* res);
+  void bindTargets(Pass* pass, const GLint viewport[4]);
+  void copyTexture(Pass* pass, const Resource& source, const Resource& target);
+
+  std::vector<Pass*> _passes;
+  std::vector<Resource> _resources;
+  std::map<std::string, int> _resourceIds;
+  std::vector<int> _order;  // indices into _passes, in execution order
+  std::vector<std::vector<int>> _deps;  // compile() scratch
+  std::vector<bool> _live, _done;
+  std::vector<int> _stack;
+  std::vector<PooledTexture> _pool;
+  GLuint _copyFbo;  // read framebuffer for Pass::copy()
+  GLuint _screenFbo;  // framebuffer bound when execute() was called
+  bool _dirty;
+  int _frame;
+};
+
+}  // namespace agl
+#endif  // AGL_FRAME_GRAPH_H_
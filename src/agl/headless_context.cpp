@@ -0,0 +1,151 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/headless_context.h"
+#include <iostream>
+
+#ifdef AGL_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace agl {
+
+HeadlessContext::HeadlessContext() :
+  _display(nullptr),
+  _config(nullptr),
+  _context(nullptr),
+  _surface(nullptr) {
+}
+
+HeadlessContext::~HeadlessContext() {
+  cleanup();
+}
+
+#ifdef AGL_HEADLESS
+
+bool HeadlessContext::init(int width, int height) {
+  // Prefer Mesa's surfaceless platform, which needs neither X nor a GPU
+  EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+      eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (getPlatformDisplay) {
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+        EGL_DEFAULT_DISPLAY, nullptr);
+  }
+#endif
+  if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    std::cout << "ERROR: Cannot initialize EGL\n";
+    return false;
+  }
+  _display = display;
+
+  const EGLint configAttribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_ALPHA_SIZE, 8,
+    EGL_DEPTH_SIZE, 24,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint numConfigs = 0;
+  if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) ||
+      numConfigs == 0) {
+    std::cout << "ERROR: No EGL config supports OpenGL pbuffers\n";
+    cleanup();
+    return false;
+  }
+  _config = config;
+
+  // Match the version and profile that Window requests from GLFW
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 1,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+  eglBindAPI(EGL_OPENGL_API);
+  EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+      contextAttribs);
+  if (context == EGL_NO_CONTEXT) {
+    std::cout << "ERROR: Cannot create an OpenGL 4.1 EGL context\n";
+    cleanup();
+    return false;
+  }
+  _context = context;
+
+  if (!createSurface(width, height)) {
+    cleanup();
+    return false;
+  }
+  return true;
+}
+
+bool HeadlessContext::resize(int width, int height) {
+  if (!_context) return false;
+  EGLSurface old = _surface;
+  bool result = createSurface(width, height);
+  if (result && old) eglDestroySurface(_display, old);
+  return result;
+}
+
+bool HeadlessContext::createSurface(int width, int height) {
+  const EGLint surfaceAttribs[] = {
+    EGL_WIDTH, width,
+    EGL_HEIGHT, height,
+    EGL_NONE
+  };
+  EGLSurface surface = eglCreatePbufferSurface(_display, _config,
+      surfaceAttribs);
+  if (surface == EGL_NO_SURFACE ||
+      !eglMakeCurrent(_display, surface, surface, _context)) {
+    std::cout << "ERROR: Cannot create a " << width << "x" << height <<
+        " EGL pbuffer\n";
+    if (surface != EGL_NO_SURFACE) eglDestroySurface(_display, surface);
+    return false;
+  }
+  _surface = surface;
+  return true;
+}
+
+void HeadlessContext::cleanup() {
+  if (!_display) return;
+  eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (_surface) eglDestroySurface(_display, _surface);
+  if (_context) eglDestroyContext(_display, _context);
+  eglTerminate(_display);
+  _display = nullptr;
+  _config = nullptr;
+  _context = nullptr;
+  _surface = nullptr;
+}
+
+#else
+
+bool HeadlessContext::init(int width, int height) {
+  std::cout << "ERROR: Headless rendering requires building with "
+      "AGL_HEADLESS\n";
+  return false;
+}
+
+bool HeadlessContext::resize(int width, int height) {
+  return false;
+}
+
+bool HeadlessContext::createSurface(int width, int height) {
+  return false;
+}
+
+void HeadlessContext::cleanup() {
+}
+
+#endif  // AGL_HEADLESS
+
+}  // namespace agl
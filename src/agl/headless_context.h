@@ -0,0 +1,54 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_HEADLESS_CONTEXT_H_
+#define AGL_HEADLESS_CONTEXT_H_
+
+namespace agl {
+
+/**
+ * @brief An OpenGL context without a window or display
+ *
+ * Renders into an EGL pbuffer, so the default framebuffer, glReadPixels
+ * and Window::screenshot() behave exactly as they do for a window. On
+ * machines without a GPU, Mesa provides the context through llvmpipe via
+ * its surfaceless platform, so no X server is needed.
+ *
+ * Requires building with AGL_HEADLESS (which links libEGL); otherwise
+ * init() always fails.
+ *
+ * Users do not need to use this class directly.
+ * @see Window::Headless
+ */
+class HeadlessContext {
+ public:
+  HeadlessContext();
+  ~HeadlessContext();
+
+  /**
+   * @brief Create an OpenGL 4.1 core context and make it current
+   * @return Returns false if EGL or a suitable config is not available
+   */
+  bool init(int width, int height);
+
+  /**
+   * @brief Replace the pbuffer with one of the given size
+   */
+  bool resize(int width, int height);
+
+  /**
+   * @brief Release the context and its surface
+   */
+  void cleanup();
+
+ private:
+  bool createSurface(int width, int height);
+
+  // EGL handles, kept opaque so that this header doesn't need EGL
+  void* _display;
+  void* _config;
+  void* _context;
+  void* _surface;
+};
+
+}  // namespace agl
+#endif  // AGL_HEADLESS_CONTEXT_H_
@@ -3,6 +3,9 @@
 #include "agl/image.h"
 
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <vector>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -84,10 +87,101 @@ bool Image::load(const std::string& filename, bool flip) {
 }
 
 
+// Encodes RGBA pixels in the QOI format (https://qoiformat.org), which
+// compresses almost as well as PNG at a fraction of the cost
+static bool saveQOI(const std::string& filename, int width, int height,
+    const unsigned char* data, bool flip) {
+  std::vector<unsigned char> out;
+  out.reserve(14 + static_cast<size_t>(width) * height + 8);
+
+  const unsigned char header[] = {'q', 'o', 'i', 'f',
+    static_cast<unsigned char>(width >> 24),
+    static_cast<unsigned char>(width >> 16),
+    static_cast<unsigned char>(width >> 8),
+    static_cast<unsigned char>(width),
+    static_cast<unsigned char>(height >> 24),
+    static_cast<unsigned char>(height >> 16),
+    static_cast<unsigned char>(height >> 8),
+    static_cast<unsigned char>(height),
+    4, 0};  // RGBA, sRGB
+  out.insert(out.end(), header, header + sizeof(header));
+
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char prev[4] = {0, 0, 0, 255};
+  int run = 0;
+  for (int row = 0; row < height; row++) {
+    int srcRow = flip ? height - 1 - row : row;
+    const unsigned char* px = data + static_cast<size_t>(srcRow) * width * 4;
+    for (int col = 0; col < width; col++, px += 4) {
+      bool last = row == height - 1 && col == width - 1;
+      if (memcmp(px, prev, 4) == 0) {
+        run++;
+        if (run == 62 || last) {
+          out.push_back(0xc0 | (run - 1));  // QOI_OP_RUN
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        out.push_back(0xc0 | (run - 1));
+        run = 0;
+      }
+
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if (memcmp(index[hash], px, 4) == 0) {
+        out.push_back(hash);  // QOI_OP_INDEX
+      } else if (px[3] == prev[3]) {
+        memcpy(index[hash], px, 4);
+        int dr = static_cast<signed char>(px[0] - prev[0]);
+        int dg = static_cast<signed char>(px[1] - prev[1]);
+        int db = static_cast<signed char>(px[2] - prev[2]);
+        int drg = dr - dg;
+        int dbg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+            db >= -2 && db <= 1) {
+          out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 &&
+            dbg >= -8 && dbg <= 7) {
+          out.push_back(0x80 | (dg + 32));  // QOI_OP_LUMA
+          out.push_back((drg + 8) << 4 | (dbg + 8));
+        } else {
+          out.push_back(0xfe);  // QOI_OP_RGB
+          out.insert(out.end(), px, px + 3);
+        }
+      } else {
+        memcpy(index[hash], px, 4);
+        out.push_back(0xff);  // QOI_OP_RGBA
+        out.insert(out.end(), px, px + 4);
+      }
+      memcpy(prev, px, 4);
+    }
+  }
+
+  const unsigned char end[] = {0, 0, 0, 0, 0, 0, 0, 1};
+  out.insert(out.end(), end, end + sizeof(end));
+
+  std::ofstream file(filename, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(out.data()), out.size());
+  return file.good();
+}
+
 bool Image::save(const std::string& filename, bool flip) const {
-  stbi_flip_vertically_on_write(flip);
+  size_t dot = filename.rfind('.');
+  if (dot != std::string::npos && filename.substr(dot) == ".qoi") {
+    return saveQOI(filename, myWidth, myHeight, myData, flip);
+  }
+
+  // Flip by walking the rows backwards rather than with
+  // stbi_flip_vertically_on_write(), whose flag is shared by every thread
+  int stride = myWidth * 4;
+  const unsigned char* first = myData;
+  if (flip && myHeight > 0) {
+    first = myData + static_cast<size_t>(myHeight - 1) * stride;
+    stride = -stride;
+  }
   int result = stbi_write_png(filename.c_str(), myWidth, myHeight,
-    4, (unsigned char*) myData, myWidth*4);
+    4, first, stride);
   return (result == 1);
 }
 
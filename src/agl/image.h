@@ -43,9 +43,11 @@ class Image {
   bool load(const std::string& filename, bool flip = false);
 
   /** 
-   * @brief Save the image to the given filename (.png)
-   * @param filename The file to load, relative to the running directory
+   * @brief Save the image to the given filename (.png or .qoi)
+   * @param filename The file to save, relative to the running directory
    * @param flip Whether the file should flipped vertally before being saved
+   *
+   * Safe to call from several threads at once on different images.
    */
   bool save(const std::string& filename, bool flip = true) const;
 
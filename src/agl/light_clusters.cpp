@@ -0,0 +1,363 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/light_clusters.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
+#include "agl/renderer.h"
+
+namespace agl {
+
+int LightClusters::WorkerThreads = 0;
+
+// Fewer visible lights than this are binned on the calling thread alone
+static const int MinParallelLights = 32;
+
+static const GLenum TexelFormats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+// Range of x / d * scale over x in [lo, hi] and d in [d0, d1] (d > 0)
+static void projectRange(float lo, float hi, float d0, float d1, float scale,
+    float* ndc0, float* ndc1) {
+  *ndc0 = scale * std::min(lo / d0, lo / d1);
+  *ndc1 = scale * std::max(hi / d0, hi / d1);
+}
+
+static int cell(float ndc, int count) {
+  int i = static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * count));
+  return std::max(0, std::min(count - 1, i));
+}
+
+static void uploadBuffer(GLuint buffer, const void* data, size_t bytes) {
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  // Orphan last frame's storage so the upload doesn't wait for the GPU
+  glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, size_t(16)), nullptr,
+      GL_STREAM_DRAW);
+  if (bytes > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  RenderStats::countBuffer(bytes);
+}
+
+LightClusters::LightClusters(int tilesX, int tilesY, int slices) :
+  _tilesX(std::max(1, tilesX)),
+  _tilesY(std::max(1, tilesY)),
+  _slices(std::max(1, slices)),
+  _focal(1.0f),
+  _sliceResults(_slices),
+  _ranges(2 * clusterCount(), 0) {
+}
+
+LightClusters::~LightClusters() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  for (std::thread& worker : _workers) {
+    worker.join();
+  }
+  cleanup();
+}
+
+void LightClusters::update(const std::vector<Light>& lights,
+    const glm::mat4& view, float fovy, float aspect, float near, float far) {
+  AGL_PROFILE_SCOPE("LightClusters::update");
+  if (_buffers[0] == 0) {
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &_maxTexels);
+    glGenBuffers(3, _buffers);
+    glGenTextures(3, _textures);
+    for (int i = 0; i < 3; i++) {
+      uploadBuffer(_buffers[i], nullptr, 0);
+      glBindTexture(GL_TEXTURE_BUFFER, _textures[i]);
+      glTexBuffer(GL_TEXTURE_BUFFER, TexelFormats[i], _buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+
+  computeClusterBounds(fovy, aspect, near, far);
+  boundLights(lights, view);
+
+  bool parallel = _visibleLights >= MinParallelLights;
+  if (parallel && _workers.empty()) startWorkers();
+  parallel = parallel && !_workers.empty();
+
+  _nextSlice = 0;
+  if (parallel) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _running = static_cast<int>(_workers.size());
+      _generation++;
+    }
+    _wake.notify_all();
+  }
+  binSlices();
+  if (parallel) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _finished.wait(lock, [this]() { return _running == 0; });
+  }
+
+  merge();
+  upload();
+}
+
+void LightClusters::bind(Renderer& renderer, int slot) const {
+  static const char* Names[3] =
+      {"ClusterLights", "ClusterRanges", "ClusterIndices"};
+  for (int i = 0; i < 3; i++) {
+    glActiveTexture(GL_TEXTURE0 + slot + i);
+    glBindTexture(GL_TEXTURE_BUFFER, _textures[i]);
+    RenderStats::countTexture();
+    renderer.setUniform(Names[i], slot + i);
+  }
+  renderer.setUniform("ClusterGrid", glm::vec3(_tilesX, _tilesY, _slices));
+  renderer.setUniform("ClusterFocal", _focal);
+  renderer.setUniform("ClusterDepth",
+      glm::vec2(_near, _slices / std::log(_far / _near)));
+}
+
+void LightClusters::cleanup() {
+  if (_buffers[0] == 0) return;
+  glDeleteTextures(3, _textures);
+  glDeleteBuffers(3, _buffers);
+  for (int i = 0; i < 3; i++) {
+    _textures[i] = 0;
+    _buffers[i] = 0;
+  }
+}
+
+void LightClusters::computeClusterBounds(float fovy, float aspect,
+    float near, float far) {
+  if (fovy == _fovy && aspect == _aspect && near == _near && far == _far) {
+    return;
+  }
+  _fovy = fovy;
+  _aspect = aspect;
+  _near = near;
+  _far = far;
+
+  float focal = 1.0f / std::tan(fovy * 0.5f);
+  _focal = glm::vec2(focal / aspect, focal);
+  _clusterMin.resize(clusterCount());
+  _clusterMax.resize(clusterCount());
+
+  // Slices are evenly spaced in log(depth), so that clusters stay roughly
+  // cube shaped
+  for (int z = 0; z < _slices; z++) {
+    float d0 = near * std::pow(far / near, static_cast<float>(z) / _slices);
+    float d1 = near * std::pow(far / near, (z + 1.0f) / _slices);
+    for (int y = 0; y < _tilesY; y++) {
+      float y0 = -1.0f + 2.0f * y / _tilesY;
+      float y1 = -1.0f + 2.0f * (y + 1) / _tilesY;
+      for (int x = 0; x < _tilesX; x++) {
+        float x0 = -1.0f + 2.0f * x / _tilesX;
+        float x1 = -1.0f + 2.0f * (x + 1) / _tilesX;
+        int i = (z * _tilesY + y) * _tilesX + x;
+        _clusterMin[i] = glm::vec3(
+            std::min(x0 * d0, x0 * d1) / _focal.x,
+            std::min(y0 * d0, y0 * d1) / _focal.y, -d1);
+        _clusterMax[i] = glm::vec3(
+            std::max(x1 * d0, x1 * d1) / _focal.x,
+            std::max(y1 * d0, y1 * d1) / _focal.y, -d0);
+      }
+    }
+  }
+}
+
+void LightClusters::boundLights(const std::vector<Light>& lights,
+    const glm::mat4& view) {
+  int count = static_cast<int>(lights.size());
+  if (count * 3 > _maxTexels) {
+    if (!_truncated) {
+      std::cout << "WARNING: LightClusters: too many lights; only the first "
+          << _maxTexels / 3 << " are used\n";
+      _truncated = true;
+    }
+    count = _maxTexels / 3;
+  }
+
+  glm::mat3 rotation(view);
+  float sliceScale = _slices / std::log(_far / _near);
+  _lightData.resize(3 * count);
+  _bounds.clear();
+  for (int i = 0; i < count; i++) {
+    const Light& light = lights[i];
+    glm::vec3 pos = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    glm::vec3 dir = glm::normalize(rotation * light.direction);
+
+    // Point lights use a cone that includes every direction
+    float cosOuter = -2.0f;
+    float cosInner = -1.0f;
+    glm::vec3 center = pos;
+    float radius = light.radius;
+    if (light.spotAngle > 0.0f) {
+      float angle = std::min(light.spotAngle, glm::half_pi<float>());
+      cosOuter = std::cos(angle);
+      cosInner = std::cos(angle * 0.8f);  // soften the edge
+
+      // Smallest sphere around the cone
+      if (angle > glm::quarter_pi<float>()) {
+        center = pos + dir * cosOuter * light.radius;
+        radius = std::sin(angle) * light.radius;
+      } else {
+        radius = light.radius / (2.0f * cosOuter);
+        center = pos + dir * radius;
+      }
+    }
+    _lightData[3 * i] = glm::vec4(pos, light.radius);
+    _lightData[3 * i + 1] = glm::vec4(light.color * light.intensity, cosOuter);
+    _lightData[3 * i + 2] = glm::vec4(dir, cosInner);
+
+    // Depth range in front of the camera
+    float d0 = std::max(-center.z - radius, _near);
+    float d1 = std::min(-center.z + radius, _far);
+    if (d1 < d0) continue;
+
+    Bounds bounds;
+    bounds.light = i;
+    bounds.center = center;
+    bounds.radius = radius;
+
+    float ndc0, ndc1;
+    projectRange(center.x - radius, center.x + radius, d0, d1, _focal.x,
+        &ndc0, &ndc1);
+    if (ndc1 < -1.0f || ndc0 > 1.0f) continue;
+    bounds.x0 = cell(ndc0, _tilesX);
+    bounds.x1 = cell(ndc1, _tilesX);
+
+    projectRange(center.y - radius, center.y + radius, d0, d1, _focal.y,
+        &ndc0, &ndc1);
+    if (ndc1 < -1.0f || ndc0 > 1.0f) continue;
+    bounds.y0 = cell(ndc0, _tilesY);
+    bounds.y1 = cell(ndc1, _tilesY);
+
+    bounds.z0 = std::min(_slices - 1,
+        static_cast<int>(std::log(d0 / _near) * sliceScale));
+    bounds.z1 = std::min(_slices - 1,
+        static_cast<int>(std::log(d1 / _near) * sliceScale));
+    _bounds.push_back(bounds);
+  }
+  _visibleLights = static_cast<int>(_bounds.size());
+}
+
+void LightClusters::binSlices() {
+  AGL_PROFILE_SCOPE("LightClusters::bin");
+  for (int z = _nextSlice++; z < _slices; z = _nextSlice++) {
+    binSlice(z);
+  }
+}
+
+void LightClusters::binSlice(int z) {
+  Slice& slice = _sliceResults[z];
+  int clustersPerSlice = _tilesX * _tilesY;
+  int first = z * clustersPerSlice;
+  GLuint* ranges = &_ranges[2 * first];
+  std::fill(ranges, ranges + 2 * clustersPerSlice, 0);
+
+  // Each light only visits the tiles its bounds cover; counts go into
+  // the ranges as they are found
+  slice.hits.clear();
+  for (const Bounds& bounds : _bounds) {
+    if (z < bounds.z0 || z > bounds.z1) continue;
+    float radius2 = bounds.radius * bounds.radius;
+    for (int y = bounds.y0; y <= bounds.y1; y++) {
+      for (int x = bounds.x0; x <= bounds.x1; x++) {
+        int cell = y * _tilesX + x;
+        glm::vec3 d = glm::clamp(bounds.center, _clusterMin[first + cell],
+            _clusterMax[first + cell]) - bounds.center;
+        if (glm::dot(d, d) > radius2) continue;
+        ranges[2 * cell + 1]++;
+        slice.hits.push_back(cell);
+        slice.hits.push_back(bounds.light);
+      }
+    }
+  }
+
+  // Turn the counts into offsets, then put each light in its cluster's list
+  GLuint offset = 0;
+  for (int cell = 0; cell < clustersPerSlice; cell++) {
+    ranges[2 * cell] = offset;
+    offset += ranges[2 * cell + 1];
+    ranges[2 * cell + 1] = 0;
+  }
+  slice.indices.resize(offset);
+  for (size_t i = 0; i < slice.hits.size(); i += 2) {
+    GLuint* range = &ranges[2 * slice.hits[i]];
+    slice.indices[range[0] + range[1]++] = slice.hits[i + 1];
+  }
+}
+
+void LightClusters::merge() {
+  size_t total = 0;
+  for (const Slice& slice : _sliceResults) {
+    total += slice.indices.size();
+  }
+  size_t limit = static_cast<size_t>(_maxTexels);
+  if (total > limit && !_truncated) {
+    std::cout << "WARNING: LightClusters: too many light indices; "
+        "some lights are dropped\n";
+    _truncated = true;
+  }
+  _indices.resize(std::min(total, limit));
+
+  // Make slice offsets global and concatenate the indices
+  size_t base = 0;
+  int clustersPerSlice = _tilesX * _tilesY;
+  _maxClusterLights = 0;
+  for (int z = 0; z < _slices; z++) {
+    const Slice& slice = _sliceResults[z];
+    size_t size = std::min(slice.indices.size(), limit - base);
+    if (size > 0) {
+      memcpy(&_indices[base], slice.indices.data(), size * sizeof(GLuint));
+    }
+    for (int i = 0; i < clustersPerSlice; i++) {
+      int cluster = z * clustersPerSlice + i;
+      size_t offset = base + _ranges[2 * cluster];
+      size_t end = std::min(offset + _ranges[2 * cluster + 1], limit);
+      size_t count = end > offset ? end - offset : 0;
+      _ranges[2 * cluster] = static_cast<GLuint>(offset);
+      _ranges[2 * cluster + 1] = static_cast<GLuint>(count);
+      _maxClusterLights = std::max(_maxClusterLights, static_cast<int>(count));
+    }
+    base += size;
+  }
+}
+
+void LightClusters::upload() {
+  uploadBuffer(_buffers[0], _lightData.data(),
+      _lightData.size() * sizeof(glm::vec4));
+  uploadBuffer(_buffers[1], _ranges.data(), _ranges.size() * sizeof(GLuint));
+  uploadBuffer(_buffers[2], _indices.data(), _indices.size() * sizeof(GLuint));
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::startWorkers() {
+  int numThreads = WorkerThreads;
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  numThreads = std::min(numThreads, _slices);
+  for (int i = 1; i < numThreads; i++) {
+    _workers.emplace_back(&LightClusters::workerLoop, this, _generation);
+  }
+}
+
+void LightClusters::workerLoop(int generation) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [this, generation]() {
+            return _stopping || _generation != generation;
+          });
+      if (_stopping) return;
+      generation = _generation;
+    }
+
+    binSlices();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_running == 0) _finished.notify_one();
+  }
+}
+
+}  // namespace agl
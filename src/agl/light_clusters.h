@@ -0,0 +1,160 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_LIGHT_CLUSTERS_H_
+#define AGL_LIGHT_CLUSTERS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "agl/agl.h"
+#include "agl/aglm.h"
+
+namespace agl {
+
+class Renderer;
+
+/**
+ * @brief Bins point and spot lights into view-space clusters for shading
+ *
+ * The view frustum is divided into a grid of clusters ("froxels"): tiles
+ * across the screen, and slices along the view direction that get
+ * thicker with distance. Every frame, update() finds the lights that
+ * reach each cluster, on several threads, and uploads three texture
+ * buffers:
+ *
+ * - the lights, in view space (3 RGBA32F texels each)
+ * - an offset and a count for each cluster (RG32UI)
+ * - the light indices of all clusters, one after another (R32UI)
+ *
+ * A fragment shader finds its cluster from its view-space position and
+ * only loops over that cluster's lights, so shading cost depends on how
+ * many lights overlap a fragment rather than on the total. See the
+ * CLUSTERED variant of phong-pixel.fs for the matching shader code.
+ * ```
+ * // draw()
+ * _clusters.update(_lights, view, glm::radians(60.0f), aspect, 0.5f, 10);
+ * renderer.beginShader("phong-pixel", CLUSTERED);
+ * ...  // set the camera
+ * _clusters.bind(renderer, 3);  // uses texture units 3, 4 and 5
+ * ```
+ */
+class LightClusters {
+ public:
+  /**
+   * @brief A point light, or a spot light when spotAngle > 0
+   */
+  struct Light {
+    glm::vec3 position = glm::vec3(0);  // world space
+    float radius = 1.0f;                // no light reaches further
+    glm::vec3 color = glm::vec3(1);
+    float intensity = 1.0f;
+    glm::vec3 direction = glm::vec3(0, -1, 0);  // world space, spots only
+    float spotAngle = 0.0f;  // half-angle of the cone in radians
+  };
+
+  /**
+   * @brief Create a grid with the given number of tiles and depth slices
+   */
+  LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24);
+  ~LightClusters();
+
+  /**
+   * @brief Bin lights for a camera and upload the results
+   * @param view The camera's view matrix
+   * @param fovy, aspect, near, far The camera's perspective projection
+   *
+   * Requires a current GL context. Buffers are reused between frames, so
+   * once they have grown to fit, this method doesn't allocate.
+   */
+  void update(const std::vector<Light>& lights, const glm::mat4& view,
+      float fovy, float aspect, float near, float far);
+
+  /**
+   * @brief Bind the buffers to units slot, slot+1 and slot+2 and set the
+   * cluster uniforms of the current shader
+   */
+  void bind(Renderer& renderer, int slot) const;
+
+  /**
+   * @brief Delete the GL buffers and textures
+   */
+  void cleanup();
+
+  /** @brief Return the number of lights inside the last update's frustum */
+  int visibleLights() const { return _visibleLights; }
+
+  /** @brief Return the most lights binned to a single cluster */
+  int maxClusterLights() const { return _maxClusterLights; }
+
+  /** @brief Return the number of clusters */
+  int clusterCount() const { return _tilesX * _tilesY * _slices; }
+
+  /**
+   * @brief Number of threads used to bin lights (0 = one per core)
+   *
+   * Takes effect when the first update() starts the workers.
+   */
+  static int WorkerThreads;
+
+ private:
+  // A light's view-space bounding sphere and the clusters it may touch
+  struct Bounds {
+    int light;  // index into the update's lights
+    glm::vec3 center;
+    float radius;
+    int x0, x1, y0, y1, z0, z1;
+  };
+
+  // Binning results of one depth slice; offsets are relative to the slice
+  struct Slice {
+    std::vector<GLuint> hits;  // cluster in the slice, light; in pairs
+    std::vector<GLuint> indices;
+  };
+
+  void computeClusterBounds(float fovy, float aspect, float near, float far);
+  void boundLights(const std::vector<Light>& lights, const glm::mat4& view);
+  void binSlices();
+  void binSlice(int z);
+  void merge();
+  void upload();
+  void startWorkers();
+  void workerLoop(int generation);
+
+  int _tilesX, _tilesY, _slices;
+
+  // Camera the cluster bounds were computed for
+  float _fovy = 0, _aspect = 0, _near = 0, _far = 0;
+  glm::vec2 _focal;  // projection[0][0] and projection[1][1]
+  std::vector<glm::vec3> _clusterMin, _clusterMax;  // view space
+
+  std::vector<Bounds> _bounds;
+  std::vector<Slice> _sliceResults;
+  std::vector<glm::vec4> _lightData;  // uploaded light texels
+  std::vector<GLuint> _ranges;        // offset, count per cluster
+  std::vector<GLuint> _indices;
+  int _visibleLights = 0;
+  int _maxClusterLights = 0;
+  int _maxTexels = 0;  // GL_MAX_TEXTURE_BUFFER_SIZE
+  bool _truncated = false;
+
+  GLuint _buffers[3] = {0, 0, 0};   // lights, ranges, indices
+  GLuint _textures[3] = {0, 0, 0};
+
+  // Worker pool; the calling thread bins slices too
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _finished;
+  int _generation = 0;  // incremented for each update that uses workers
+  int _running = 0;     // workers still binning
+  bool _stopping = false;
+  std::atomic<int> _nextSlice{0};
+
+  LightClusters(const LightClusters&) = delete;
+  LightClusters& operator=(const LightClusters&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_LIGHT_CLUSTERS_H_
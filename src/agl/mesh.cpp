@@ -1,6 +1,7 @@
 // Copyright, 2020, Savvy Sine, Aline Normoyle
 #include "agl/mesh.h"
 #include <iostream>
+#include "agl/render_stats.h"
 
 using glm::vec4;
 
@@ -47,6 +48,7 @@ void Mesh::initBuffers(
   glBindBuffer(GL_ARRAY_BUFFER, posBuf);
   glBufferData(GL_ARRAY_BUFFER,
       points->size() * sizeof(GLfloat), points->data(), type);
+  RenderStats::countBuffer(points->size() * sizeof(GLfloat));
 
   if (normals != nullptr) {
     glGenBuffers(1, &normBuf);
@@ -54,6 +56,7 @@ void Mesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, normBuf);
     glBufferData(GL_ARRAY_BUFFER,
         normals->size() * sizeof(GLfloat), normals->data(), type);
+    RenderStats::countBuffer(normals->size() * sizeof(GLfloat));
   }
 
   if (texCoords != nullptr) {
@@ -62,6 +65,7 @@ void Mesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
     glBufferData(GL_ARRAY_BUFFER,
         texCoords->size() * sizeof(GLfloat), texCoords->data(), type);
+    RenderStats::countBuffer(texCoords->size() * sizeof(GLfloat));
   }
 
   if (colors != nullptr) {
@@ -70,6 +74,7 @@ void Mesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, cBuf);
     glBufferData(GL_ARRAY_BUFFER,
         colors->size() * sizeof(GLfloat), colors->data(), type);
+    RenderStats::countBuffer(colors->size() * sizeof(GLfloat));
   }
 
   if (tangents != nullptr) {
@@ -78,6 +83,7 @@ void Mesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
     glBufferData(GL_ARRAY_BUFFER,
         tangents->size() * sizeof(GLfloat), tangents->data(), type);
+    RenderStats::countBuffer(tangents->size() * sizeof(GLfloat));
   }
 
   glGenVertexArrays(1, &_vao);
@@ -1,6 +1,7 @@
 // Copyright, 2020, Savvy Sine, Aline Normoyle
 #include "agl/mesh/line_mesh.h"
 #include <iostream>
+#include "agl/render_stats.h"
 
 using glm::vec4;
 
@@ -18,11 +19,13 @@ void LineMesh::render() const {
         glBindBuffer(GL_ARRAY_BUFFER, _buffers[i]);
         glBufferData(GL_ARRAY_BUFFER, _data[i].size() * sizeof(GLfloat),
             _data[i].data(), GL_DYNAMIC_DRAW);
+        RenderStats::countBuffer(_data[i].size() * sizeof(GLfloat));
       }
     }
   }
 
   glDrawArrays(GL_LINES, 0, _nVerts * 3);
+  RenderStats::countDraw(GL_LINES, _nVerts * 3);
   glBindVertexArray(0);
 }
 
@@ -2,6 +2,7 @@
 
 #include "agl/mesh/skybox.h"
 #include "agl/agl.h"
+#include "agl/render_stats.h"
 
 namespace agl {
 
@@ -54,10 +55,12 @@ SkyBox::SkyBox(int side) {
 
   glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
   glBufferData(GL_ARRAY_BUFFER, 24 * 3 * sizeof(float), v, GL_STATIC_DRAW);
+  RenderStats::countBuffer(24 * 3 * sizeof(float));
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[1]);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,
       36 * sizeof(GLuint), el, GL_STATIC_DRAW);
+  RenderStats::countBuffer(36 * sizeof(GLuint));
 
   glGenVertexArrays(1, &vaoHandle);
   glBindVertexArray(vaoHandle);
@@ -73,6 +76,7 @@ SkyBox::SkyBox(int side) {
 void SkyBox::render() const {
   glBindVertexArray(vaoHandle);
   glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+  RenderStats::countDraw(GL_TRIANGLES, 36);
   glBindVertexArray(0);
 }
 
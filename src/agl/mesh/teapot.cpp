@@ -30,7 +30,76 @@ void Teapot::init() {
   initBuffers(&el, &p, &n, &tc);
 }
 
+void Teapot::controlPoints(std::vector<GLfloat>* points) {
+  // The mesh is fitted to a unit box after evaluation, so evaluate it once
+  // to find the same fit
+  int verts = 32 * (_grid + 1) * (_grid + 1);
+  int faces = _grid * _grid * 32;
+  std::vector<GLfloat> p(verts * 3);
+  std::vector<GLfloat> n(verts * 3);
+  std::vector<GLfloat> tc(verts * 2);
+  std::vector<GLuint> el(faces * 6);
+  generatePatches(p, n, tc, el, _grid);
+  moveLid(_grid, p, _lidTransform);
+
+  vec3 center;
+  float scale;
+  unitBox(p, &center, &scale);
+  mat3 R = mat3(glm::angleAxis(glm::half_pi<float>(), vec3(-1, 0, 0)));
+
+  // Same patches and reflections as generatePatches()
+  const mat3 reflections[4] = {
+    mat3(1.0f),
+    mat3(vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1)),
+    mat3(vec3(1, 0, 0), vec3(0, -1, 0), vec3(0, 0, 1)),
+    mat3(vec3(-1, 0, 0), vec3(0, -1, 0), vec3(0, 0, 1))
+  };
+  points->clear();
+  points->reserve(32 * 16 * 3);
+  for (int patchNum = 0; patchNum < 10; patchNum++) {
+    bool reflectX = patchNum < 6;  // the handle and spout aren't mirrored
+    bool lid = patchNum == 3 || patchNum == 4;
+    for (int r = 0; r < 4; r++) {
+      if (!reflectX && (r == 1 || r == 3)) continue;
+
+      // Single reflections use the reversed patch to keep the orientation
+      vec3 patch[4][4];
+      getPatch(patchNum, patch, r == 1 || r == 2);
+      for (int u = 0; u < 4; u++) {
+        for (int v = 0; v < 4; v++) {
+          vec3 pt = reflections[r] * patch[u][v];
+          if (lid) pt = vec3(_lidTransform * vec4(pt, 1.0f));
+          pt = R * (pt - center) / scale;
+          points->insert(points->end(), {pt.x, pt.y, pt.z});
+        }
+      }
+    }
+  }
+}
+
 void Teapot::fitUnitBox(std::vector<GLfloat>& p, std::vector<GLfloat>& n) {
+  vec3 center;
+  float scale;
+  unitBox(p, &center, &scale);
+  mat3 R = mat3(glm::angleAxis(glm::half_pi<float>(), vec3(-1, 0, 0))); 
+
+  for (int i = 0; i < p.size(); i += 3) {
+    vec3 pos = R * (vec3(p[i], p[i+1], p[i+2]) - center) / scale;
+    vec3 nor = R * vec3(n[i], n[i+1], n[i+2]);
+
+    p[i+0] = pos[0]; 
+    p[i+1] = pos[1]; 
+    p[i+2] = pos[2]; 
+
+    n[i+0] = nor[0]; 
+    n[i+1] = nor[1]; 
+    n[i+2] = nor[2]; 
+  }
+
+}
+
+void Teapot::unitBox(const std::vector<GLfloat>& p, vec3* center,
+    float* scale) {
   vec3 min, max;
   for (int i = 0; i < p.size(); i += 3) {
     float x = p[i+0]; 
@@ -49,24 +118,9 @@ void Teapot::fitUnitBox(std::vector<GLfloat>& p, std::vector<GLfloat>& n) {
     if (z > max[2]) max[2] = z;
   }
 
-  vec3 center = 0.5f * (max + min);
+  *center = 0.5f * (max + min);
   vec3 bounds = (max - min);
-  float scale = std::max(std::max(bounds[0], bounds[1]), bounds[2]);
-  mat3 R = mat3(glm::angleAxis(glm::half_pi<float>(), vec3(-1, 0, 0))); 
-
-  for (int i = 0; i < p.size(); i += 3) {
-    vec3 pos = R * (vec3(p[i], p[i+1], p[i+2]) - center) / scale;
-    vec3 nor = R * vec3(n[i], n[i+1], n[i+2]);
-
-    p[i+0] = pos[0]; 
-    p[i+1] = pos[1]; 
-    p[i+2] = pos[2]; 
-
-    n[i+0] = nor[0]; 
-    n[i+1] = nor[1]; 
-    n[i+2] = nor[2]; 
-  }
-
+  *scale = std::max(std::max(bounds[0], bounds[1]), bounds[2]);
 }
 
 // From: OpenGL 4.0 Shading language cookbook (David Wolf 2011)
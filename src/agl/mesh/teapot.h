@@ -26,6 +26,16 @@ class Teapot : public TriangleMesh {
    */
   Teapot(int grid, const glm::mat4& lidTransform);
 
+  /**
+   * @brief Get the Bezier control points of the teapot
+   * @param points Receives 16 points (x, y, z) per patch, row by row
+   *
+   * The points are placed like the vertices of the mesh, so evaluating the
+   * patches gives the same surface. Normals point along -dP/du x dP/dv.
+   * @see BezierPatches
+   */
+  void controlPoints(std::vector<GLfloat>* points);
+
  protected:
   void init() override;
 
@@ -66,6 +76,9 @@ class Teapot : public TriangleMesh {
 
   void fitUnitBox(std::vector<GLfloat>& p, std::vector<GLfloat>& n);
 
+  void unitBox(const std::vector<GLfloat>& p, glm::vec3* center,
+      float* scale);
+
   void moveLid(int grid, std::vector<GLfloat>& p, 
       const glm::mat4& lidTransform);
 
@@ -1,6 +1,8 @@
 // Copyright, 2020, Savvy Sine, Aline Normoyle
 #include "agl/mesh/triangle_mesh.h"
+#include <cassert>
 #include <iostream>
+#include "agl/render_stats.h"
 
 using glm::vec4;
 
@@ -22,6 +24,15 @@ void TriangleMesh::initBuffers(
     return;
   }
 
+  if (_capture) {
+    _capture->indices = *indices;
+    _capture->points = *points;
+    _capture->normals = *normals;
+    if (texCoords != nullptr) _capture->texCoords = *texCoords;
+    if (tangents != nullptr) _capture->tangents = *tangents;
+    return;
+  }
+
   _initialized = true;
   _hasUV = (texCoords != nullptr);
   _nIndices = (GLuint)indices->size();
@@ -43,18 +54,21 @@ void TriangleMesh::initBuffers(
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,
       indices->size() * sizeof(GLuint), indices->data(), type);
+  RenderStats::countBuffer(indices->size() * sizeof(GLuint));
 
   glGenBuffers(1, &posBuf);
   _buffers.push_back(posBuf);
   glBindBuffer(GL_ARRAY_BUFFER, posBuf);
   glBufferData(GL_ARRAY_BUFFER,
       points->size() * sizeof(GLfloat), points->data(), type);
+  RenderStats::countBuffer(points->size() * sizeof(GLfloat));
 
   glGenBuffers(1, &normBuf);
   _buffers.push_back(normBuf);
   glBindBuffer(GL_ARRAY_BUFFER, normBuf);
   glBufferData(GL_ARRAY_BUFFER,
       normals->size() * sizeof(GLfloat), normals->data(), type);
+  RenderStats::countBuffer(normals->size() * sizeof(GLfloat));
 
   if (texCoords != nullptr) {
     glGenBuffers(1, &tcBuf);
@@ -62,6 +76,7 @@ void TriangleMesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
     glBufferData(GL_ARRAY_BUFFER,
         texCoords->size() * sizeof(GLfloat), texCoords->data(), type);
+    RenderStats::countBuffer(texCoords->size() * sizeof(GLfloat));
   }
 
   if (tangents != nullptr) {
@@ -70,6 +85,7 @@ void TriangleMesh::initBuffers(
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
     glBufferData(GL_ARRAY_BUFFER,
         tangents->size() * sizeof(GLfloat), tangents->data(), type);
+    RenderStats::countBuffer(tangents->size() * sizeof(GLfloat));
   }
 
   glGenVertexArrays(1, &_vao);
@@ -103,6 +119,13 @@ void TriangleMesh::initBuffers(
   glBindVertexArray(0);
 }
 
+void TriangleMesh::generate(Geometry* geometry) {
+  assert(!_initialized);
+  _capture = geometry;
+  init();
+  _capture = nullptr;
+}
+
 void TriangleMesh::render() const {
   if (!_initialized) const_cast<TriangleMesh*>(this)->init();
   if (_vao == 0) return;
@@ -115,11 +138,13 @@ void TriangleMesh::render() const {
         glBindBuffer(GL_ARRAY_BUFFER, _buffers[i]);
         glBufferData(GL_ARRAY_BUFFER, _data[i].size() * sizeof(GLfloat),
             _data[i].data(), GL_DYNAMIC_DRAW);
+        RenderStats::countBuffer(_data[i].size() * sizeof(GLfloat));
       }
     }
   }
 
   glDrawElements(GL_TRIANGLES, _nIndices, GL_UNSIGNED_INT, 0);
+  RenderStats::countDraw(GL_TRIANGLES, _nIndices);
   glBindVertexArray(0);
 }
 
@@ -24,8 +24,30 @@ class TriangleMesh : public Mesh {
    */ 
   virtual void render() const;
 
+  /**
+   * @brief Vertex data as passed to initBuffers()
+   */
+  struct Geometry {
+    std::vector<GLuint> indices;
+    std::vector<GLfloat> points;
+    std::vector<GLfloat> normals;
+    std::vector<GLfloat> texCoords;  // empty if the mesh has none
+    std::vector<GLfloat> tangents;   // empty if the mesh has none
+  };
+
+  /**
+   * @brief Run init() but keep the data on the CPU instead of creating
+   * buffers
+   *
+   * The mesh itself stays uninitialized. Renderer uses this method to pack
+   * primitives into shared buffers.
+   * @see PrimitiveCache
+   */
+  void generate(Geometry* geometry);
+
  protected:
   GLuint _nIndices = 0;    // Number of triangle vertices
+  Geometry* _capture = nullptr;  // set during generate()
 
   /**
    * @brief Call initBuffers from init() to set the data for this mesh
@@ -0,0 +1,231 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/primitive_cache.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <glm/gtc/constants.hpp>
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
+#include "agl/mesh/capsule.h"
+#include "agl/mesh/cube.h"
+#include "agl/mesh/cylinder.h"
+#include "agl/mesh/plane.h"
+#include "agl/mesh/sphere.h"
+#include "agl/mesh/teapot.h"
+#include "agl/mesh/torus.h"
+
+namespace agl {
+
+float PrimitiveCache::PixelsPerSegment = 8.0f;
+
+static const int VertexFloats = 8;  // position, normal, uv
+static const int MinSlices = 4;
+static const int TeapotGrid = 13;   // patch subdivision of the finest level
+
+// Tessellations by shape and subdivision, shared by every cache in the
+// process. Entries are never removed, so references to them stay valid.
+static std::mutex theTessellationMutex;
+static std::map<std::pair<int, int>, TriangleMesh::Geometry>*
+    theTessellations = nullptr;
+
+static TriangleMesh* createMesh(PrimitiveCache::Shape shape, int n) {
+  switch (shape) {
+    case PrimitiveCache::CUBE: return new Cube(1.0f);
+    case PrimitiveCache::PLANE: return new Plane(1.0, 1.0, 1.0, 1.0);
+    case PrimitiveCache::SPHERE: return new Sphere(0.5f, n, n);
+    case PrimitiveCache::CYLINDER: return new Cylinder(0.5, 1.0, n);
+    case PrimitiveCache::CONE: return new Cylinder(0.5f, 0.01, 1, n);
+    case PrimitiveCache::CAPSULE: return new Capsule(0.25, 0.5, n, n);
+    case PrimitiveCache::TORUS: return new Torus(0.5, 0.25, n, n);
+    case PrimitiveCache::TEAPOT: return new Teapot(n, glm::mat4(1.0));
+    default: return nullptr;
+  }
+}
+
+static const TriangleMesh::Geometry& tessellation(PrimitiveCache::Shape shape,
+    int subdivision) {
+  std::lock_guard<std::mutex> lock(theTessellationMutex);
+  if (!theTessellations) {
+    theTessellations = new std::map<std::pair<int, int>,
+        TriangleMesh::Geometry>();
+  }
+  std::pair<int, int> key(shape, subdivision);
+  auto it = theTessellations->find(key);
+  if (it == theTessellations->end()) {
+    it = theTessellations->emplace(key, TriangleMesh::Geometry()).first;
+    TriangleMesh* mesh = createMesh(shape, subdivision);
+    mesh->generate(&it->second);
+    delete mesh;
+  }
+  return it->second;
+}
+
+bool PrimitiveCache::hasLevels(Shape shape) {
+  return shape != CUBE && shape != PLANE;
+}
+
+PrimitiveCache::PrimitiveCache(int subdivision) :
+  _subdivision(std::max(MinSlices, subdivision)),
+  _vao(0),
+  _vbo(0),
+  _ibo(0),
+  _vboCapacity(0),
+  _iboCapacity(0) {
+  for (int i = 0; i < NUM_SHAPES; i++) {
+    _loaded[i] = false;
+    _radius[i] = 0;
+  }
+}
+
+PrimitiveCache::~PrimitiveCache() {
+  cleanup();
+}
+
+float PrimitiveCache::boundingRadius(Shape shape) {
+  if (!_loaded[shape]) load(shape);
+  return _radius[shape];
+}
+
+int PrimitiveCache::level(Shape shape, float pixelRadius) const {
+  if (!hasLevels(shape)) return 0;
+
+  // Slices needed to keep edges around the outline short enough
+  float slices = glm::two_pi<float>() * pixelRadius / PixelsPerSegment;
+  for (int level = 0; level < Levels - 1; level++) {
+    int levelSlices = std::max(MinSlices,
+        _subdivision >> (Levels - 1 - level));
+    if (levelSlices >= slices) return level;
+  }
+  return Levels - 1;
+}
+
+int PrimitiveCache::subdivision(Shape shape, int level) const {
+  if (!hasLevels(shape)) return 1;
+  if (shape == TEAPOT) {
+    return std::max(2, (TeapotGrid << level) >> (Levels - 1));
+  }
+  return std::max(MinSlices, _subdivision >> (Levels - 1 - level));
+}
+
+void PrimitiveCache::draw(Shape shape, int level) {
+  if (!_loaded[shape]) load(shape);
+
+  const Entry& entry = _entries[shape][level];
+  glBindVertexArray(_vao);
+  glDrawElementsBaseVertex(GL_TRIANGLES, entry.count, GL_UNSIGNED_INT,
+      reinterpret_cast<void*>(entry.firstIndex * sizeof(GLuint)),
+      entry.baseVertex);
+  RenderStats::countDraw(GL_TRIANGLES, entry.count);
+  glBindVertexArray(0);
+}
+
+void PrimitiveCache::cleanup() {
+  if (_vao != 0) {
+    glDeleteVertexArrays(1, &_vao);
+    glDeleteBuffers(1, &_vbo);
+    glDeleteBuffers(1, &_ibo);
+    _vao = _vbo = _ibo = 0;
+  }
+  _vboCapacity = _iboCapacity = 0;
+  _vertices.clear();
+  _indices.clear();
+  for (int i = 0; i < NUM_SHAPES; i++) {
+    _loaded[i] = false;
+  }
+}
+
+size_t PrimitiveCache::bytes() const {
+  return _vertices.size() * sizeof(GLfloat) + _indices.size() * sizeof(GLuint);
+}
+
+void PrimitiveCache::load(Shape shape) {
+  AGL_PROFILE_SCOPE("PrimitiveCache::load");
+  size_t firstFloat = _vertices.size();
+  size_t firstIndex = _indices.size();
+
+  float radius = 0;
+  int levels = hasLevels(shape) ? Levels : 1;
+  for (int level = 0; level < levels; level++) {
+    const TriangleMesh::Geometry& geometry =
+        tessellation(shape, subdivision(shape, level));
+    Entry& entry = _entries[shape][level];
+    entry.baseVertex = static_cast<GLint>(_vertices.size() / VertexFloats);
+    entry.firstIndex = static_cast<GLuint>(_indices.size());
+    entry.count = static_cast<GLsizei>(geometry.indices.size());
+
+    size_t numVertices = geometry.points.size() / 3;
+    bool hasUV = geometry.texCoords.size() >= 2 * numVertices;
+    for (size_t i = 0; i < numVertices; i++) {
+      const GLfloat* p = &geometry.points[3 * i];
+      const GLfloat* n = &geometry.normals[3 * i];
+      _vertices.insert(_vertices.end(), p, p + 3);
+      _vertices.insert(_vertices.end(), n, n + 3);
+      _vertices.push_back(hasUV ? geometry.texCoords[2 * i] : 0.0f);
+      _vertices.push_back(hasUV ? geometry.texCoords[2 * i + 1] : 0.0f);
+      radius = std::max(radius, std::sqrt(p[0] * p[0] + p[1] * p[1] +
+          p[2] * p[2]));
+    }
+    _indices.insert(_indices.end(), geometry.indices.begin(),
+        geometry.indices.end());
+  }
+  for (int level = levels; level < Levels; level++) {
+    _entries[shape][level] = _entries[shape][0];
+  }
+
+  _radius[shape] = radius;
+  _loaded[shape] = true;
+  upload(firstFloat, firstIndex);
+}
+
+void PrimitiveCache::upload(size_t firstFloat, size_t firstIndex) {
+  if (_vao == 0) {
+    glGenVertexArrays(1, &_vao);
+    glGenBuffers(1, &_vbo);
+    glGenBuffers(1, &_ibo);
+
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    GLsizei stride = VertexFloats * sizeof(GLfloat);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);  // Vertex position
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+        reinterpret_cast<void*>(3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);  // Normal
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+        reinterpret_cast<void*>(6 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);  // Tex coord
+  }
+  glBindVertexArray(_vao);
+
+  // Grow by doubling so that loading shape after shape re-uploads little
+  glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+  if (_vertices.size() > _vboCapacity) {
+    _vboCapacity = std::max(_vertices.size(), 2 * _vboCapacity);
+    glBufferData(GL_ARRAY_BUFFER, _vboCapacity * sizeof(GLfloat), nullptr,
+        GL_STATIC_DRAW);
+    firstFloat = 0;
+  }
+  size_t bytes = (_vertices.size() - firstFloat) * sizeof(GLfloat);
+  glBufferSubData(GL_ARRAY_BUFFER, firstFloat * sizeof(GLfloat), bytes,
+      _vertices.data() + firstFloat);
+  RenderStats::countBuffer(bytes);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+  if (_indices.size() > _iboCapacity) {
+    _iboCapacity = std::max(_indices.size(), 2 * _iboCapacity);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _iboCapacity * sizeof(GLuint),
+        nullptr, GL_STATIC_DRAW);
+    firstIndex = 0;
+  }
+  bytes = (_indices.size() - firstIndex) * sizeof(GLuint);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(GLuint),
+      bytes, _indices.data() + firstIndex);
+  RenderStats::countBuffer(bytes);
+
+  glBindVertexArray(0);
+}
+
+}  // namespace agl
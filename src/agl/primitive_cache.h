@@ -0,0 +1,119 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_PRIMITIVE_CACHE_H_
+#define AGL_PRIMITIVE_CACHE_H_
+
+#include <cstddef>
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief The built-in primitives at several levels of detail, packed into
+ * one vertex buffer and one index buffer
+ *
+ * The first time a shape is drawn, its tessellations for every level are
+ * generated and appended to the shared buffers, so every primitive draw
+ * uses the same vertex array. Tessellations are kept for the life of the
+ * process and shared by all caches (e.g. one per Renderer), so each one is
+ * only generated once.
+ *
+ * Level Levels - 1 uses the finest subdivision given to the constructor,
+ * and each level below it halves it. level() picks the coarsest level
+ * whose edges are at most PixelsPerSegment long on screen. The cube and
+ * the plane have a single level.
+ *
+ * Users do not need to use this class directly.
+ * @see Renderer::sphere()
+ */
+class PrimitiveCache {
+ public:
+  enum Shape {
+    CUBE = 0,
+    PLANE,
+    SPHERE,
+    CYLINDER,
+    CONE,
+    CAPSULE,
+    TORUS,
+    TEAPOT,
+    NUM_SHAPES
+  };
+
+  static const int Levels = 4;
+
+  /**
+   * @brief Create an empty cache
+   * @param subdivision The number of slices and stacks of the finest level
+   */
+  explicit PrimitiveCache(int subdivision);
+  ~PrimitiveCache();
+
+  /**
+   * @brief Return the radius of a bounding sphere centered at the origin
+   */
+  float boundingRadius(Shape shape);
+
+  /**
+   * @brief Return whether a shape has more than one level of detail
+   */
+  static bool hasLevels(Shape shape);
+
+  /**
+   * @brief Return the level of detail for a shape whose bounding sphere
+   * has the given radius in pixels
+   */
+  int level(Shape shape, float pixelRadius) const;
+
+  /**
+   * @brief Return the number of slices used for a level
+   */
+  int subdivision(Shape shape, int level) const;
+
+  /**
+   * @brief Draw a shape with the current shader
+   */
+  void draw(Shape shape, int level);
+
+  /**
+   * @brief Delete the GL buffers (tessellations stay cached)
+   */
+  void cleanup();
+
+  /** @brief Return the bytes uploaded to the shared buffers */
+  size_t bytes() const;
+
+  /**
+   * @brief Longest edge, in pixels, that level() accepts
+   */
+  static float PixelsPerSegment;
+
+ private:
+  struct Entry {
+    GLint baseVertex;
+    GLuint firstIndex;
+    GLsizei count;
+  };
+
+  void load(Shape shape);
+  void upload(size_t firstFloat, size_t firstIndex);
+
+  int _subdivision;
+  bool _loaded[NUM_SHAPES];
+  float _radius[NUM_SHAPES];
+  Entry _entries[NUM_SHAPES][Levels];
+
+  // Copies of the buffer contents, needed when the buffers grow
+  std::vector<GLfloat> _vertices;  // position, normal, uv
+  std::vector<GLuint> _indices;
+
+  GLuint _vao, _vbo, _ibo;
+  size_t _vboCapacity, _iboCapacity;  // in elements
+
+  PrimitiveCache(const PrimitiveCache&) = delete;
+  PrimitiveCache& operator=(const PrimitiveCache&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_PRIMITIVE_CACHE_H_
@@ -0,0 +1,242 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/profiler.h"
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace agl {
+
+std::string Profiler::TraceFile = "agl-trace.json";
+size_t Profiler::MaxEvents = 1000000;
+
+namespace {
+
+struct Event {
+  const char* name;
+  double start;     // microseconds
+  double duration;  // microseconds
+  int tid;          // 0 is the GPU track
+};
+
+// GPU work is recorded as a sequence of ops and laid out when the queries
+// have finished. A SEGMENT is a single query; nested scopes pause their
+// parent, so each scope is made of one or more segments.
+enum GpuOpType { BEGIN, SEGMENT, END };
+
+struct GpuOp {
+  GpuOpType type;
+  const char* name;  // BEGIN
+  GLuint query;      // SEGMENT
+};
+
+struct GpuFrame {
+  double cpuStart;  // when the frame's first GPU scope began
+  std::vector<GpuOp> ops;
+};
+
+// Frames whose queries may still be in flight before endFrame() waits
+const size_t MaxPendingFrames = 3;
+
+const std::chrono::steady_clock::time_point StartTime =
+    std::chrono::steady_clock::now();
+
+std::mutex Mutex;  // guards Events, ThreadIds and Names
+std::vector<Event> Events;
+std::map<std::thread::id, int> ThreadIds;
+std::set<std::string> Names;
+bool Dropped = false;
+
+// GPU state is only used from the thread that owns the GL context
+GpuFrame Current;
+std::deque<GpuFrame> Pending;
+std::vector<GLuint> FreeQueries;
+std::vector<GLuint> AllQueries;
+int GpuDepth = 0;
+GLuint ActiveQuery = 0;
+
+void record(const char* name, double start, double end, int tid) {
+  if (Events.size() >= Profiler::MaxEvents) {
+    if (!Dropped) {
+      std::cout << "WARNING: Profiler::MaxEvents reached; "
+          "later scopes are not recorded\n";
+      Dropped = true;
+    }
+    return;
+  }
+  Event event = {name, start, end - start, tid};
+  Events.push_back(event);
+}
+
+int threadId() {
+  auto id = ThreadIds.find(std::this_thread::get_id());
+  if (id != ThreadIds.end()) return id->second;
+  int tid = static_cast<int>(ThreadIds.size()) + 1;
+  ThreadIds[std::this_thread::get_id()] = tid;
+  return tid;
+}
+
+void startQuery() {
+  if (FreeQueries.empty()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    AllQueries.push_back(query);
+    FreeQueries.push_back(query);
+  }
+  ActiveQuery = FreeQueries.back();
+  FreeQueries.pop_back();
+  glBeginQuery(GL_TIME_ELAPSED, ActiveQuery);
+}
+
+void stopQuery() {
+  glEndQuery(GL_TIME_ELAPSED);
+  GpuOp op = {SEGMENT, nullptr, ActiveQuery};
+  Current.ops.push_back(op);
+  ActiveQuery = 0;
+}
+
+bool ready(const GpuFrame& frame) {
+  // Queries finish in order, so the last one is enough
+  for (auto op = frame.ops.rbegin(); op != frame.ops.rend(); ++op) {
+    if (op->type != SEGMENT) continue;
+    GLint available = 0;
+    glGetQueryObjectiv(op->query, GL_QUERY_RESULT_AVAILABLE, &available);
+    return available != 0;
+  }
+  return true;
+}
+
+// Lays the frame's scopes out back to back on the GPU track (blocks if the
+// queries haven't finished)
+void resolve(const GpuFrame& frame) {
+  std::vector<std::pair<const char*, double>> open;
+  double cursor = frame.cpuStart;
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  for (const GpuOp& op : frame.ops) {
+    if (op.type == BEGIN) {
+      open.push_back(std::make_pair(op.name, cursor));
+    } else if (op.type == SEGMENT) {
+      GLuint64 elapsed = 0;  // nanoseconds
+      glGetQueryObjectui64v(op.query, GL_QUERY_RESULT, &elapsed);
+      cursor += elapsed / 1000.0;
+      FreeQueries.push_back(op.query);
+    } else if (!open.empty()) {
+      record(open.back().first, open.back().second, cursor, 0);
+      open.pop_back();
+    }
+  }
+}
+
+void writeName(std::ostream& out, const char* name) {
+  out << '"';
+  for (const char* c = name; *c; c++) {
+    if (*c == '"' || *c == '\\') out << '\\' << *c;
+    else if (static_cast<unsigned char>(*c) >= 0x20) out << *c;
+  }
+  out << '"';
+}
+
+}  // namespace
+
+double Profiler::now() {
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - StartTime;
+  return elapsed.count();
+}
+
+void Profiler::addEvent(const char* name, double start, double end) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  record(name, start, end, threadId());
+}
+
+void Profiler::beginGpu(const char* name) {
+  if (Current.ops.empty()) Current.cpuStart = now();
+  if (GpuDepth > 0) stopQuery();
+  GpuOp op = {BEGIN, name, 0};
+  Current.ops.push_back(op);
+  GpuDepth++;
+  startQuery();
+}
+
+void Profiler::endGpu() {
+  if (GpuDepth == 0) return;
+  stopQuery();
+  GpuOp op = {END, nullptr, 0};
+  Current.ops.push_back(op);
+  GpuDepth--;
+  if (GpuDepth > 0) startQuery();
+}
+
+void Profiler::endFrame() {
+  // Scopes left open (e.g. around the whole frame) continue in the next one
+  if (GpuDepth == 0 && !Current.ops.empty()) {
+    Pending.push_back(std::move(Current));
+    Current = GpuFrame();
+  }
+
+  while (!Pending.empty() &&
+      (Pending.size() > MaxPendingFrames || ready(Pending.front()))) {
+    resolve(Pending.front());
+    Pending.pop_front();
+  }
+}
+
+void Profiler::finish() {
+  while (GpuDepth > 0) endGpu();
+  endFrame();
+  while (!Pending.empty()) {
+    resolve(Pending.front());
+    Pending.pop_front();
+  }
+
+  if (!AllQueries.empty()) {
+    glDeleteQueries(static_cast<GLsizei>(AllQueries.size()),
+        AllQueries.data());
+  }
+  AllQueries.clear();
+  FreeQueries.clear();
+}
+
+bool Profiler::writeTrace(const std::string& filename) {
+  std::ofstream out(filename);
+  if (!out) {
+    std::cout << "ERROR: Cannot write profile " << filename << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+      "\"args\":{\"name\":\"GPU\"}}";
+  for (const auto& thread : ThreadIds) {
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<
+        thread.second << ",\"args\":{\"name\":\"CPU " << thread.second <<
+        "\"}}";
+  }
+
+  out.precision(3);
+  out << std::fixed;
+  for (const Event& event : Events) {
+    out << ",\n{\"name\":";
+    writeName(out, event.name);
+    out << ",\"cat\":\"" << (event.tid == 0 ? "gpu" : "cpu") <<
+        "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid <<
+        ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+  }
+  out << "\n]}\n";
+  return static_cast<bool>(out);
+}
+
+const char* Profiler::intern(const std::string& name) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Names.insert(name).first->c_str();
+}
+
+}  // namespace agl
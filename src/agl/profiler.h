@@ -0,0 +1,156 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_PROFILER_H_
+#define AGL_PROFILER_H_
+
+#include <string>
+#include "agl/agl.h"
+
+/**
+ * @brief Time the enclosing block on the CPU
+ *
+ * Expands to nothing unless AGL_PROFILE is defined (see the CMake option
+ * of the same name). name must outlive the program, e.g. a string literal
+ * or a string returned by Profiler::intern().
+ * ```
+ * void Renderer::loadTexture(...) {
+ *   AGL_PROFILE_SCOPE("Renderer::loadTexture");
+ *   ...
+ * }
+ * ```
+ */
+#ifdef AGL_PROFILE
+#define AGL_PROFILE_SCOPE(name) \
+  agl::ProfileScope AGL_PROFILE_CONCAT(aglProfileScope, __LINE__)(name)
+
+/**
+ * @brief Time the enclosing block on the CPU and the GPU
+ *
+ * GPU time is measured with GL_TIME_ELAPSED queries, so a GL context must
+ * be current.
+ */
+#define AGL_PROFILE_GPU_SCOPE(name) \
+  agl::GpuProfileScope AGL_PROFILE_CONCAT(aglGpuProfileScope, __LINE__)(name)
+
+#define AGL_PROFILE_CONCAT(a, b) AGL_PROFILE_CONCAT2(a, b)
+#define AGL_PROFILE_CONCAT2(a, b) a##b
+#else
+#define AGL_PROFILE_SCOPE(name) ((void) 0)
+#define AGL_PROFILE_GPU_SCOPE(name) ((void) 0)
+#endif
+
+namespace agl {
+
+/**
+ * @brief Collects CPU and GPU timings and saves them as a Chrome trace
+ *
+ * Scopes are recorded from program start, so the trace covers startup
+ * (context creation, shader and texture loading) as well as each frame.
+ * Open the file in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * GPU scopes nest: while an inner scope is open, the outer scope's query
+ * is paused, and its time is the sum of its own and its children's
+ * queries. Results are read back a couple of frames later so that
+ * queries never stall the pipeline. The "GPU" track in the trace shows
+ * each frame's GPU work back to back, starting when the frame started on
+ * the CPU; idle time between GPU scopes isn't measured.
+ *
+ * Use the AGL_PROFILE_SCOPE and AGL_PROFILE_GPU_SCOPE macros rather than
+ * calling these methods directly.
+ */
+class Profiler {
+ public:
+  /**
+   * @brief Return microseconds since the profiler started
+   */
+  static double now();
+
+  /**
+   * @brief Record a finished CPU scope on the calling thread
+   */
+  static void addEvent(const char* name, double start, double end);
+
+  /**
+   * @brief Start a GPU scope (pausing the enclosing one)
+   */
+  static void beginGpu(const char* name);
+
+  /**
+   * @brief End the innermost GPU scope
+   */
+  static void endGpu();
+
+  /**
+   * @brief Finish a frame and collect GPU results that are ready
+   *
+   * Window calls this method once per frame.
+   */
+  static void endFrame();
+
+  /**
+   * @brief Wait for all GPU results and release the GL queries
+   *
+   * Window calls this method before its context is destroyed.
+   */
+  static void finish();
+
+  /**
+   * @brief Save everything recorded so far as Chrome trace JSON
+   */
+  static bool writeTrace(const std::string& filename);
+
+  /**
+   * @brief Return a copy of name that lives until the program exits
+   */
+  static const char* intern(const std::string& name);
+
+  /**
+   * @brief The trace saved when the Window is destroyed (empty = none)
+   */
+  static std::string TraceFile;
+
+  /**
+   * @brief Recording stops after this many events to bound memory use
+   */
+  static size_t MaxEvents;
+};
+
+/**
+ * @brief Records a CPU scope when it goes out of scope
+ * @see AGL_PROFILE_SCOPE
+ */
+class ProfileScope {
+ public:
+  explicit ProfileScope(const char* name) :
+    _name(name), _start(Profiler::now()) {
+  }
+
+  ~ProfileScope() {
+    Profiler::addEvent(_name, _start, Profiler::now());
+  }
+
+ private:
+  const char* _name;
+  double _start;
+};
+
+/**
+ * @brief Records a CPU and a GPU scope when it goes out of scope
+ * @see AGL_PROFILE_GPU_SCOPE
+ */
+class GpuProfileScope {
+ public:
+  explicit GpuProfileScope(const char* name) : _cpu(name) {
+    Profiler::beginGpu(name);
+  }
+
+  ~GpuProfileScope() {
+    Profiler::endGpu();
+  }
+
+ private:
+  ProfileScope _cpu;
+};
+
+}  // namespace agl
+#endif  // AGL_PROFILER_H_
@@ -0,0 +1,125 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/program_cache.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "agl/shader.h"
+
+namespace agl {
+
+bool ProgramCache::Enabled = true;
+
+static const char CacheMagic[8] = {'A', 'G', 'L', 'P', 'R', 'G', '0', '1'};
+
+// FNV-1a, continued from the given hash
+static uint64_t hashBytes(const char* data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+ProgramCache::ProgramCache() : _supported(-1) {
+}
+
+bool ProgramCache::supported() {
+  if (_supported == -1) {
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    _supported = formats > 0 ? 1 : 0;
+  }
+  return Enabled && _supported == 1;
+}
+
+const std::string& ProgramCache::driver() {
+  if (_driver.empty()) {
+    GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for (GLenum name : names) {
+      const GLubyte* str = glGetString(name);
+      if (str) _driver += reinterpret_cast<const char*>(str);
+      _driver += "\n";
+    }
+  }
+  return _driver;
+}
+
+uint64_t ProgramCache::sourceHash(const std::vector<std::string>& sources,
+    const std::string& defines) const {
+  uint64_t hash = 14695981039346656037ull;
+  hash = hashBytes(defines.data(), defines.size() + 1, hash);
+  for (const std::string& fileName : sources) {
+    std::ifstream file(fileName, std::ios::binary);
+    std::string code((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    // Separate files so moving text between them changes the hash
+    hash = hashBytes(code.data(), code.size() + 1, hash);
+  }
+  return hash;
+}
+
+bool ProgramCache::load(Shader* shader, const std::string& cacheFile,
+    const std::vector<std::string>& sources, const std::string& defines) {
+  if (!supported()) return false;
+
+  std::ifstream file(cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  char magic[sizeof(CacheMagic)];
+  uint64_t hash = 0;
+  uint32_t header[3];  // driver length, binary format, binary length
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!file || memcmp(magic, CacheMagic, sizeof(magic)) != 0 ||
+      hash != sourceHash(sources, defines) || header[0] != driver().size()) {
+    return false;
+  }
+
+  std::string fileDriver(header[0], '\0');
+  file.read(&fileDriver[0], header[0]);
+  if (!file || fileDriver != driver()) return false;
+
+  std::vector<char> binary(header[2]);
+  file.read(binary.data(), binary.size());
+  if (!file) return false;
+
+  return shader->linkBinary(header[1], binary.data(),
+      static_cast<GLsizei>(binary.size()));
+}
+
+bool ProgramCache::save(Shader* shader, const std::string& cacheFile,
+    const std::vector<std::string>& sources, const std::string& defines) {
+  if (!supported()) return false;
+
+  GLenum format = 0;
+  std::vector<char> binary;
+  if (!shader->getBinary(&format, &binary)) return false;
+
+  std::ofstream file(cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  uint64_t hash = sourceHash(sources, defines);
+  uint32_t header[] = {
+    static_cast<uint32_t>(driver().size()),
+    static_cast<uint32_t>(format),
+    static_cast<uint32_t>(binary.size())
+  };
+  file.write(CacheMagic, sizeof(CacheMagic));
+  file.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(driver().data(), driver().size());
+  file.write(binary.data(), binary.size());
+  return file.good();
+}
+
+std::string ProgramCache::cacheFileName(const std::string& name,
+    const std::string& vertexShader) {
+  size_t slash = vertexShader.find_last_of("/\\");
+  std::string dir = (slash == std::string::npos) ?
+      "" : vertexShader.substr(0, slash + 1);
+  return dir + name + ".program";
+}
+
+}  // namespace agl
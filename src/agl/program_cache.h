@@ -0,0 +1,72 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_PROGRAM_CACHE_H_
+#define AGL_PROGRAM_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+class Shader;
+
+/**
+ * @brief Stores linked shader programs on disk as driver binaries
+ *
+ * Each program is saved next to its vertex shader as <name>.program. The
+ * file is keyed on a hash of the shader sources together with the GL
+ * vendor, renderer and version strings, so editing a shader or updating
+ * the driver simply causes a recompile. Drivers may still reject a binary
+ * that matches its key; in that case the program is compiled from source
+ * and the cache entry rewritten.
+ *
+ * Users do not need to use this class directly.
+ * @see Renderer::loadShader
+ */
+class ProgramCache {
+ public:
+  ProgramCache();
+
+  /**
+   * @brief Link a shader from the cache
+   * @param cacheFile The cache entry for this program
+   * @param sources The shader files the program is built from
+   * @param defines Preprocessor lines added to every source
+   * @return Returns false if there is no valid entry; shader is unchanged
+   */
+  bool load(Shader* shader, const std::string& cacheFile,
+      const std::vector<std::string>& sources,
+      const std::string& defines = "");
+
+  /**
+   * @brief Save a linked shader to the cache
+   */
+  bool save(Shader* shader, const std::string& cacheFile,
+      const std::vector<std::string>& sources,
+      const std::string& defines = "");
+
+  /**
+   * @brief Return the cache file for a program with the given name
+   */
+  static std::string cacheFileName(const std::string& name,
+      const std::string& vertexShader);
+
+  /**
+   * @brief Set to false to always compile shaders from source
+   */
+  static bool Enabled;
+
+ private:
+  bool supported();
+  uint64_t sourceHash(const std::vector<std::string>& sources,
+      const std::string& defines) const;
+  const std::string& driver();
+
+  int _supported;       // -1 until the driver has been queried
+  std::string _driver;  // vendor, renderer and version strings
+};
+
+}  // namespace agl
+#endif  // AGL_PROGRAM_CACHE_H_
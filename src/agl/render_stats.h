@@ -0,0 +1,59 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_RENDER_STATS_H_
+#define AGL_RENDER_STATS_H_
+
+#include <cstddef>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief Counts the GL work submitted during one frame
+ *
+ * The library's draw, bind and upload calls add to Current as they run.
+ * Renderer::beginFrame() saves the totals of the finished frame, which
+ * Renderer::stats() returns, and starts counting from zero.
+ * @see Renderer::stats
+ */
+struct RenderStats {
+  int drawCalls = 0;
+  size_t triangles = 0;
+  size_t vertices = 0;         // vertices (or indices) submitted
+  int programSwitches = 0;     // glUseProgram calls
+  int textureBinds = 0;
+  int uniformUploads = 0;
+  size_t bufferBytes = 0;      // bytes uploaded to buffer objects
+  int framebufferSwitches = 0;
+
+  void reset() { *this = RenderStats(); }
+
+  /**
+   * @brief Count a draw of count vertices in the given primitive mode
+   */
+  static void countDraw(GLenum mode, GLsizei count, GLsizei instances = 1) {
+    size_t total = static_cast<size_t>(count) * instances;
+    Current.drawCalls++;
+    Current.vertices += total;
+    if (mode == GL_TRIANGLES) {
+      Current.triangles += total / 3;
+    } else if ((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) &&
+        count > 2) {
+      Current.triangles += static_cast<size_t>(count - 2) * instances;
+    }
+  }
+
+  static void countProgram() { Current.programSwitches++; }
+  static void countTexture() { Current.textureBinds++; }
+  static void countUniform() { Current.uniformUploads++; }
+  static void countBuffer(size_t bytes) { Current.bufferBytes += bytes; }
+  static void countFramebuffer() { Current.framebufferSwitches++; }
+
+  /**
+   * @brief Counters for the frame in progress
+   */
+  static RenderStats Current;
+};
+
+}  // namespace agl
+#endif  // AGL_RENDER_STATS_H_
@@ -1,26 +1,25 @@
 // Copyright 2020, Savvy Sine, Aline Normoyle
 
 #include "agl/renderer.h"
+#include <algorithm>
+#include <cstddef>
 #include <fstream>
+#include <limits>
 #include <sstream>
 #include "agl/image.h"
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
 #include "agl/shader.h"
-#include "agl/mesh/sphere.h"
-#include "agl/mesh/cube.h"
-#include "agl/mesh/cylinder.h"
-#include "agl/mesh/capsule.h"
-#include "agl/mesh/teapot.h"
-#include "agl/mesh/torus.h"
-#include "agl/mesh/plane.h"
 #include "agl/mesh/skybox.h"
-#define FONTSTASH_IMPLEMENTATION
-#include "fontstash/fontstash.h"
-#define GLFONTSTASH_IMPLEMENTATION
-#include "fontstash/gl3corefontstash.h"
+#include "agl/mesh/teapot.h"
+#include "agl/primitive_cache.h"
+#include "agl/bezier_patches.h"
+#include "agl/text_layer.h"
+#include "agl/texture_cache.h"
+#include "agl/program_cache.h"
 
 namespace agl {
 
-static FONScontext* _fs = NULL;
 using glm::vec2;
 using glm::vec3;
 using glm::vec4;
@@ -31,21 +30,32 @@ using std::string;
 using std::vector;
 
 int Renderer::PrimitiveSubdivision = 32;
+bool Renderer::TessellatePatches = true;
+RenderStats RenderStats::Current;
 
 Renderer::Renderer() {
-  _cube = 0;
-  _cone = 0;
-  _capsule = 0;
-  _cylinder = 0;
-  _teapot = 0;
-  _torus = 0;
-  _plane = 0;
-  _sphere = 0;
+  _primitives = 0;
+  _teapotPatches = 0;
   _skybox = 0;
   _blendMode = DEFAULT;
 
-  _fontNormal = FONS_INVALID;
-  _fs = NULL;
+  mBBVboPosId = 0;
+  mBBVaoId = 0;
+  mBBVboInstanceId = 0;
+  mBBInstanceVaoId = 0;
+  mBBInstanceCapacity = 0;
+  mFullscreenVaoId = 0;
+  mVboLinePosId = 0;
+  mVboLineColorId = 0;
+  mVaoLineId = 0;
+
+  _textLayer = 0;
+  _programCache = new ProgramCache();
+
+  _showStats = false;
+  _statsLog = 0;
+  _statsFrame = 0;
+  _viewportHeight = 0;
 
   _currentShader = 0;
   _initialized = false;
@@ -53,35 +63,50 @@ Renderer::Renderer() {
 
 Renderer::~Renderer() {
   cleanup();
+  delete _programCache;
+  delete _statsLog;
 }
 
 void Renderer::cleanup() {
-  glfonsDelete(_fs);
-  _fs = NULL;
-  _fontNormal = FONS_INVALID;
-
-  delete _cube;
-  delete _cone;
-  delete _capsule;
-  delete _cylinder;
-  delete _teapot;
-  delete _torus;
-  delete _plane;
-  delete _sphere;
+  delete _textLayer;
+  _textLayer = 0;
+
+  delete _primitives;
+  delete _teapotPatches;
   delete _skybox;
 
-  _cube = 0;
-  _cone = 0;
-  _capsule = 0;
-  _cylinder = 0;
-  _teapot = 0;
-  _torus = 0;
-  _plane = 0;
-  _sphere = 0;
+  _primitives = 0;
+  _teapotPatches = 0;
   _skybox = 0;
 
-  for (auto it : _shaders) {
-    delete it.second;
+  if (mBBVaoId != 0) {
+    glDeleteVertexArrays(1, &mBBVaoId);
+    glDeleteBuffers(1, &mBBVboPosId);
+    glDeleteVertexArrays(1, &mBBInstanceVaoId);
+    glDeleteBuffers(1, &mBBVboInstanceId);
+    mBBVaoId = 0;
+    mBBVboPosId = 0;
+    mBBInstanceVaoId = 0;
+    mBBVboInstanceId = 0;
+    mBBInstanceCapacity = 0;
+  }
+  if (mVaoLineId != 0) {
+    glDeleteVertexArrays(1, &mVaoLineId);
+    glDeleteBuffers(1, &mVboLinePosId);
+    glDeleteBuffers(1, &mVboLineColorId);
+    mVaoLineId = 0;
+    mVboLinePosId = 0;
+    mVboLineColorId = 0;
+  }
+  if (mFullscreenVaoId != 0) {
+    glDeleteVertexArrays(1, &mFullscreenVaoId);
+    mFullscreenVaoId = 0;
+  }
+
+  for (auto& it : _shaders) {
+    for (auto& variant : it.second.variants) {
+      delete variant.second;
+    }
   }
   _shaders.clear();
   _textures.clear();
@@ -98,31 +123,42 @@ vec3 Renderer::cameraPosition() const {
 }
 
 void Renderer::init() {
+  Shader::enableParallelCompile();
+
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
   glCullFace(GL_BACK);
 
+  // Refreshed by beginFrame() and the render texture calls
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  _viewportHeight = static_cast<float>(viewport[3]);
+
   // setup default camera and projection
   float halfw = 1.0;
   float halfh = 1.0;
   ortho(-halfw, halfw, -halfh, halfh, -10.0f, 10.0f);
   lookAt(vec3(0, 0, 2), vec3(0, 0, 0));
 
-  initLines();
-  initBillboards();
+  // Subsystems (shaders, fonts, primitives, sprite and line buffers) are
+  // created the first time they are used, so applications only pay for
+  // what they draw
+  registerShader("lines", "../shaders/lines.vs", "../shaders/lines.fs", {});
+  registerShader("sprite",
+      "../shaders/billboard.vs",
+      "../shaders/billboard.fs", {});
+  registerShader("sprite-batch",
+      "../shaders/billboard-batch.vs",
+      "../shaders/billboard.fs", {});
   initText();
-  loadShader("cubemap", "../shaders/cubemap.vs", "../shaders/cubemap.fs");
-  loadShader("unlit", "../shaders/unlit.vs", "../shaders/unlit.fs");
-
-  _cube = new Cube(1.0f);
-  _cone = new Cylinder(0.5f, 0.01, 1, PrimitiveSubdivision);
-  _capsule = new Capsule(0.25, 0.5, PrimitiveSubdivision, PrimitiveSubdivision);
-  _cylinder = new Cylinder(0.5, 1.0, PrimitiveSubdivision);
-  _teapot = new Teapot(13, mat4(1.0));
-  _torus = new Torus(0.5, 0.25, PrimitiveSubdivision, PrimitiveSubdivision);
-  _plane = new Plane(1.0, 1.0, 1.0, 1.0);
-  _sphere = new Sphere(0.5f, PrimitiveSubdivision, PrimitiveSubdivision);
-  _skybox = new SkyBox(1);
+  registerShader("cubemap", "../shaders/cubemap.vs", "../shaders/cubemap.fs", {});
+  registerShader("unlit", "../shaders/unlit.vs", "../shaders/unlit.fs", {});
+  registerShader("oit-composite", "../shaders/fullscreen.vs",
+      "../shaders/oit-composite.fs", {});
+  registerShader("upscale", "../shaders/fullscreen.vs",
+      "../shaders/upscale.fs", {});
+
+  _primitives = new PrimitiveCache(PrimitiveSubdivision);
   _trs = mat4(1.0);
   _initialized = true;
 
@@ -130,7 +166,7 @@ void Renderer::init() {
 }
 
 void Renderer::initLines() {
-  loadShader("lines", "../shaders/lines.vs", "../shaders/lines.fs");
+  AGL_PROFILE_SCOPE("Renderer::initLines");
   const float positions[] = {
     0.0f, 0.0f, 1.0f,
     1.0f, 0.0f, 0.0f
@@ -157,6 +193,7 @@ void Renderer::initLines() {
 }
 
 void Renderer::initBillboards() {
+  AGL_PROFILE_SCOPE("Renderer::initBillboards");
   const float positions[] = {
      0.0f, 0.0f, 0.0f,
      1.0f, 0.0f, 0.0f,
@@ -178,25 +215,36 @@ void Renderer::initBillboards() {
   glBindBuffer(GL_ARRAY_BUFFER, mBBVboPosId);  // bind before setting data
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<GLubyte*>(0));
 
-  loadShader("sprite",
-      "../shaders/billboard.vs",
-      "../shaders/billboard.fs");
-}
+  // Instanced billboards share the quad positions (attribute 0) and read
+  // one SpriteInstance per quad (attributes 1 and 2)
+  glGenBuffers(1, &mBBVboInstanceId);
+  glGenVertexArrays(1, &mBBInstanceVaoId);
+  glBindVertexArray(mBBInstanceVaoId);
 
-void Renderer::initText() {
-    loadShader("text", "../shaders/text.vs", "../shaders/text.fs");
-    _fs = glfonsCreate(512, 512, FONS_ZERO_TOPLEFT);
-    if (_fs == NULL) {
-      printf("Could not create stash.\n");
-    }
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, mBBVboPosId);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<GLubyte*>(0));
 
-    _fontNormal = fonsAddFont(_fs, "sans", "../fonts/DroidSerif-Regular.ttf");
-    if (_fontNormal == FONS_INVALID) {
-      printf("Could not add font normal.\n");
-    }
+  GLsizei stride = sizeof(SpriteInstance);
+  glBindBuffer(GL_ARRAY_BUFFER, mBBVboInstanceId);
+  glEnableVertexAttribArray(1);  // xyz = offset, w = size
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLvoid*>(offsetof(SpriteInstance, pos)));
+  glVertexAttribDivisor(1, 1);
 
-    _fontColor = glfonsRGBA(255, 255, 255, 255);
-    _fontSize = 20.0;
+  glEnableVertexAttribArray(2);  // color
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLvoid*>(offsetof(SpriteInstance, color)));
+  glVertexAttribDivisor(2, 1);
+  glBindVertexArray(0);
+}
+
+void Renderer::initText() {
+    registerShader("text", "../shaders/text.vs", "../shaders/text.fs", {});
+    _textLayer = new TextLayer();
+    _textLayer->setFont("../fonts/DroidSerif-Regular.ttf");  // loaded lazily
+    _textLayer->setColor(TextLayer::packColor(vec4(1.0f)));
+    _textLayer->setSize(20.0f);
 }
 
 void Renderer::cullMode(CullMode mode) {
@@ -228,6 +276,12 @@ void Renderer::blendMode(BlendMode mode) {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // Alpha blend
 
+  } else if (mode == OIT) {
+    _blendMode = OIT;
+    glEnable(GL_BLEND);
+    glBlendFunci(0, GL_ONE, GL_ONE);                  // sum weighted colors
+    glBlendFunci(1, GL_ONE, GL_ONE_MINUS_SRC_COLOR);  // combine coverage
+
   } else {
     _blendMode = DEFAULT;
     glDisable(GL_BLEND);
@@ -254,49 +308,48 @@ void Renderer::texture(const std::string& uniformName,
     const std::string& textureName) {
   assert(_textures.count(textureName) != 0);
 
-  glActiveTexture(GL_TEXTURE0 + _textures[textureName].slot);
-  glBindTexture(GL_TEXTURE_2D, _textures[textureName].texId);
-  setUniform(uniformName, _textures[textureName].slot);
+  const Texture& tex = _textures[textureName];
+  glActiveTexture(GL_TEXTURE0 + tex.slot);
+  glBindTexture(tex.target, tex.texId);
+  RenderStats::countTexture();
+  setUniform(uniformName, tex.slot);
 }
 
 void Renderer::fontColor(const glm::vec4& c) {
-  unsigned char r = (unsigned char) (c[0]*255.9);
-  unsigned char g = (unsigned char) (c[1]*255.9);
-  unsigned char b = (unsigned char) (c[2]*255.9);
-  unsigned char a = (unsigned char) (c[3]*255.9);
-  _fontColor = glfonsRGBA(r, g, b, a);
+  _textLayer->setColor(TextLayer::packColor(c));
 }
 
 void Renderer::fontSize(int s) {
-  _fontSize = s;
+  _textLayer->setSize(s);
 }
 
 float Renderer::textWidth(const std::string& s) {
-  float w = fonsTextBounds(_fs, 0, 0, s.c_str(), NULL, NULL);
-  return w;
+  return _textLayer->textWidth(s);
 }
 
 float Renderer::textHeight() {
-  float lineh = 0;
-  fonsVertMetrics(_fs, NULL, NULL, &lineh);
-  return lineh;
+  return _textLayer->textHeight();
 }
 
 void Renderer::text(const std::string& text, float x, float y) {
-  float viewport[4]; 
+  assert(_initialized);
+  _textLayer->queue(text, x, y);
+}
+
+void Renderer::flushText() {
+  if (_textLayer == 0 || _textLayer->empty()) return;
+
+  float viewport[4];
   glGetFloatv(GL_VIEWPORT, viewport);
 
   mat4 ortho = glm::ortho(0.0f, viewport[2], viewport[3], 0.0f, -100.0f, 100.0f);
   BlendMode m = _blendMode;
   blendMode(BLEND);
   beginShader("text");
-  setUniform("MVP", ortho);
+  _currentShader->setUniform("MVP", ortho);
+  _currentShader->setUniform("fontTexture", TextLayer::FONT_TEXTURE_SLOT);
 
-  fonsSetSize(_fs, _fontSize);
-  fonsSetFont(_fs, _fontNormal);
-  fonsSetColor(_fs, _fontColor);
-  fonsDrawText(_fs, x, y, text.c_str(), NULL);
-  //std::cout << viewport[2] << " " << viewport[3] << std::endl;
+  _textLayer->flush();
 
   endShader();
   blendMode(m);
@@ -305,9 +358,10 @@ void Renderer::text(const std::string& text, float x, float y) {
 void Renderer::line(const glm::vec3& p1, const glm::vec3& p2,
     const glm::vec3& c1, const glm::vec3& c2) {
   assert(_initialized);
+  assert(_currentShader != nullptr);
 
   mat4 mvp = _projectionMatrix * _viewMatrix * _trs;
-  setUniform("MVP", mvp);
+  _currentShader->setUniform("MVP", mvp);
 
   GLfloat positions[6];
   positions[0] = p1.x;
@@ -325,29 +379,93 @@ void Renderer::line(const glm::vec3& p1, const glm::vec3& p2,
   colors[4] = c2.y;
   colors[5] = c2.z;
 
+  if (mVaoLineId == 0) initLines();
   glBindVertexArray(mVaoLineId);
   glBindBuffer(GL_ARRAY_BUFFER, mVboLinePosId);
   glBufferData(GL_ARRAY_BUFFER, 6 * sizeof(float), positions, GL_DYNAMIC_DRAW);
 
   glBindBuffer(GL_ARRAY_BUFFER, mVboLineColorId);
   glBufferData(GL_ARRAY_BUFFER, 6 * sizeof(float), colors, GL_DYNAMIC_DRAW);
+  RenderStats::countBuffer(12 * sizeof(float));
 
   glDrawArrays(GL_LINES, 0, 2);
+  RenderStats::countDraw(GL_LINES, 2);
 }
 
 void Renderer::sprite(const glm::vec3& pos,
     const glm::vec4& color, float size) {
   assert(_initialized);
+  assert(_currentShader != nullptr);
 
   mat4 mvp = _projectionMatrix * _viewMatrix * _trs;
-  setUniform("MVP", mvp);
-  setUniform("CameraPos", _lookfrom);
-  setUniform("Offset", pos);
-  setUniform("Color", color);
-  setUniform("Size", size);
+  _currentShader->setUniform("MVP", mvp);
+  _currentShader->setUniform("CameraPos", _lookfrom);
+  _currentShader->setUniform("Offset", pos);
+  _currentShader->setUniform("Color", color);
+  _currentShader->setUniform("Size", size);
 
+  if (mBBVaoId == 0) initBillboards();
   glBindVertexArray(mBBVaoId);
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  RenderStats::countDraw(GL_TRIANGLES, 6);
+}
+
+void Renderer::sprites(const std::vector<glm::vec3>& positions,
+    const std::vector<glm::vec4>& colors,
+    const std::vector<float>& sizes, bool sortBackToFront) {
+  assert(_initialized);
+  assert(_currentShader != nullptr);
+  assert(positions.size() == colors.size());
+  assert(positions.size() == sizes.size());
+
+  int count = static_cast<int>(positions.size());
+  if (count == 0) return;
+
+  mat4 mvp = _projectionMatrix * _viewMatrix * _trs;
+  _currentShader->setUniform("MVP", mvp);
+  _currentShader->setUniform("CameraPos", _lookfrom);
+
+  // Scratch arrays come from the frame arena so this never hits the heap
+  SpriteInstance* instances = _frameArena.allocate<SpriteInstance>(count);
+  if (sortBackToFront) {
+    // Sprite positions are in model space; compare against the camera
+    // position expressed in the same space
+    vec3 eye = vec3(inverse(_trs) * vec4(_lookfrom, 1.0f));
+    int* order = _frameArena.allocate<int>(count);
+    float* depth = _frameArena.allocate<float>(count);
+    for (int i = 0; i < count; i++) {
+      order[i] = i;
+      depth[i] = glm::distance2(positions[i], eye);
+    }
+    std::sort(order, order + count,
+        [depth](int a, int b) { return depth[a] > depth[b]; });
+
+    for (int i = 0; i < count; i++) {
+      int id = order[i];
+      instances[i] = SpriteInstance{positions[id], sizes[id], colors[id]};
+    }
+  } else {
+    for (int i = 0; i < count; i++) {
+      instances[i] = SpriteInstance{positions[i], sizes[i], colors[i]};
+    }
+  }
+
+  // Orphan the previous frame's storage so the driver never has to wait for
+  // draws that still read from it; only reallocate when the batch grows
+  GLsizeiptr bytes = count * sizeof(SpriteInstance);
+  if (mBBVaoId == 0) initBillboards();
+  glBindBuffer(GL_ARRAY_BUFFER, mBBVboInstanceId);
+  if (bytes > mBBInstanceCapacity) {
+    mBBInstanceCapacity = bytes;
+  }
+  glBufferData(GL_ARRAY_BUFFER, mBBInstanceCapacity, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances);
+  RenderStats::countBuffer(bytes);
+
+  glBindVertexArray(mBBInstanceVaoId);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+  RenderStats::countDraw(GL_TRIANGLES, 6, count);
+  glBindVertexArray(0);
 }
 
 void Renderer::cubemap(const std::string& uniformName,
@@ -355,26 +473,59 @@ void Renderer::cubemap(const std::string& uniformName,
   assert(_textures.count(textureName) != 0);
 
   glBindTexture(GL_TEXTURE_CUBE_MAP, _textures[textureName].texId);
+  RenderStats::countTexture();
   setUniform(uniformName, _textures[textureName].slot);
 }
 
 void Renderer::skybox(float size) {
   assert(_initialized);
+  assert(_currentShader != nullptr);
 
   mat4 s = glm::scale(mat4(1.0f), vec3(size));
   mat4 mvp = _projectionMatrix * _viewMatrix * s;
-  setUniform("MVP", mvp);
+  _currentShader->setUniform("MVP", mvp);
+  if (!_skybox) _skybox = new SkyBox(1);
   _skybox->render();
 }
 
+void Renderer::fullscreen() {
+  assert(_initialized);
+  assert(_currentShader != nullptr);
+
+  // Core profiles need a vertex array bound, even an empty one
+  if (mFullscreenVaoId == 0) glGenVertexArrays(1, &mFullscreenVaoId);
+  glBindVertexArray(mFullscreenVaoId);
+  glDisable(GL_DEPTH_TEST);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glEnable(GL_DEPTH_TEST);
+  RenderStats::countDraw(GL_TRIANGLES, 3);
+}
+
+void Renderer::compositeTransparency(int accumSlot, int coverageSlot,
+    int opaqueSlot) {
+  BlendMode previous = _blendMode;
+  beginShader("oit-composite");
+  _currentShader->setUniform("Accum", accumSlot);
+  _currentShader->setUniform("Coverage", coverageSlot);
+  _currentShader->setUniform("HasOpaque", opaqueSlot >= 0);
+  if (opaqueSlot >= 0) _currentShader->setUniform("Opaque", opaqueSlot);
+  blendMode(opaqueSlot >= 0 ? DEFAULT : BLEND);
+  fullscreen();
+  blendMode(previous);
+  endShader();
+}
+
 void Renderer::push() {
-  _stack.push_front(_trs);
+  if (!_stack.push(_trs)) {
+    std::cout << "WARNING: matrix stack overflow (max depth " <<
+        MatrixStack::capacity() << ")\n";
+  }
 }
 
 void Renderer::pop() {
-  if (_stack.size() == 0) return;
-  _trs = _stack.front();
-  _stack.pop_front();
+  if (_stack.empty()) return;
+  _trs = _stack.top();
+  _stack.pop();
 }
 
 void Renderer::identity() {
@@ -402,55 +553,113 @@ void Renderer::transform(const glm::mat4& trs) {
 }
 
 void Renderer::teapot() {
-  mesh(*_teapot);
+  if (TessellatePatches && loadTeapotPatches()) {
+    AGL_PROFILE_SCOPE("Renderer::teapot");
+    assert(_currentShader != nullptr);
+    setTransformUniforms(true);
+    _teapotPatches->draw(_viewMatrix * _trs, _projectionMatrix,
+        _viewportHeight, _currentShader);
+    return;
+  }
+  primitive(PrimitiveCache::TEAPOT);
+}
+
+bool Renderer::loadTeapotPatches() {
+  assert(_initialized);
+  if (!_teapotPatches) {
+    _teapotPatches = new BezierPatches();
+    std::vector<GLfloat> points;
+    Teapot(13, mat4(1.0)).controlPoints(&points);
+    if (!_teapotPatches->load(points)) {
+      std::cout << "WARNING: Cannot tessellate the teapot on the GPU. "
+          "Using meshes instead." << std::endl;
+    }
+  }
+  return _teapotPatches->loaded();
 }
 
 void Renderer::plane() {
-  mesh(*_plane);
+  primitive(PrimitiveCache::PLANE);
 }
 
 void Renderer::cylinder() {
-  mesh(*_cylinder);
+  primitive(PrimitiveCache::CYLINDER);
 }
 
 void Renderer::capsule() {
-  mesh(*_capsule);
+  primitive(PrimitiveCache::CAPSULE);
 }
 
 void Renderer::torus() {
-  mesh(*_torus);
+  primitive(PrimitiveCache::TORUS);
 }
 
 void Renderer::cone() {
-  mesh(*_cone);
+  primitive(PrimitiveCache::CONE);
 }
 
 void Renderer::cube() {
-  mesh(*_cube);
+  primitive(PrimitiveCache::CUBE);
 }
 
 void Renderer::sphere() {
-  mesh(*_sphere);
+  primitive(PrimitiveCache::SPHERE);
+}
+
+void Renderer::primitive(int shape) {
+  AGL_PROFILE_SCOPE("Renderer::primitive");
+  assert(_initialized);
+  assert(_currentShader != nullptr);
+
+  PrimitiveCache::Shape id = static_cast<PrimitiveCache::Shape>(shape);
+  int level = 0;
+  if (PrimitiveCache::hasLevels(id)) {
+    float radius = projectedRadius(_primitives->boundingRadius(id));
+    level = _primitives->level(id, radius);
+  }
+  setTransformUniforms(true);
+  _primitives->draw(id, level);
+}
+
+float Renderer::projectedRadius(float radius) const {
+  // Radius of a sphere at the model's origin, scaled like its longest axis
+  mat4 mv = _viewMatrix * _trs;
+  float scale = std::max(length(vec3(mv[0])),
+      std::max(length(vec3(mv[1])), length(vec3(mv[2]))));
+  radius *= scale;
+
+  float pixels = 0.5f * _viewportHeight * _projectionMatrix[1][1] * radius;
+  if (_projectionMatrix[2][3] != 0) {  // perspective
+    float depth = -mv[3].z;
+    if (depth <= radius) return std::numeric_limits<float>::max();
+    pixels /= depth;
+  }
+  return pixels;
 }
 
 void Renderer::mesh(const Mesh& mesh) {
+  AGL_PROFILE_SCOPE("Renderer::mesh");
   assert(_initialized);
+  assert(_currentShader != nullptr);
+
+  setTransformUniforms(mesh.hasUV());
+  mesh.render();
+}
 
+void Renderer::setTransformUniforms(bool hasUV) {
   mat4 mv = _viewMatrix * _trs;
   mat4 mvp = _projectionMatrix * mv;
   mat3 nmv = transpose(inverse(mat3(vec3(mv[0]), vec3(mv[1]), vec3(mv[2]))));
   mat3 nm = transpose(inverse(mat3(vec3(_trs[0]), vec3(_trs[1]), vec3(_trs[2]))));
 
-  setUniform("MVP", mvp);
-  setUniform("ModelViewMatrix", mv);
-  setUniform("NormalMatrix", nmv);
-  setUniform("ViewMatrix", _viewMatrix);
-  setUniform("ProjectionMatrix", _projectionMatrix);
-  setUniform("ModelMatrix", _trs);
-  setUniform("ModelInverseTransposeMatrix", nm);
-  setUniform("HasUV", mesh.hasUV());
-
-  mesh.render();
+  _currentShader->setUniform("MVP", mvp);
+  _currentShader->setUniform("ModelViewMatrix", mv);
+  _currentShader->setUniform("NormalMatrix", nmv);
+  _currentShader->setUniform("ViewMatrix", _viewMatrix);
+  _currentShader->setUniform("ProjectionMatrix", _projectionMatrix);
+  _currentShader->setUniform("ModelMatrix", _trs);
+  _currentShader->setUniform("ModelInverseTransposeMatrix", nm);
+  _currentShader->setUniform("HasUV", hasUV);
 }
 
 void Renderer::cleanupShaders() {
@@ -459,25 +668,136 @@ void Renderer::cleanupShaders() {
   }
 }
 
+void Renderer::beginFrame() {
+  _frameArena.reset();
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  _viewportHeight = static_cast<float>(viewport[3]);
+
+  _stats = RenderStats::Current;
+  RenderStats::Current.reset();
+  if (_statsLog) {
+    *_statsLog << _statsFrame << "," << _stats.drawCalls << "," <<
+        _stats.triangles << "," << _stats.vertices << "," <<
+        _stats.programSwitches << "," << _stats.textureBinds << "," <<
+        _stats.uniformUploads << "," << _stats.bufferBytes << "," <<
+        _stats.framebufferSwitches << "\n";
+  }
+  _statsFrame++;
+}
+
+void Renderer::drawStats() {
+  // Short lines stay within std::string's small buffer, so the overlay
+  // doesn't allocate
+  float viewport[4];
+  glGetFloatv(GL_VIEWPORT, viewport);
+
+  // Top-right corner, clear of the labels applications usually draw
+  char line[32];
+  float x = viewport[2] - textWidth("uniforms 0000000") - 10;
+  float y = 15 + textHeight();
+  float lineHeight = 1.25f * textHeight();
+  auto print = [&](const char* label, size_t value) {
+    snprintf(line, sizeof(line), "%s %zu", label, value);
+    text(line, x, y);
+    y += lineHeight;
+  };
+  print("draws", _stats.drawCalls);
+  print("tris", _stats.triangles);
+  print("verts", _stats.vertices);
+  print("programs", _stats.programSwitches);
+  print("textures", _stats.textureBinds);
+  print("uniforms", _stats.uniformUploads);
+  print("buffer KB", _stats.bufferBytes / 1024);
+  print("fbos", _stats.framebufferSwitches);
+}
+
+bool Renderer::logStats(const std::string& filename) {
+  delete _statsLog;
+  _statsLog = 0;
+  if (filename.empty()) return true;
+
+  _statsLog = new std::ofstream(filename);
+  if (!*_statsLog) {
+    std::cout << "ERROR: Cannot write statistics to " << filename << "\n";
+    delete _statsLog;
+    _statsLog = 0;
+    return false;
+  }
+  *_statsLog << "frame,draw_calls,triangles,vertices,program_switches,"
+      "texture_binds,uniform_uploads,buffer_bytes,framebuffer_switches\n";
+  return true;
+}
+
 void Renderer::beginShader(const std::string& shaderName) {
-  assert(_shaders.count(shaderName) != 0);
+  beginShader(shaderName, 0);
+}
 
-  _shaderStack.push_front(_currentShader);
-  _currentShader = _shaders[shaderName];
+void Renderer::beginShader(const std::string& shaderName,
+    unsigned int features) {
+  Shader* shader = findShader(shaderName, features);
+
+  bool pushed = _shaderStack.push(_currentShader);
+  assert(pushed && "shader stack overflow: missing endShader()?");
+  (void) pushed;
+  _currentShader = shader;
   _currentShader->use();
 }
 
+Shader* Renderer::findShader(const std::string& name, unsigned int features) {
+  auto it = _shaders.find(name);
+  assert(it != _shaders.end());
+  ShaderProgram& program = it->second;
+
+  // Variants, including registered built-in programs, are only created the
+  // first time they are used
+  Shader* shader = 0;
+  auto variant = program.variants.find(features);
+  if (variant != program.variants.end()) {
+    shader = variant->second;
+  } else {
+    shader = createShader(name, features);
+  }
+
+  if (!shader->isLinked()) {
+    AGL_PROFILE_SCOPE("Shader::finishLink");
+    shader->finishLink();
+    std::cout << "Loaded shader: " << name << variantSuffix(features) <<
+        std::endl;
+    _programCache->save(shader,
+        ProgramCache::cacheFileName(name + variantSuffix(features), program.vs),
+        {program.vs, program.fs}, variantDefines(program, features));
+  }
+  return shader;
+}
+
+void Renderer::preloadShader(const std::string& shaderName,
+    unsigned int features) {
+  assert(_shaders.count(shaderName) != 0);
+  if (_shaders[shaderName].variants.count(features) == 0) {
+    createShader(shaderName, features);
+  }
+}
+
+bool Renderer::shaderReady(const std::string& shaderName,
+    unsigned int features) {
+  preloadShader(shaderName, features);
+  return _shaders[shaderName].variants[features]->isReady();
+}
+
 void Renderer::endShader() {
   assert(_shaderStack.size() > 0);
 
-  _currentShader = _shaderStack.front();
-  _shaderStack.pop_front();
+  _currentShader = _shaderStack.top();
+  _shaderStack.pop();
 
   if (_currentShader != nullptr) {
     _currentShader->use();
 
   } else {
     glUseProgram(0);
+    RenderStats::countProgram();
   }
 }
 
@@ -558,6 +878,7 @@ void Renderer::loadCubemap(const std::string& name,
 
 void Renderer::loadCubemap(const std::string& name,
     const vector<string>& faces, int slot) {
+  AGL_PROFILE_SCOPE("Renderer::loadCubemap files");
   vector<Image> images;
   for (string filename : faces) {
       Image img;
@@ -569,7 +890,8 @@ void Renderer::loadCubemap(const std::string& name,
 
 void Renderer::loadCubemap(const std::string& name,
     const vector<Image>& faces, int slot) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
+  AGL_PROFILE_SCOPE("Renderer::loadCubemap");
+  if (slot == TextLayer::FONT_TEXTURE_SLOT) {
     std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
   }
   glEnable(GL_TEXTURE0 + slot);
@@ -610,53 +932,181 @@ void Renderer::loadCubemap(const std::string& name,
 
 void Renderer::loadTexture(const std::string& name,
     const std::string& fileName, int slot) {
-  Image img;
-  img.load(fileName);
-  loadTexture(name, img, slot);
+  AGL_PROFILE_SCOPE("Renderer::loadTexture");
+  MipTexture mips;
+  if (!mips.loadFile(fileName, MipTexture::compressionSupported())) {
+    std::cout << "WARNING: cannot load texture " << fileName << std::endl;
+    return;
+  }
+
+  bindNewTexture(name, slot, GL_TEXTURE_2D);
+  mips.upload();
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+      GL_LINEAR_MIPMAP_LINEAR);
+}
+
+void Renderer::loadTextureArray(const std::string& name,
+    const std::vector<std::string>& fileNames, int slot) {
+  AGL_PROFILE_SCOPE("Renderer::loadTextureArray");
+  // Every layer is resampled to the largest width and height
+  int width = 0, height = 0;
+  for (const std::string& fileName : fileNames) {
+    int w, h;
+    if (!MipTexture::imageSize(fileName, &w, &h)) {
+      std::cout << "WARNING: cannot load texture " << fileName << std::endl;
+      return;
+    }
+    width = std::max(width, w);
+    height = std::max(height, h);
+  }
+  if (fileNames.empty()) return;
+
+  bool compress = MipTexture::compressionSupported();
+  std::vector<MipTexture> layers(fileNames.size());
+  bool hasAlpha = false;
+  for (size_t i = 0; i < fileNames.size(); i++) {
+    if (!layers[i].loadFile(fileNames[i], compress, width, height)) {
+      std::cout << "WARNING: cannot load texture " << fileNames[i] << "\n";
+      return;
+    }
+    hasAlpha = hasAlpha || layers[i].format() == MipTexture::BC3;
+  }
+
+  // Layers share one format, so opaque layers follow any layer with alpha
+  if (hasAlpha) {
+    for (MipTexture& layer : layers) {
+      layer.promoteToBC3();
+    }
+  }
+
+  bindNewTexture(name, slot, GL_TEXTURE_2D_ARRAY);
+  MipTexture::allocateArray(layers[0].format(), width, height,
+      layers[0].levels(), static_cast<int>(layers.size()));
+  for (size_t i = 0; i < layers.size(); i++) {
+    layers[i].uploadLayer(static_cast<int>(i));
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+      GL_LINEAR_MIPMAP_LINEAR);
 }
 
 void Renderer::loadTexture(const std::string& name,
     const Image& image, int slot) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
-    std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
+  AGL_PROFILE_SCOPE("Renderer::loadTexture image");
+  int levels = 1;
+  for (int size = std::max(image.width(), image.height()); size > 1;
+       size /= 2) {
+    levels++;
   }
-  glEnable(GL_TEXTURE0 + slot);
-  glActiveTexture(GL_TEXTURE0 + slot);
 
-  GLuint texId;
-  if (_textures.count(name) == 0) {
-    glGenTextures(1, &texId);
-    _textures[name] = Texture{texId, slot};
-  } else {
-    //std::cout << "Warning: texture already registered with name: " << 
-        //name << std::endl;
-    texId = _textures[name].texId;
-  }
-
-  glBindTexture(GL_TEXTURE_2D, texId);
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, image.width(), image.height());
+  bindNewTexture(name, slot, GL_TEXTURE_2D);
+  glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8,
+      image.width(), image.height());
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width(), image.height(),
       GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+  glGenerateMipmap(GL_TEXTURE_2D);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+      GL_LINEAR_MIPMAP_LINEAR);
+}
+
+void Renderer::bindNewTexture(const std::string& name, int slot,
+    GLenum target) {
+  if (slot == TextLayer::FONT_TEXTURE_SLOT) {
+    std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
+  }
+  glActiveTexture(GL_TEXTURE0 + slot);
+
+  // Texture storage is immutable, so reloading a name needs a new texture
+  auto it = _textures.find(name);
+  if (it != _textures.end()) {
+    glDeleteTextures(1, &it->second.texId);
+  }
+
+  GLuint texId;
+  glGenTextures(1, &texId);
+  _textures[name] = Texture{texId, slot, target};
+  glBindTexture(target, texId);
 }
 
 void Renderer::loadShader(const std::string& name,
     const std::string& vs, const std::string& fs) {
+  AGL_PROFILE_SCOPE("Renderer::loadShader");
+  registerShader(name, vs, fs, {});
+  createShader(name, 0);
+}
 
-  Shader* shader = new Shader();
+void Renderer::loadShader(const std::string& name,
+    const std::string& vs, const std::string& fs,
+    const std::vector<std::string>& features) {
+  assert(features.size() <= 32);
+  registerShader(name, vs, fs, features);
+}
+
+void Renderer::registerShader(const std::string& name,
+    const std::string& vs, const std::string& fs,
+    const std::vector<std::string>& features) {
+  ShaderProgram& program = _shaders[name];
+  for (auto& variant : program.variants) {
+    assert(variant.second != _currentShader);
+    delete variant.second;
+  }
+  program.variants.clear();
+  program.vs = vs;
+  program.fs = fs;
+  program.features = features;
+}
 
-  std::cout << "Compiling: " << vs << std::endl;
-  shader->compileShader(vs);
+std::string Renderer::variantSuffix(unsigned int features) {
+  if (features == 0) return "";
+  std::ostringstream suffix;
+  suffix << "." << std::hex << features;
+  return suffix.str();
+}
+
+std::string Renderer::variantDefines(const ShaderProgram& program,
+    unsigned int features) {
+  std::string defines;
+  for (size_t i = 0; i < program.features.size(); i++) {
+    if (features & (1u << i)) {
+      defines += "#define " + program.features[i] + "\n";
+    }
+  }
+  return defines;
+}
 
-  std::cout << "Compiling: " << fs << std::endl;
-  shader->compileShader(fs);
+Shader* Renderer::createShader(const std::string& name,
+    unsigned int features) {
+  AGL_PROFILE_SCOPE("Renderer::createShader");
+  ShaderProgram& program = _shaders[name];
+  assert(program.features.size() == 32 ||
+      (features >> program.features.size()) == 0);
 
-  shader->link();
-  std::cout << "Loaded shader: " << name << std::endl;
+  std::vector<std::string> sources = {program.vs, program.fs};
+  std::string defines = variantDefines(program, features);
+  std::string cacheFile =
+      ProgramCache::cacheFileName(name + variantSuffix(features), program.vs);
+
+  Shader* shader = new Shader();
+  if (_programCache->load(shader, cacheFile, sources, defines)) {
+    std::cout << "Loaded shader: " << name << variantSuffix(features) <<
+        " (cached)" << std::endl;
+  } else {
+    // Start compiling without waiting; findShader() finishes the link
+    // when the program is first used, so other work (and other compiles)
+    // can overlap with the driver
+    std::cout << "Compiling: " << program.vs << std::endl;
+    shader->compileShaderAsync(program.vs, defines);
+
+    std::cout << "Compiling: " << program.fs << std::endl;
+    shader->compileShaderAsync(program.fs, defines);
+    shader->linkAsync();
+  }
 
-  _shaders[name] = shader;
+  program.variants[features] = shader;
+  return shader;
 }
 
 void Renderer::beginRenderTexture(const std::string& targetName) {
@@ -665,10 +1115,12 @@ void Renderer::beginRenderTexture(const std::string& targetName) {
 
   RenderTexture& tex = _renderTextures[targetName];
   glBindFramebuffer(GL_FRAMEBUFFER, tex.handleId);
+  RenderStats::countFramebuffer();
 
   // Cache viewport size so it can be restored later
   glGetIntegerv(GL_VIEWPORT, tex.winProps);
   glViewport(0, 0, tex.width, tex.height);
+  _viewportHeight = static_cast<float>(tex.height);
   _activeRenderTexture = targetName;
 }
 
@@ -679,17 +1131,19 @@ void Renderer::endRenderTexture() {
   // unbind fbo and revert to default (the screen)
   RenderTexture target = _renderTextures[_activeRenderTexture];
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  RenderStats::countFramebuffer();
   glViewport(target.winProps[0],
              target.winProps[1],
              target.winProps[2],
              target.winProps[3]);
+  _viewportHeight = static_cast<float>(target.winProps[3]);
 
   _activeRenderTexture = "";
 }
 
 void Renderer::loadRenderTexture(const std::string& name,
     int slot, int width, int height) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
+  if (slot == TextLayer::FONT_TEXTURE_SLOT) {
     std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
   }
   // Generate and bind the framebuffer
@@ -748,7 +1202,7 @@ void Renderer::loadRenderTexture(const std::string& name,
 
 void Renderer::loadDepthTexture(const std::string& name,
     int slot, int width, int height) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
+  if (slot == TextLayer::FONT_TEXTURE_SLOT) {
     std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
   }
 
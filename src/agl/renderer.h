@@ -4,13 +4,16 @@
 #define AGL_RENDERER_H_
 
 #include <vector>
-#include <list>
 #include <string>
 #include <map>
+#include <iosfwd>
 #include "agl/agl.h"
 #include "agl/aglm.h"
+#include "agl/fixed_stack.h"
+#include "agl/frame_arena.h"
 #include "agl/image.h"
 #include "agl/mesh.h"
+#include "agl/render_stats.h"
 
 namespace agl {
 
@@ -23,12 +26,17 @@ namespace agl {
  * * *DEFAULT* Ignore alpha and draw all objects as opaque
  * * *ADD* Add colors using formula: cSrc + c * c.alpha
  * * *BLEND* Blend colors using formula: cSrc * alpha + c * (1 - c.alpha)
+ * * *OIT* Accumulate weighted blended order-independent transparency into
+ *   two color targets: target 0 sums weighted colors, target 1 combines
+ *   coverage as 1 - (1 - c1.alpha)(1 - c2.alpha)... Draw order doesn't
+ *   matter. Resolve the targets with Renderer::compositeTransparency().
  * @verbinclude sprites.cpp
  */
 enum BlendMode {
   DEFAULT,
   ADD,
-  BLEND
+  BLEND,
+  OIT
 };
 
 /**
@@ -80,6 +88,64 @@ class Renderer {
    */
   bool initialized() const;
 
+  /**
+   * @brief Start a new frame
+   *
+   * Releases everything allocated from frameArena() during the previous
+   * frame. Window calls this method automatically before draw(). Users
+   * should not call this method.
+   */
+  void beginFrame();
+
+  /**
+   * @brief Get the allocator for memory that only needs to last one frame
+   *
+   * Allocations are released at the start of the next frame. Use it for
+   * per-frame scratch arrays to avoid heap allocations while drawing.
+   * @see FrameArena
+   */
+  FrameArena& frameArena() { return _frameArena; }
+
+  /** @name Statistics
+   */
+  ///@{
+  /**
+   * @brief Get the GL work submitted during the previous frame
+   *
+   * Counts draw calls, triangles, vertices, program switches, texture
+   * binds, uniform uploads, buffer uploads and framebuffer switches made
+   * between two calls to beginFrame().
+   */
+  const RenderStats& stats() const { return _stats; }
+
+  /**
+   * @brief Show or hide the statistics overlay
+   *
+   * The overlay lists stats() in the top-right corner using text(), so it
+   * adds one text draw of its own while it is shown.
+   */
+  void showStats(bool show) { _showStats = show; }
+
+  /**
+   * @brief Return whether the statistics overlay is shown
+   */
+  bool statsShown() const { return _showStats; }
+
+  /**
+   * @brief Queue the statistics overlay for the current frame
+   *
+   * Window calls this method before flushText() when the overlay is shown.
+   */
+  void drawStats();
+
+  /**
+   * @brief Append the statistics of every frame to a CSV file
+   * @param filename The file to create, or "" to stop logging
+   * @return Returns false if the file cannot be created
+   */
+  bool logStats(const std::string& filename);
+  ///@}
+
   /** @name Projections and view
    */
   ///@{
@@ -194,11 +260,46 @@ class Renderer {
    * renderer automatically loads shaders for "phong", "sprites", and
    * "cubemap". Paths are relative to the directory from which you run your
    * application.
+   *
+   * Compiling starts immediately but does not wait for the driver; the
+   * program is finished the first time it is passed to beginShader(), so
+   * several shaders loaded in a row compile in parallel on drivers that
+   * support GL_KHR_parallel_shader_compile. Compile and link errors are
+   * reported at that point.
+   *
+   * Linked programs are cached as driver binaries in <name>.program next
+   * to the vertex shader. Later runs skip compiling unless the sources or
+   * the GL driver change.
    * @see beginShader
    */
   void loadShader(const std::string& name,
       const std::string& vs, const std::string& fs);
 
+  /**
+   * @brief Load a GLSL shader with optional features
+   * @param name A nickname for the shader to be used in beginShader()
+   * @param vs The vertex shader file name
+   * @param fs The fragment shader file name
+   * @param features Names of preprocessor symbols the shader can be
+   *   specialized with. Bit i of a feature mask defines features[i].
+   *
+   * Instead of branching on uniforms per fragment, shaders can test
+   * features with `#ifdef`. Each combination of features used with
+   * beginShader(const std::string&, unsigned int) is compiled into its own
+   * program the first time it is used, or by preloadShader(), and cached
+   * by its feature mask.
+   * The defines are inserted after the `#version` line of both shaders.
+   *
+   * ```
+   * enum { TEXTURED = 1 << 0, TINT_MASK = 1 << 1 };
+   * loadShader("phong", "phong.vs", "phong.fs", {"TEXTURED", "TINT_MASK"});
+   * beginShader("phong", TEXTURED | TINT_MASK);
+   * ```
+   */
+  void loadShader(const std::string& name,
+      const std::string& vs, const std::string& fs,
+      const std::vector<std::string>& features);
+
   /**
    * @brief Set active shader to use for rendering.
    *
@@ -217,6 +318,38 @@ class Renderer {
    */
   void beginShader(const std::string& shaderName);
 
+  /**
+   * @brief Set the active shader to the variant with the given features
+   *
+   * Uniforms are stored per program, so values set for one variant are not
+   * seen by the others.
+   * @param features A bitmask over the feature list passed to loadShader
+   * @see loadShader(const std::string&, const std::string&,
+   *   const std::string&, const std::vector<std::string>&)
+   */
+  void beginShader(const std::string& shaderName, unsigned int features);
+
+  /**
+   * @brief Start compiling a shader variant without waiting for it
+   *
+   * Otherwise a variant is compiled the first time it is passed to
+   * beginShader(), which then waits for the driver in the middle of a
+   * frame. Preloading the variants an app will use in setup() lets them
+   * compile together, in parallel on drivers that support
+   * GL_KHR_parallel_shader_compile.
+   * @see shaderReady
+   */
+  void preloadShader(const std::string& shaderName, unsigned int features);
+
+  /**
+   * @brief Return whether beginShader() can use a variant without waiting
+   *
+   * Starts compiling the variant if needed, then polls the driver. Drivers
+   * without GL_KHR_parallel_shader_compile can't be polled; for them this
+   * returns true once compiling has started, and the first use waits.
+   */
+  bool shaderReady(const std::string& shaderName, unsigned int features);
+
   /**
    * @brief Clear active shader to use for rendering.
    *
@@ -359,6 +492,7 @@ class Renderer {
    * the texture is loaded.
    *
    * @see loadTexture
+   * @see loadTextureArray
    * @verbinclude sprites.cpp
    */
   void texture(const std::string& uniformName, const std::string& textureName);
@@ -382,13 +516,40 @@ class Renderer {
   /**
    * @brief Load a texture from a file
    *
+   * Builds a full mip chain and, when the GL driver supports it, compresses
+   * it to BC1 (opaque) or BC3 (with alpha). The result is cached next to the
+   * image as <filename>.tex so later runs skip decoding the image. The cache
+   * is rebuilt automatically when the image file changes.
+   *
    * @verbinclude sprites.cpp
    */
   void loadTexture(const std::string& name,
       const std::string& filename, int slot);
 
+  /**
+   * @brief Load several image files as the layers of one texture array
+   *
+   * Layers are resampled to the largest width and height in the list, so
+   * each layer still spans the full [0,1] UV range. Files are cached and
+   * compressed the same way as loadTexture(). Bind the array with texture()
+   * and sample it in a shader with a sampler2DArray, passing the layer
+   * index as the third texture coordinate. Meshes with different skins can
+   * then share one texture bind and select their skin with a uniform or
+   * per-instance attribute.
+   *
+   * @code
+   * renderer.loadTextureArray("skins", {"eye.png", "horn.png"}, 0);
+   * renderer.texture("Skins", "skins");
+   * renderer.setUniform("SkinLayer", 1);  // horn
+   * @endcode
+   */
+  void loadTextureArray(const std::string& name,
+      const std::vector<std::string>& filenames, int slot);
+
   /**
    * @brief Load a texture from an Image
+   *
+   * Mipmaps are generated on the GPU; the texture is not compressed.
    */
   void loadTexture(const std::string& name, const Image& img, int slot);
 
@@ -545,6 +706,29 @@ class Renderer {
    */
   void sprite(const glm::vec3& pos, const glm::vec4& color, float size);
 
+  /**
+   * @brief Draws many sprites with a single instanced draw call
+   * @param positions The location of the center of each sprite
+   * @param colors The color of each sprite
+   * @param sizes The size (width/height) of each billboard
+   * @param sortBackToFront Sort sprites from furthest to closest to the
+   * camera before drawing (needed for correct results with BLEND)
+   *
+   * All three arrays should have the same length. Sprite data is uploaded
+   * once per call into an instance buffer, so this is much faster than
+   * calling sprite() in a loop. The "sprite-batch" shader should be active.
+   * ```
+   * renderer.beginShader("sprite-batch");
+   * renderer.texture("image", "particle");
+   * renderer.sprites(positions, colors, sizes, true);
+   * renderer.endShader();
+   * ```
+   * @see sprite(const glm::vec3&, const glm::vec4&, float)
+   */
+  void sprites(const std::vector<glm::vec3>& positions,
+      const std::vector<glm::vec4>& colors,
+      const std::vector<float>& sizes, bool sortBackToFront = false);
+
   /**
    * @brief Draws a sprite using a point billboard
    * @param p1 The location of the first point
@@ -562,9 +746,19 @@ class Renderer {
    * @param x The x-location of the text (left-most point). Range [0, screenwidth]
    * @param y The y-location of the text (bottom-most point). Range [0, screenheight]
    *
+   * Text is queued and drawn on top of the scene by flushText() at the end
+   * of the frame, so all labels in a frame share a single draw call.
    */
   void text(const std::string& text, float x, float y);
 
+  /**
+   * @brief Draw all text queued by text() this frame
+   *
+   * Window calls this method automatically after draw(). Call it manually
+   * to draw queued text into a render texture.
+   */
+  void flushText();
+
   /**
    * @brief Set font color for drawing text
    * @param color A RGBA color with values in range [0,1]
@@ -597,6 +791,10 @@ class Renderer {
   /**
    * @brief Draws a sphere centered at the origin with radius 0.5
    *
+   * Like the other primitives, the sphere is tessellated on first use and
+   * drawn at a level of detail chosen from its size on screen.
+   * @see PrimitiveCache
+   *
    * @verbinclude sphere.cpp
    */
   void sphere();
@@ -619,6 +817,11 @@ class Renderer {
   /**
    * @brief Draws a teapot with largest side with width 1
    *
+   * The teapot's Bezier patches are tessellated on the GPU, finer where
+   * their edges are longer on screen, and drawn with the current shader.
+   * When TessellatePatches is false or the tessellation shaders fail to
+   * compile, a mesh tessellated on the CPU is drawn instead.
+   * @see BezierPatches
    */
   void teapot();
 
@@ -654,6 +857,41 @@ class Renderer {
    */
   void skybox(float size = 10.0);
 
+  /**
+   * @brief Draws a triangle that covers the viewport
+   *
+   * The triangle has no vertex attributes; the current shader computes
+   * positions from gl_VertexID (see fullscreen.vs). Depth testing is
+   * disabled while drawing.
+   */
+  void fullscreen();
+
+  /**
+   * @brief Blend transparency accumulated in OIT mode over the current target
+   * @param accumSlot The texture unit of the OIT accumulation target
+   * @param coverageSlot The texture unit of the OIT coverage target
+   * @param opaqueSlot The texture unit of the opaque scene to composite
+   *   over, replacing the target's contents; if negative, transparency is
+   *   blended over the target instead
+   *
+   * All targets must be the size of the viewport. Use an RGBA16F
+   * accumulation target so that many layers don't saturate.
+   * ```
+   * // transparent pass, writes "accum" (RGBA16F) and "coverage" (RGBA8)
+   * glDepthMask(GL_FALSE);
+   * renderer.blendMode(OIT);
+   * ...  // draw transparent meshes, in any order, with a shader that
+   *      // writes both targets (see the OIT variant of phong-pixel.fs)
+   * renderer.blendMode(DEFAULT);
+   * glDepthMask(GL_TRUE);
+   *
+   * // composite pass, reads both and writes the screen
+   * renderer.compositeTransparency(6, 7);
+   * ```
+   */
+  void compositeTransparency(int accumSlot, int coverageSlot,
+      int opaqueSlot = -1);
+
   /**
    * @brief Draws a custom mesh
    *
@@ -673,6 +911,20 @@ class Renderer {
   void initLines();
   void initMesh();
   void initText();
+  void primitive(int shape);  // a PrimitiveCache::Shape
+  float projectedRadius(float radius) const;
+  void setTransformUniforms(bool hasUV);
+  bool loadTeapotPatches();
+  void bindNewTexture(const std::string& name, int slot, GLenum target);
+  struct ShaderProgram;
+  void registerShader(const std::string& name,
+      const std::string& vs, const std::string& fs,
+      const std::vector<std::string>& features);
+  class Shader* createShader(const std::string& name, unsigned int features);
+  class Shader* findShader(const std::string& name, unsigned int features);
+  static std::string variantSuffix(unsigned int features);
+  static std::string variantDefines(const ShaderProgram& program,
+      unsigned int features);
 
  private:
   bool _initialized;
@@ -682,6 +934,7 @@ class Renderer {
   struct Texture {
     GLuint texId;
     int slot;
+    GLenum target = GL_TEXTURE_2D;
   };
   std::map<std::string, Texture> _textures;
 
@@ -700,45 +953,71 @@ class Renderer {
 
   // shaders
   class Shader* _currentShader;
-  std::map<std::string, class Shader*> _shaders;
-  std::list<Shader*> _shaderStack;
+  struct ShaderProgram {
+    std::string vs, fs;
+    std::vector<std::string> features;  // bit i defines features[i]
+    std::map<unsigned int, class Shader*> variants;  // created on first use
+  };
+  std::map<std::string, ShaderProgram> _shaders;
+  FixedStack<Shader*, 32> _shaderStack;
 
   // matrix stack
-  std::list<glm::mat4> _stack;
+  typedef FixedStack<glm::mat4, 64> MatrixStack;
+  MatrixStack _stack;
   glm::mat4 _trs;
 
+  // scratch memory released every frame
+  FrameArena _frameArena;
+
+  // statistics of the previous frame
+  RenderStats _stats;
+  bool _showStats;
+  std::ofstream* _statsLog;
+  int _statsFrame;
+
   // perspective and view
   glm::mat4 _projectionMatrix;
   glm::mat4 _viewMatrix;
+  float _viewportHeight;  // of the window or render texture, for LOD
   glm::vec3 _lookfrom;
 
   // default meshes
-  class Cube* _cube;
-  class Cylinder* _cone;
-  class Capsule* _capsule;
-  class Cylinder* _cylinder;
-  class Teapot* _teapot;
-  class Torus* _torus;
-  class Plane* _plane;
-  class Sphere* _sphere;
+  class PrimitiveCache* _primitives;
+  class BezierPatches* _teapotPatches;  // created on first use
   class SkyBox* _skybox;
 
   // Quad
   GLuint mBBVboPosId;
   GLuint mBBVaoId;
 
+  // Full viewport triangle (no attributes)
+  GLuint mFullscreenVaoId;
+
+  // Instanced quads
+  struct SpriteInstance {
+    glm::vec3 pos;
+    float size;
+    glm::vec4 color;
+  };
+  GLuint mBBVboInstanceId;
+  GLuint mBBInstanceVaoId;
+  GLsizeiptr mBBInstanceCapacity;       // bytes allocated for instances
+
   // Line
   GLuint mVboLinePosId;
   GLuint mVboLineColorId;
   GLuint mVaoLineId;
 
   // Text
-  int _fontNormal;
-  unsigned int _fontColor;
-  float _fontSize;
+  class TextLayer* _textLayer;
+  class ProgramCache* _programCache;
 
  public:
+  // Slices and stacks of the finest primitive level (set before init())
   static int PrimitiveSubdivision;
+
+  // Tessellate the teapot on the GPU rather than drawing a mesh
+  static bool TessellatePatches;
 };
 
 }  // namespace agl
@@ -0,0 +1,204 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/screen_capture.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "agl/image.h"
+
+namespace agl {
+
+int ScreenCapture::EncoderThreads = 0;
+int ScreenCapture::MaxQueued = 16;
+
+ScreenCapture::ScreenCapture() :
+  _next(0),
+  _oldest(0),
+  _inFlight(0),
+  _encoding(0),
+  _stop(false) {
+  for (Readback& readback : _readbacks) {
+    readback.pbo = 0;
+    readback.fence = 0;
+    readback.size = 0;
+    readback.width = 0;
+    readback.height = 0;
+  }
+}
+
+ScreenCapture::~ScreenCapture() {
+  finish();
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _jobReady.notify_all();
+  for (std::thread& encoder : _encoders) {
+    encoder.join();
+  }
+
+  for (Readback& readback : _readbacks) {
+    if (readback.pbo != 0) glDeleteBuffers(1, &readback.pbo);
+  }
+}
+
+bool ScreenCapture::capture(const std::string& filename) {
+  // Every buffer is in flight, so the oldest must be finished first
+  if (_inFlight == NumBuffers) update();
+  if (_inFlight == NumBuffers) retire(&_readbacks[_oldest], true);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  Readback& readback = _readbacks[_next];
+  size_t size = static_cast<size_t>(viewport[2]) * viewport[3] * 4;
+  if (readback.pbo == 0) glGenBuffers(1, &readback.pbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+  if (readback.size < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+    readback.size = size;
+  }
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3],
+      GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  if (readback.fence == 0) return false;
+  readback.width = viewport[2];
+  readback.height = viewport[3];
+  readback.filename = filename;
+
+  _next = (_next + 1) % NumBuffers;
+  _inFlight++;
+  return true;
+}
+
+bool ScreenCapture::ready() {
+  update();
+  if (_inFlight == NumBuffers) return false;
+
+  // The next retire() would wait for an encoder if the queue is full
+  std::lock_guard<std::mutex> lock(_mutex);
+  return static_cast<int>(_jobs.size()) < MaxQueued;
+}
+
+void ScreenCapture::update() {
+  while (_inFlight > 0) {
+    Readback& readback = _readbacks[_oldest];
+    GLenum status = glClientWaitSync(readback.fence,
+        GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) break;
+    retire(&readback, false);
+  }
+}
+
+void ScreenCapture::retire(Readback* readback, bool wait) {
+  if (wait) {
+    const GLuint64 OneSecond = 1000000000;
+    while (glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+        OneSecond) == GL_TIMEOUT_EXPIRED) {
+    }
+  }
+  glDeleteSync(readback->fence);
+  readback->fence = 0;
+  _oldest = (_oldest + 1) % NumBuffers;
+  _inFlight--;
+
+  Job job;
+  job.width = readback->width;
+  job.height = readback->height;
+  job.filename = readback->filename;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_encoders.empty()) {
+    int numThreads = EncoderThreads;
+    if (numThreads <= 0) {
+      numThreads = std::min(4u,
+          std::max(1u, std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < numThreads; i++) {
+      _encoders.emplace_back(&ScreenCapture::encodeLoop, this);
+    }
+  }
+
+  // Back-pressure: don't let a slow disk grow the queue without bound
+  if (static_cast<int>(_jobs.size()) >= MaxQueued) {
+    _jobDone.wait(lock, [this]() {
+      return static_cast<int>(_jobs.size()) < MaxQueued;
+    });
+  }
+  if (!_freeBuffers.empty()) {
+    job.pixels.swap(_freeBuffers.back());
+    _freeBuffers.pop_back();
+  }
+  lock.unlock();
+
+  size_t size = static_cast<size_t>(job.width) * job.height * 4;
+  job.pixels.resize(size);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->pbo);
+  void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+      GL_MAP_READ_BIT);
+  bool mapped = pixels != 0;
+  if (mapped) {
+    // Flip to top-down rows while copying, so encoders save as is
+    size_t rowSize = static_cast<size_t>(job.width) * 4;
+    const unsigned char* src = static_cast<const unsigned char*>(pixels);
+    for (int row = 0; row < job.height; row++) {
+      memcpy(job.pixels.data() + (job.height - 1 - row) * rowSize,
+          src + row * rowSize, rowSize);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if (!mapped) {
+    std::cout << "ERROR: Cannot read back " << job.filename << std::endl;
+    return;
+  }
+
+  lock.lock();
+  _jobs.push_back(std::move(job));
+  lock.unlock();
+  _jobReady.notify_one();
+}
+
+void ScreenCapture::encodeLoop() {
+  Image image;
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    _jobReady.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+    if (_jobs.empty()) return;  // stopping
+
+    Job job = std::move(_jobs.front());
+    _jobs.pop_front();
+    _encoding++;
+    lock.unlock();
+
+    image.set(job.width, job.height, job.pixels.data());
+    if (!image.save(job.filename, false)) {  // flipped by retire()
+      std::cout << "ERROR: Cannot save " << job.filename << std::endl;
+    }
+
+    lock.lock();
+    _freeBuffers.push_back(std::move(job.pixels));
+    _encoding--;
+    _jobDone.notify_all();
+  }
+}
+
+void ScreenCapture::finish() {
+  while (_inFlight > 0) retire(&_readbacks[_oldest], true);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _jobDone.wait(lock, [this]() { return _jobs.empty() && _encoding == 0; });
+}
+
+bool ScreenCapture::busy() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _inFlight > 0 || !_jobs.empty() || _encoding > 0;
+}
+
+}  // namespace agl
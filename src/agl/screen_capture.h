@@ -0,0 +1,120 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_SCREEN_CAPTURE_H_
+#define AGL_SCREEN_CAPTURE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief Saves screenshots without stalling the render loop
+ *
+ * capture() only queues a glReadPixels into one of a small ring of pixel
+ * buffer objects and inserts a fence. update(), called once per frame,
+ * maps the buffers whose fences have signaled (normally one or two frames
+ * later), copies the pixels out and hands them to encoder threads that
+ * write the PNG files.
+ *
+ * The render thread only blocks when every buffer is still in flight, or
+ * when the encoders fall more than MaxQueued images behind.
+ *
+ * Users do not need to use this class directly.
+ * @see Window::screenshotAsync
+ */
+class ScreenCapture {
+ public:
+  ScreenCapture();
+
+  /**
+   * @brief Save all pending captures and stop the encoder threads
+   *
+   * Needs the GL context that the captures were made with.
+   */
+  ~ScreenCapture();
+
+  /**
+   * @brief Start reading the current viewport of the bound framebuffer
+   * @return Returns false if the readback could not be started
+   */
+  bool capture(const std::string& filename);
+
+  /**
+   * @brief Return whether capture() can start without waiting
+   *
+   * Queues finished readbacks first, like update(). capture() waits when
+   * every buffer is still in flight or the encoders are MaxQueued images
+   * behind.
+   */
+  bool ready();
+
+  /**
+   * @brief Queue finished readbacks for encoding; call once per frame
+   */
+  void update();
+
+  /**
+   * @brief Block until every capture so far has been written
+   */
+  void finish();
+
+  /**
+   * @brief Return whether captures are being read back or encoded
+   */
+  bool busy() const;
+
+  /**
+   * @brief Number of PNG encoder threads (0 = one per core, at most 4)
+   *
+   * Read when the first image is queued.
+   */
+  static int EncoderThreads;
+
+  /**
+   * @brief Images that may wait for an encoder before capture() blocks
+   */
+  static int MaxQueued;
+
+ private:
+  struct Readback {
+    GLuint pbo;
+    GLsync fence;  // 0 when the buffer is free
+    size_t size;   // allocated bytes
+    int width, height;
+    std::string filename;
+  };
+
+  struct Job {
+    int width, height;
+    std::string filename;
+    std::vector<unsigned char> pixels;
+  };
+
+  static const int NumBuffers = 3;
+
+  void retire(Readback* readback, bool wait);
+  void encodeLoop();
+
+  Readback _readbacks[NumBuffers];
+  int _next;    // slot for the next capture
+  int _oldest;  // oldest slot still in flight
+  int _inFlight;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _jobReady;
+  std::condition_variable _jobDone;
+  std::deque<Job> _jobs;
+  std::vector<std::vector<unsigned char>> _freeBuffers;  // recycled pixels
+  std::vector<std::thread> _encoders;
+  int _encoding;  // jobs taken by encoders but not yet written
+  bool _stop;
+};
+
+}  // namespace agl
+#endif  // AGL_SCREEN_CAPTURE_H_
@@ -0,0 +1,292 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/sdf_font.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "fontstash/stb_truetype.h"
+
+namespace agl {
+
+float SdfFont::ReferenceSize = 48.0f;
+int SdfFont::Padding = 6;
+int SdfFont::MaxAtlasSize = 4096;
+
+static const char CacheMagic[8] = {'A', 'G', 'L', 'S', 'D', 'F', '0', '1'};
+
+// FNV-1a hash of the font file, used to detect stale caches
+static unsigned int hashBytes(const std::vector<unsigned char>& data) {
+  uint32_t h = 2166136261u;
+  for (unsigned char c : data) {
+    h ^= c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+SdfFont::SdfFont() :
+  _info(0),
+  _fontHash(0),
+  _scale(1.0f),
+  _atlasWidth(0), _atlasHeight(0),
+  _shelfX(0), _shelfY(0), _shelfHeight(0),
+  _dirtyMinY(0), _dirtyMaxY(0),
+  _resized(false),
+  _cacheDirty(false),
+  _texture(0),
+  _textureWidth(0), _textureHeight(0) {
+}
+
+SdfFont::~SdfFont() {
+  cleanup();
+  delete _info;
+}
+
+bool SdfFont::load(const std::string& fontFile) {
+  std::ifstream file(fontFile, std::ios::binary);
+  if (!file) {
+    std::cout << "Could not open font: " << fontFile << std::endl;
+    return false;
+  }
+  _fontData.assign(std::istreambuf_iterator<char>(file),
+      std::istreambuf_iterator<char>());
+
+  if (!_info) _info = new stbtt_fontinfo;
+  int offset = stbtt_GetFontOffsetForIndex(_fontData.data(), 0);
+  if (!stbtt_InitFont(_info, _fontData.data(), offset)) {
+    std::cout << "Could not parse font: " << fontFile << std::endl;
+    return false;
+  }
+  _scale = stbtt_ScaleForPixelHeight(_info, ReferenceSize);
+  _fontHash = hashBytes(_fontData);
+  _cacheFile = fontFile + ".sdf";
+
+  if (!loadCache()) {
+    _glyphs.clear();
+    _atlasWidth = 512;
+    _atlasHeight = 512;
+    _atlas.assign(_atlasWidth * _atlasHeight, 0);
+    _shelfX = _shelfY = _shelfHeight = 0;
+
+    // Printable ASCII covers nearly every label; other glyphs are added
+    // on first use
+    for (int c = 32; c < 127; c++) {
+      addGlyph(c);
+    }
+    _cacheDirty = true;
+  }
+  _resized = true;
+  return true;
+}
+
+void SdfFont::cleanup() {
+  if (_cacheDirty) {
+    saveCache();
+    _cacheDirty = false;
+  }
+  if (_texture != 0) {
+    glDeleteTextures(1, &_texture);
+    _texture = 0;
+  }
+}
+
+const SdfFont::Glyph* SdfFont::glyph(int codepoint) {
+  auto it = _glyphs.find(codepoint);
+  if (it == _glyphs.end()) {
+    if (std::find(_missing.begin(), _missing.end(), codepoint) !=
+        _missing.end()) {
+      return 0;
+    }
+    if (!addGlyph(codepoint)) {
+      _missing.push_back(codepoint);
+      return 0;
+    }
+    it = _glyphs.find(codepoint);
+  }
+  return &it->second;
+}
+
+float SdfFont::kerning(int first, int second) const {
+  return stbtt_GetCodepointKernAdvance(_info, first, second) * _scale;
+}
+
+void SdfFont::metrics(float* ascender, float* descender, float* lineh) const {
+  int ascent, descent, lineGap;
+  stbtt_GetFontVMetrics(_info, &ascent, &descent, &lineGap);
+  float fh = static_cast<float>(ascent - descent);
+  if (ascender) *ascender = ReferenceSize * ascent / fh;
+  if (descender) *descender = ReferenceSize * descent / fh;
+  if (lineh) *lineh = ReferenceSize * (fh + lineGap) / fh;
+}
+
+bool SdfFont::addGlyph(int codepoint) {
+  if (stbtt_FindGlyphIndex(_info, codepoint) == 0) return false;
+
+  int advance, bearing;
+  stbtt_GetCodepointHMetrics(_info, codepoint, &advance, &bearing);
+
+  int w = 0, h = 0, xoff = 0, yoff = 0;
+  float pixelDistScale = 128.0f / Padding;  // +/- Padding maps to [0, 255]
+  unsigned char* sdf = stbtt_GetCodepointSDF(_info, _scale, codepoint,
+      Padding, 128, pixelDistScale, &w, &h, &xoff, &yoff);
+
+  Glyph g{0, 0, w, h, static_cast<float>(xoff), static_cast<float>(yoff),
+      advance * _scale};
+
+  // Whitespace has no bitmap but still advances the pen
+  if (sdf != 0) {
+    if (!allocate(w, h, &g.x, &g.y)) {
+      stbtt_FreeSDF(sdf, 0);
+      std::cout << "WARNING: SDF font atlas is full\n";
+      return false;
+    }
+    for (int row = 0; row < h; row++) {
+      memcpy(&_atlas[(g.y + row) * _atlasWidth + g.x], &sdf[row * w], w);
+    }
+    stbtt_FreeSDF(sdf, 0);
+
+    _dirtyMinY = std::min(_dirtyMinY, g.y);
+    _dirtyMaxY = std::max(_dirtyMaxY, g.y + h);
+  }
+
+  _glyphs[codepoint] = g;
+  _cacheDirty = true;
+  return true;
+}
+
+bool SdfFont::allocate(int w, int h, int* x, int* y) {
+  // Leave a one pixel gutter so bilinear filtering never bleeds
+  int gw = w + 1;
+  int gh = h + 1;
+  if (gw > _atlasWidth) return false;
+
+  if (_shelfX + gw > _atlasWidth) {
+    _shelfY += _shelfHeight;
+    _shelfX = 0;
+    _shelfHeight = 0;
+  }
+  while (_shelfY + gh > _atlasHeight) {
+    if (_atlasHeight >= MaxAtlasSize) return false;
+    grow();
+  }
+
+  *x = _shelfX;
+  *y = _shelfY;
+  _shelfX += gw;
+  _shelfHeight = std::max(_shelfHeight, gh);
+  return true;
+}
+
+void SdfFont::grow() {
+  // Growing downwards keeps every existing glyph at the same pixel position
+  _atlasHeight *= 2;
+  _atlas.resize(_atlasWidth * _atlasHeight, 0);
+  _resized = true;
+}
+
+void SdfFont::upload() {
+  if (_texture == 0) {
+    glGenTextures(1, &_texture);
+    _resized = true;
+  }
+
+  glBindTexture(GL_TEXTURE_2D, _texture);
+  GLint alignment;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  if (_resized) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, _atlasWidth, _atlasHeight, 0,
+        GL_RED, GL_UNSIGNED_BYTE, _atlas.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    _textureWidth = _atlasWidth;
+    _textureHeight = _atlasHeight;
+    _resized = false;
+
+  } else if (_dirtyMinY < _dirtyMaxY) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, _dirtyMinY,
+        _atlasWidth, _dirtyMaxY - _dirtyMinY, GL_RED, GL_UNSIGNED_BYTE,
+        &_atlas[_dirtyMinY * _atlasWidth]);
+  }
+  _dirtyMinY = _atlasHeight;
+  _dirtyMaxY = 0;
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+// Cache layout: magic, font hash, reference size, padding, atlas size,
+// shelf state, glyph count, glyph records, atlas pixels
+bool SdfFont::saveCache() const {
+  std::ofstream file(_cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  int32_t header[] = {
+    static_cast<int32_t>(_fontHash), Padding,
+    _atlasWidth, _atlasHeight, _shelfX, _shelfY, _shelfHeight,
+    static_cast<int32_t>(_glyphs.size())
+  };
+  file.write(CacheMagic, sizeof(CacheMagic));
+  file.write(reinterpret_cast<const char*>(&ReferenceSize), sizeof(float));
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  for (const auto& it : _glyphs) {
+    int32_t codepoint = it.first;
+    file.write(reinterpret_cast<const char*>(&codepoint), sizeof(codepoint));
+    file.write(reinterpret_cast<const char*>(&it.second), sizeof(Glyph));
+  }
+  file.write(reinterpret_cast<const char*>(_atlas.data()), _atlas.size());
+  return file.good();
+}
+
+bool SdfFont::loadCache() {
+  std::ifstream file(_cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  char magic[sizeof(CacheMagic)];
+  float refSize = 0;
+  int32_t header[8];
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&refSize), sizeof(float));
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!file || memcmp(magic, CacheMagic, sizeof(magic)) != 0 ||
+      header[0] != static_cast<int32_t>(_fontHash) ||
+      refSize != ReferenceSize || header[1] != Padding) {
+    return false;
+  }
+
+  _atlasWidth = header[2];
+  _atlasHeight = header[3];
+  _shelfX = header[4];
+  _shelfY = header[5];
+  _shelfHeight = header[6];
+  int numGlyphs = header[7];
+  if (_atlasWidth <= 0 || _atlasHeight <= 0 ||
+      _atlasHeight > MaxAtlasSize || numGlyphs < 0) {
+    return false;
+  }
+
+  _glyphs.clear();
+  for (int i = 0; i < numGlyphs; i++) {
+    int32_t codepoint;
+    Glyph g;
+    file.read(reinterpret_cast<char*>(&codepoint), sizeof(codepoint));
+    file.read(reinterpret_cast<char*>(&g), sizeof(Glyph));
+    _glyphs[codepoint] = g;
+  }
+  _atlas.resize(_atlasWidth * _atlasHeight);
+  file.read(reinterpret_cast<char*>(_atlas.data()), _atlas.size());
+  if (!file) {
+    _glyphs.clear();
+    return false;
+  }
+  _cacheDirty = false;
+  return true;
+}
+
+}  // namespace agl
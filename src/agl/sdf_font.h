@@ -0,0 +1,125 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_SDF_FONT_H_
+#define AGL_SDF_FONT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+
+struct stbtt_fontinfo;
+
+namespace agl {
+
+/**
+ * @brief A TrueType font stored as signed distance field glyphs
+ *
+ * Each glyph is rasterized once, at ReferenceSize, into a single-channel
+ * distance field and packed into a growable atlas. The text shader
+ * reconstructs sharp edges from the distance field at any size, so drawing
+ * text at a new size never rasterizes glyphs again.
+ *
+ * The atlas is cached on disk next to the font file (e.g.
+ * DroidSerif-Regular.ttf.sdf) and reloaded on the next launch.
+ *
+ * Users do not need to use this class directly.
+ * @see TextLayer
+ */
+class SdfFont {
+ public:
+  /**
+   * @brief Placement of one glyph, in pixels at the reference size
+   */
+  struct Glyph {
+    int x, y, w, h;    // rectangle in the atlas
+    float xoff, yoff;  // top-left corner relative to the pen position
+    float advance;     // horizontal pen advance
+  };
+
+  SdfFont();
+  ~SdfFont();
+
+  /**
+   * @brief Load a .ttf file and its atlas cache (if one exists)
+   * @return Returns false if the font cannot be loaded
+   */
+  bool load(const std::string& fontFile);
+
+  /**
+   * @brief Save the atlas cache (if it changed) and release GPU memory
+   */
+  void cleanup();
+
+  /**
+   * @brief Get a glyph, generating its distance field on first use
+   * @return Returns null if the font doesn't define the codepoint or the
+   * atlas is full
+   */
+  const Glyph* glyph(int codepoint);
+
+  /**
+   * @brief Get the kerning between two codepoints at the reference size
+   */
+  float kerning(int first, int second) const;
+
+  /**
+   * @brief Get vertical metrics at the reference size
+   */
+  void metrics(float* ascender, float* descender, float* lineh) const;
+
+  /**
+   * @brief Push atlas changes to the GPU texture
+   *
+   * Call before drawing with texture().
+   */
+  void upload();
+
+  /** @brief Return the atlas texture (single channel distance field) */
+  GLuint texture() const { return _texture; }
+
+  /** @brief Return the atlas width in pixels */
+  int atlasWidth() const { return _atlasWidth; }
+
+  /** @brief Return the atlas height in pixels */
+  int atlasHeight() const { return _atlasHeight; }
+
+  /**
+   * @brief Write the atlas and glyph table to the cache file
+   */
+  bool saveCache() const;
+
+  static float ReferenceSize;  // pixel height glyphs are generated at
+  static int Padding;          // distance field spread in pixels
+  static int MaxAtlasSize;     // the atlas grows by doubling up to this size
+
+ private:
+  bool loadCache();
+  bool addGlyph(int codepoint);
+  bool allocate(int w, int h, int* x, int* y);
+  void grow();
+
+  stbtt_fontinfo* _info;
+  std::vector<unsigned char> _fontData;
+  unsigned int _fontHash;
+  std::string _cacheFile;
+  float _scale;  // font units to pixels at the reference size
+
+  std::map<int, Glyph> _glyphs;
+  std::vector<int> _missing;  // codepoints without a glyph
+
+  // Shelf packer state
+  std::vector<unsigned char> _atlas;
+  int _atlasWidth, _atlasHeight;
+  int _shelfX, _shelfY, _shelfHeight;
+
+  // Rows [_dirtyMinY, _dirtyMaxY) changed since the last upload
+  int _dirtyMinY, _dirtyMaxY;
+  bool _resized;
+  bool _cacheDirty;
+  GLuint _texture;
+  int _textureWidth, _textureHeight;
+};
+
+}  // namespace agl
+#endif  // AGL_SDF_FONT_H_
@@ -4,6 +4,11 @@
 #include <sys/stat.h>
 #include <fstream>
 #include <sstream>
+#include "agl/render_stats.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 namespace agl {
 
@@ -50,7 +55,9 @@ const char* TypeName(GLSLShader::Type type) {
 }
 }  // namespace GLSLShaderInfo
 
-Shader::Shader() : handle(0), linked(false) {}
+bool Shader::ParallelCompile = false;
+
+Shader::Shader() : handle(0), linked(false), linkPending(false) {}
 
 Shader::~Shader() {
   if (handle == 0) return;
@@ -74,6 +81,24 @@ Shader::~Shader() {
 }
 
 void Shader::compileShader(const std::string& fileName) {
+  compileShader(fileName, shaderType(fileName));
+}
+
+void Shader::compileShaderAsync(const std::string& fileName,
+    const std::string& defines) {
+  GLSLShader::Type type = shaderType(fileName);
+  string source = readSource(fileName, type);
+  if (!defines.empty()) {
+    // #version must stay the first statement
+    size_t pos = source.find("#version");
+    pos = (pos == string::npos) ? 0 : source.find('\n', pos);
+    pos = (pos == string::npos) ? source.size() : pos + 1;
+    source.insert(pos, defines);
+  }
+  compileSourceAsync(source, type);
+}
+
+GLSLShader::Type Shader::shaderType(const std::string& fileName) {
   int extSize = sizeof(GLSLShaderInfo::ShaderFileExtension);
   int numExts = sizeof(GLSLShaderInfo::extensions) / extSize;
 
@@ -95,8 +120,7 @@ void Shader::compileShader(const std::string& fileName) {
     throw GLSLProgramException(msg);
   }
 
-  // Pass the discovered shader type along
-  compileShader(fileName, type);
+  return type;
 }
 
 string Shader::getExtension(const std::string& nameStr) {
@@ -108,19 +132,16 @@ string Shader::getExtension(const std::string& nameStr) {
 }
 
 void Shader::compileShader(const std::string& fileName, GLSLShader::Type type) {
+  compileSource(readSource(fileName, type), type);
+}
+
+string Shader::readSource(const std::string& fileName, GLSLShader::Type type) {
   string typeString = GLSLShaderInfo::TypeName(type);
   if (!fileExists(fileName)) {
     string message = typeString + " shader: " + fileName + " not found.";
     throw GLSLProgramException(message);
   }
 
-  if (handle <= 0) {
-    handle = glCreateProgram();
-    if (handle == 0) {
-      throw GLSLProgramException("Unable to create shader program.");
-    }
-  }
-
   ifstream inFile(fileName, ios::in);
   if (!inFile) {
     string message = string("Unable to open: ") + fileName;
@@ -132,7 +153,7 @@ void Shader::compileShader(const std::string& fileName, GLSLShader::Type type) {
   code << inFile.rdbuf();
   inFile.close();
 
-  compileSource(code.str(), type);
+  return code.str();
 }
 
 void Shader::compileSource(const string &source, GLSLShader::Type type) {
@@ -152,6 +173,13 @@ void Shader::compileSource(const string &source, GLSLShader::Type type) {
   glCompileShader(shaderHandle);
 
   // Check for errors
+  checkCompileStatus(shaderHandle, type);
+
+  // Compile succeeded, attach shader
+  glAttachShader(handle, shaderHandle);
+}
+
+void Shader::checkCompileStatus(GLuint shaderHandle, GLSLShader::Type type) {
   int result;
   glGetShaderiv(shaderHandle, GL_COMPILE_STATUS, &result);
   if (GL_FALSE == result) {
@@ -170,11 +198,82 @@ void Shader::compileSource(const string &source, GLSLShader::Type type) {
     msg = string(GLSLShaderInfo::TypeName(type)) + " shader compilation failed.\n";
     msg += logString;
     throw GLSLProgramException(msg);
+  }
+}
 
-  } else {
-    // Compile succeeded, attach shader
-    glAttachShader(handle, shaderHandle);
+void Shader::compileSourceAsync(const string &source, GLSLShader::Type type) {
+  if (handle <= 0) {
+    handle = glCreateProgram();
+    if (handle == 0) {
+      throw GLSLProgramException("Unable to create shader program.");
+    }
   }
+
+  GLuint shaderHandle = glCreateShader(type);
+  const char *c_code = source.c_str();
+  glShaderSource(shaderHandle, 1, &c_code, NULL);
+
+  // Don't query the result yet so that the driver can compile in the
+  // background; finishLink() checks for errors
+  glCompileShader(shaderHandle);
+  glAttachShader(handle, shaderHandle);
+  pendingShaders.push_back(std::make_pair(shaderHandle, type));
+}
+
+void Shader::linkAsync() {
+  if (linked) return;
+  if (handle <= 0) {
+    throw GLSLProgramException("Program has not been compiled.");
+  }
+
+  glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(handle);
+  linkPending = true;
+}
+
+bool Shader::isReady() {
+  if (linked || !linkPending) return true;
+
+  // Without parallel compile the status can't be polled; finishLink() waits
+  if (!ParallelCompile) return true;
+
+  int done = GL_FALSE;
+  glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+void Shader::finishLink() {
+  if (linked) return;
+  if (!linkPending) {
+    link();
+    return;
+  }
+
+  // A failed link is usually caused by a failed compile, which has the more
+  // useful log
+  int status = 0;
+  glGetProgramiv(handle, GL_LINK_STATUS, &status);
+  if (GL_FALSE == status) {
+    for (const auto& pending : pendingShaders) {
+      checkCompileStatus(pending.first, pending.second);
+    }
+  }
+  pendingShaders.clear();
+  linkPending = false;
+  checkLinkStatus();
+}
+
+bool Shader::enableParallelCompile() {
+#ifdef GL_KHR_parallel_shader_compile
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);  // let the driver decide
+    ParallelCompile = true;
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    ParallelCompile = true;
+  }
+#endif
+  return ParallelCompile;
 }
 
 void Shader::link() {
@@ -183,8 +282,13 @@ void Shader::link() {
     throw GLSLProgramException("Program has not been compiled.");
   }
 
+  // Allow the linked program to be saved to the program cache
+  glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glLinkProgram(handle);
+  checkLinkStatus();
+}
 
+void Shader::checkLinkStatus() {
   int status = 0;
   glGetProgramiv(handle, GL_LINK_STATUS, &status);
   if (GL_FALSE == status) {
@@ -211,6 +315,43 @@ void Shader::link() {
   }
 }
 
+bool Shader::linkBinary(GLenum format, const void* binary, GLsizei length) {
+  if (linked) return true;
+  if (handle <= 0) {
+    handle = glCreateProgram();
+    if (handle == 0) {
+      throw GLSLProgramException("Unable to create shader program.");
+    }
+  }
+
+  // Drivers may reject binaries after an update; callers should fall back
+  // to compiling from source
+  glProgramBinary(handle, format, binary, length);
+
+  int status = 0;
+  glGetProgramiv(handle, GL_LINK_STATUS, &status);
+  if (GL_FALSE == status) {
+    return false;
+  }
+  findUniformLocations();
+  linked = true;
+  return true;
+}
+
+bool Shader::getBinary(GLenum* format, std::vector<char>* binary) {
+  if (!linked) return false;
+
+  GLint length = 0;
+  glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return false;
+
+  binary->resize(length);
+  GLsizei written = 0;
+  glGetProgramBinary(handle, length, &written, format, binary->data());
+  binary->resize(written);
+  return written > 0;
+}
+
 void Shader::findUniformLocations() {
   uniformLocations.clear();
 
@@ -260,6 +401,7 @@ void Shader::use() {
     throw GLSLProgramException("Shader has not been linked");
   }
   glUseProgram(handle);
+  RenderStats::countProgram();
 }
 
 int Shader::getHandle() {
@@ -281,6 +423,7 @@ void Shader::bindFragDataLocation(GLuint location, const char *name) {
 void Shader::setUniform(const char *name, float x, float y, float z) {
   GLint loc = getUniformLocation(name);
   glUniform3f(loc, x, y, z);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, const glm::vec3 &v) {
@@ -290,46 +433,55 @@ void Shader::setUniform(const char *name, const glm::vec3 &v) {
 void Shader::setUniform(const char *name, const glm::vec4 &v) {
   GLint loc = getUniformLocation(name);
   glUniform4f(loc, v.x, v.y, v.z, v.w);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, const glm::vec2 &v) {
   GLint loc = getUniformLocation(name);
   glUniform2f(loc, v.x, v.y);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, const glm::mat4 &m) {
   GLint loc = getUniformLocation(name);
   glUniformMatrix4fv(loc, 1, GL_FALSE, &m[0][0]);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, const std::vector<glm::mat4> &ms) {
   GLint loc = getUniformLocation(name);
   glUniformMatrix4fv(loc, ms.size(), GL_FALSE, &ms[0][0][0]);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, const glm::mat3 &m) {
   GLint loc = getUniformLocation(name);
   glUniformMatrix3fv(loc, 1, GL_FALSE, &m[0][0]);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, float val) {
   GLint loc = getUniformLocation(name);
   glUniform1f(loc, val);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, int val) {
   GLint loc = getUniformLocation(name);
   glUniform1i(loc, val);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, GLuint val) {
   GLint loc = getUniformLocation(name);
   glUniform1ui(loc, val);
+  RenderStats::countUniform();
 }
 
 void Shader::setUniform(const char *name, bool val) {
   int loc = getUniformLocation(name);
   glUniform1i(loc, val);
+  RenderStats::countUniform();
 }
 
 void Shader::printActiveUniforms() {
@@ -567,10 +719,12 @@ int Shader::getUniformLocation(const char *name) {
   auto pos = uniformLocations.find(name);
 
   if (pos == uniformLocations.end()) {
-    uniformLocations[name] = glGetUniformLocation(handle, name);
+    GLint location = glGetUniformLocation(handle, name);
+    uniformLocations.emplace(name, location);
+    return location;
   }
 
-  return uniformLocations[name];
+  return pos->second;
 }
 
 bool Shader::fileExists(const string &fileName) {
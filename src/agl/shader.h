@@ -8,7 +8,10 @@
 #endif
 
 #include <string>
+#include <vector>
+#include <functional>
 #include <map>
+#include <utility>
 #include <stdexcept>
 #include "agl/agl.h"
 #include "agl/aglm.h"
@@ -46,6 +49,20 @@ class Shader {
   void compileSource(const std::string &source, GLSLShader::Type type);
 
   void link();
+
+  // Non-blocking compile and link. Errors are reported by finishLink(),
+  // which waits for the driver if the program is not ready yet.
+  void compileShaderAsync(const std::string& fileName,
+      const std::string& defines = "");
+  void compileSourceAsync(const std::string &source, GLSLShader::Type type);
+  void linkAsync();
+  bool isReady();  // whether finishLink() won't wait for the driver
+  void finishLink();
+  static bool enableParallelCompile();
+  static bool ParallelCompile;
+
+  bool linkBinary(GLenum format, const void* binary, GLsizei length);
+  bool getBinary(GLenum* format, std::vector<char>* binary);
   void validate();
   void use();
   int getHandle();
@@ -77,9 +94,17 @@ class Shader {
  private:
   GLuint handle;
   bool linked;
-  std::map<std::string, int> uniformLocations;
+  // std::less<> allows lookups by const char* without building a string
+  std::map<std::string, int, std::less<>> uniformLocations;
+
+  bool linkPending;
+  std::vector<std::pair<GLuint, GLSLShader::Type>> pendingShaders;
 
   GLint getUniformLocation(const char *name);
+  GLSLShader::Type shaderType(const std::string& fileName);
+  std::string readSource(const std::string& fileName, GLSLShader::Type type);
+  void checkCompileStatus(GLuint shaderHandle, GLSLShader::Type type);
+  void checkLinkStatus();
   bool fileExists(const std::string &fileName);
   std::string getExtension(const std::string& fileName);
 
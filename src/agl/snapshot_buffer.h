@@ -0,0 +1,72 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_SNAPSHOT_BUFFER_H_
+#define AGL_SNAPSHOT_BUFFER_H_
+
+#include <atomic>
+
+namespace agl {
+
+/**
+ * @brief Hands copies of a value from one thread to another without locks
+ *
+ * One thread publishes snapshots and one thread reads the latest. Neither
+ * side ever waits for the other: besides the snapshot the reader is
+ * using and the one the writer is filling, a third slot holds the newest
+ * finished snapshot, and each side swaps its slot with that one using a
+ * single atomic exchange. Snapshots the reader never saw are skipped.
+ *
+ * T must be copy-assignable. Assigning into a slot reuses its storage
+ * (e.g. vector capacity), so steady-state publishing doesn't allocate.
+ * ```
+ * // update(), input thread
+ * _snapshots.publish(_scene);
+ *
+ * // draw(), render thread
+ * const Scene& scene = _snapshots.latest();
+ * ```
+ * @see Window::runThreaded
+ */
+template <typename T>
+class SnapshotBuffer {
+ public:
+  SnapshotBuffer() : _front(0), _middle(1), _back(2) {}
+
+  /**
+   * @brief Copy value into a snapshot and make it the latest (writer only)
+   */
+  void publish(const T& value) {
+    _slots[_back] = value;
+    int previous = _middle.exchange(_back | Fresh, std::memory_order_acq_rel);
+    _back = previous & IndexMask;
+  }
+
+  /**
+   * @brief Return the newest published snapshot (reader only)
+   *
+   * The reference stays valid, and the snapshot unchanged, until the next
+   * call to latest(). Before the first publish() it is a default T.
+   */
+  const T& latest() {
+    if (_middle.load(std::memory_order_acquire) & Fresh) {
+      int previous = _middle.exchange(_front, std::memory_order_acq_rel);
+      _front = previous & IndexMask;
+    }
+    return _slots[_front];
+  }
+
+ private:
+  static const int IndexMask = 3;
+  static const int Fresh = 4;  // set until the reader takes the snapshot
+
+  T _slots[3];
+  int _front;                // read by the reader
+  std::atomic<int> _middle;  // latest snapshot, plus the Fresh bit
+  int _back;                 // written by the writer
+
+  SnapshotBuffer(const SnapshotBuffer&) = delete;
+  SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_SNAPSHOT_BUFFER_H_
@@ -0,0 +1,235 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/text_layer.h"
+#include <cstddef>
+#include "agl/profiler.h"
+#include "agl/render_stats.h"
+
+namespace agl {
+
+const int TextLayer::FONT_TEXTURE_SLOT;
+int TextLayer::CacheLifetime = 120;
+
+enum TextAttribute {
+  TEXT_POSITION = 0,
+  TEXT_UV,
+  TEXT_COLOR
+};
+
+// Decode one UTF-8 codepoint and advance str; invalid bytes become '?'
+static int decodeUtf8(const char** str, const char* end) {
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(*str);
+  int c = s[0];
+  int extra = 0;
+  if (c >= 0xF0) {
+    c &= 0x07; extra = 3;
+  } else if (c >= 0xE0) {
+    c &= 0x0F; extra = 2;
+  } else if (c >= 0xC0) {
+    c &= 0x1F; extra = 1;
+  } else if (c >= 0x80) {
+    *str += 1;
+    return '?';
+  }
+  int i = 1;
+  for (; i <= extra && *str + i < end; i++) {
+    if ((s[i] & 0xC0) != 0x80) break;
+    c = (c << 6) | (s[i] & 0x3F);
+  }
+  *str += i;
+  return (i == extra + 1) ? c : '?';
+}
+
+TextLayer::TextLayer() :
+  _loaded(false),
+  _loadFailed(false),
+  _size(20.0f),
+  _color(0xffffffff),
+  _frame(0),
+  _vao(0),
+  _vbo(0),
+  _vboCapacity(0) {
+}
+
+TextLayer::~TextLayer() {
+  cleanup();
+}
+
+void TextLayer::setFont(const std::string& fontFile) {
+  cleanup();
+  _fontFile = fontFile;
+}
+
+bool TextLayer::load() {
+  if (_loaded || _loadFailed) return _loaded;
+  AGL_PROFILE_SCOPE("TextLayer::load");
+  _loaded = _font.load(_fontFile);
+  if (!_loaded) {
+    printf("Could not add font normal.\n");
+    _loadFailed = true;
+    return false;
+  }
+
+  glGenBuffers(1, &_vbo);
+  glGenVertexArrays(1, &_vao);
+  glBindVertexArray(_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+
+  GLsizei stride = sizeof(Vertex);
+  glEnableVertexAttribArray(TEXT_POSITION);
+  glVertexAttribPointer(TEXT_POSITION, 2, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLvoid*>(offsetof(Vertex, x)));
+
+  glEnableVertexAttribArray(TEXT_UV);
+  glVertexAttribPointer(TEXT_UV, 2, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLvoid*>(offsetof(Vertex, s)));
+
+  glEnableVertexAttribArray(TEXT_COLOR);
+  glVertexAttribPointer(TEXT_COLOR, 4, GL_UNSIGNED_BYTE, GL_FALSE,
+      stride, reinterpret_cast<GLvoid*>(offsetof(Vertex, color)));
+  glBindVertexArray(0);
+  return true;
+}
+
+void TextLayer::cleanup() {
+  _font.cleanup();
+  _loaded = false;
+  _loadFailed = false;
+
+  _cache.clear();
+  _queue.clear();
+
+  if (_vao != 0) {
+    glDeleteVertexArrays(1, &_vao);
+    glDeleteBuffers(1, &_vbo);
+    _vao = 0;
+    _vbo = 0;
+    _vboCapacity = 0;
+  }
+}
+
+unsigned int TextLayer::packColor(const glm::vec4& c) {
+  unsigned int r = (unsigned char) (c[0]*255.9);
+  unsigned int g = (unsigned char) (c[1]*255.9);
+  unsigned int b = (unsigned char) (c[2]*255.9);
+  unsigned int a = (unsigned char) (c[3]*255.9);
+  return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+void TextLayer::layout(const std::string& text, CachedText* cached) {
+  cached->glyphs.clear();
+
+  float pen = 0;
+  int prev = -1;
+  const char* s = text.c_str();
+  const char* end = s + text.size();
+  while (s < end) {
+    int codepoint = decodeUtf8(&s, end);
+    const SdfFont::Glyph* g = _font.glyph(codepoint);
+    if (!g) continue;
+
+    if (prev != -1) pen += _font.kerning(prev, codepoint);
+    prev = codepoint;
+
+    if (g->w > 0 && g->h > 0) {
+      float x0 = pen + g->xoff;
+      float y0 = g->yoff;
+      cached->glyphs.push_back(Glyph{x0, y0, x0 + g->w, y0 + g->h,
+          static_cast<float>(g->x), static_cast<float>(g->y),
+          static_cast<float>(g->x + g->w), static_cast<float>(g->y + g->h)});
+    }
+    pen += g->advance;
+  }
+  cached->width = pen;
+}
+
+TextLayer::TextCache::iterator TextLayer::lookup(const std::string& text) {
+  TextCache::iterator it = _cache.find(text);
+  if (it == _cache.end()) {
+    it = _cache.insert(std::make_pair(text, CachedText())).first;
+    layout(text, &it->second);
+  }
+  it->second.lastFrame = _frame;
+  return it;
+}
+
+void TextLayer::queue(const std::string& text, float x, float y) {
+  if (text.empty() || !load()) return;
+
+  float scale = _size / SdfFont::ReferenceSize;
+  _queue.push_back(QueuedText{lookup(text), x, y, scale, _color});
+}
+
+void TextLayer::flush() {
+  if (!_loaded) return;
+
+  // Upload glyphs generated since the last flush
+  _font.upload();
+
+  float itw = 1.0f / _font.atlasWidth();
+  float ith = 1.0f / _font.atlasHeight();
+
+  _vertices.clear();
+  for (const QueuedText& q : _queue) {
+    for (const Glyph& g : q.entry->second.glyphs) {
+      float x0 = q.x + g.x0 * q.scale, x1 = q.x + g.x1 * q.scale;
+      float y0 = q.y + g.y0 * q.scale, y1 = q.y + g.y1 * q.scale;
+      float s0 = g.s0 * itw, s1 = g.s1 * itw;
+      float t0 = g.t0 * ith, t1 = g.t1 * ith;
+
+      _vertices.push_back(Vertex{x0, y0, s0, t0, q.color});
+      _vertices.push_back(Vertex{x1, y1, s1, t1, q.color});
+      _vertices.push_back(Vertex{x1, y0, s1, t0, q.color});
+
+      _vertices.push_back(Vertex{x0, y0, s0, t0, q.color});
+      _vertices.push_back(Vertex{x0, y1, s0, t1, q.color});
+      _vertices.push_back(Vertex{x1, y1, s1, t1, q.color});
+    }
+  }
+  _queue.clear();
+
+  if (!_vertices.empty()) {
+    GLsizeiptr bytes = _vertices.size() * sizeof(Vertex);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    if (bytes > _vboCapacity) {
+      _vboCapacity = bytes;
+    }
+    glBufferData(GL_ARRAY_BUFFER, _vboCapacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, _vertices.data());
+    RenderStats::countBuffer(bytes);
+
+    // The font uses a single atlas page, so one draw covers every string
+    glActiveTexture(GL_TEXTURE0 + FONT_TEXTURE_SLOT);
+    glBindTexture(GL_TEXTURE_2D, _font.texture());
+    RenderStats::countTexture();
+    glBindVertexArray(_vao);
+    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(_vertices.size()));
+    RenderStats::countDraw(GL_TRIANGLES,
+        static_cast<GLsizei>(_vertices.size()));
+    glBindVertexArray(0);
+  }
+
+  // Forget strings that haven't been drawn recently
+  for (TextCache::iterator it = _cache.begin(); it != _cache.end();) {
+    if (_frame - it->second.lastFrame > CacheLifetime) {
+      it = _cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  _frame++;
+}
+
+float TextLayer::textWidth(const std::string& text) {
+  if (!load()) return 0;
+  return lookup(text)->second.width * _size / SdfFont::ReferenceSize;
+}
+
+float TextLayer::textHeight() {
+  if (!load()) return 0;
+  float lineh = 0;
+  _font.metrics(NULL, NULL, &lineh);
+  return lineh * _size / SdfFont::ReferenceSize;
+}
+
+}  // namespace agl
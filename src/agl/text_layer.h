@@ -0,0 +1,152 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_TEXT_LAYER_H_
+#define AGL_TEXT_LAYER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+#include "agl/aglm.h"
+#include "agl/sdf_font.h"
+
+namespace agl {
+
+/**
+ * @brief Batches and caches the text drawn by Renderer
+ *
+ * Strings passed to Renderer::text() are queued here and drawn together at
+ * the end of the frame: every queued string is written into one vertex
+ * buffer and drawn with a single call per font atlas page. Glyph quads are
+ * cached per string in reference-size units and scaled when drawn, so
+ * labels that don't change between frames skip font layout entirely, at
+ * any size.
+ *
+ * Users do not need to use this class directly.
+ * @see Renderer::text(const std::string&, float, float)
+ */
+class TextLayer {
+ public:
+  TextLayer();
+  ~TextLayer();
+
+  /**
+   * @brief Set the font to use
+   *
+   * The font and its distance field atlas are loaded the first time a
+   * string is queued or measured, so applications that never draw text
+   * don't pay for it.
+   */
+  void setFont(const std::string& fontFile);
+
+  /**
+   * @brief Release the font atlas and all GPU buffers
+   */
+  void cleanup();
+
+  /**
+   * @brief Set the color (packed with packColor()) for queued strings
+   */
+  void setColor(unsigned int color) { _color = color; }
+
+  /**
+   * @brief Set the point size for queued strings and font metrics
+   */
+  void setSize(float size) { _size = size; }
+
+  /**
+   * @brief Queue a string to be drawn by the next call to flush()
+   * @param text The phrase to display
+   * @param x The left-most point of the text in screen coordinates
+   * @param y The baseline of the text in screen coordinates
+   */
+  void queue(const std::string& text, float x, float y);
+
+  /**
+   * @brief Draw and clear all queued strings
+   *
+   * The text shader should be active with its MVP and fontTexture uniforms
+   * set. Glyphs generated since the previous flush are uploaded first.
+   */
+  void flush();
+
+  /**
+   * @brief Return whether any strings are waiting to be drawn
+   */
+  bool empty() const { return _queue.empty(); }
+
+  /**
+   * @brief Get the width of a string at the current size
+   */
+  float textWidth(const std::string& text);
+
+  /**
+   * @brief Get the line height at the current size
+   */
+  float textHeight();
+
+  /**
+   * @brief Convert an RGBA color in range [0,1] to a packed font color
+   */
+  static unsigned int packColor(const glm::vec4& color);
+
+  /**
+   * @brief Texture slot reserved for the font atlas
+   */
+  static const int FONT_TEXTURE_SLOT = 10;
+
+ private:
+  // Glyph quad relative to the string origin at the reference size.
+  // Texture coordinates are stored in atlas pixels so that growing the
+  // atlas doesn't invalidate them
+  struct Glyph {
+    float x0, y0, x1, y1;
+    float s0, t0, s1, t1;
+  };
+
+  struct CachedText {
+    std::vector<Glyph> glyphs;
+    float width;     // pen advance at the reference size
+    int lastFrame;   // last frame this string was drawn
+  };
+  typedef std::map<std::string, CachedText> TextCache;
+
+  struct QueuedText {
+    TextCache::iterator entry;
+    float x, y;
+    float scale;  // font size / reference size
+    unsigned int color;
+  };
+
+  struct Vertex {
+    float x, y;
+    float s, t;
+    unsigned int color;
+  };
+
+  bool load();
+  void layout(const std::string& text, CachedText* cached);
+  TextCache::iterator lookup(const std::string& text);
+
+  SdfFont _font;
+  std::string _fontFile;
+  bool _loaded;
+  bool _loadFailed;  // don't retry every frame
+  float _size;
+  unsigned int _color;
+
+  TextCache _cache;
+  std::vector<QueuedText> _queue;
+  std::vector<Vertex> _vertices;
+  int _frame;
+
+  GLuint _vao;
+  GLuint _vbo;
+  GLsizeiptr _vboCapacity;  // bytes allocated for _vbo
+
+ public:
+  static int CacheLifetime;    // frames an unused string stays cached
+};
+
+}  // namespace agl
+#endif  // AGL_TEXT_LAYER_H_
@@ -0,0 +1,514 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/texture_cache.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "stb/stb_image.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace agl {
+
+int MipTexture::WorkerThreads = 0;
+
+static const char CacheMagic[8] = {'A', 'G', 'L', 'T', 'E', 'X', '0', '1'};
+
+// Bytes per 4x4 block (or per pixel for RGBA8)
+static int blockBytes(MipTexture::Format format) {
+  switch (format) {
+    case MipTexture::BC1: return 8;
+    case MipTexture::BC3: return 16;
+    default: return 4;
+  }
+}
+
+static GLenum internalFormat(MipTexture::Format format) {
+  switch (format) {
+    case MipTexture::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case MipTexture::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: return GL_RGBA8;
+  }
+}
+
+// Box filter one level down, clamping odd edges
+static void downsample(const std::vector<unsigned char>& src, int w, int h,
+    std::vector<unsigned char>* dst, int dw, int dh) {
+  dst->resize(dw * dh * 4);
+  for (int y = 0; y < dh; y++) {
+    int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+    for (int x = 0; x < dw; x++) {
+      int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+      for (int c = 0; c < 4; c++) {
+        int sum = src[(y0 * w + x0) * 4 + c] + src[(y0 * w + x1) * 4 + c] +
+                  src[(y1 * w + x0) * 4 + c] + src[(y1 * w + x1) * 4 + c];
+        (*dst)[(y * dw + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+// Bilinear resample; used to bring texture array layers to one size
+static void resample(const unsigned char* src, int w, int h,
+    std::vector<unsigned char>* dst, int dw, int dh) {
+  dst->resize(dw * dh * 4);
+  float sx = static_cast<float>(w) / dw;
+  float sy = static_cast<float>(h) / dh;
+  for (int y = 0; y < dh; y++) {
+    float fy = std::max(0.0f, (y + 0.5f) * sy - 0.5f);
+    int y0 = std::min(static_cast<int>(fy), h - 1);
+    int y1 = std::min(y0 + 1, h - 1);
+    float ty = fy - y0;
+    for (int x = 0; x < dw; x++) {
+      float fx = std::max(0.0f, (x + 0.5f) * sx - 0.5f);
+      int x0 = std::min(static_cast<int>(fx), w - 1);
+      int x1 = std::min(x0 + 1, w - 1);
+      float tx = fx - x0;
+      for (int c = 0; c < 4; c++) {
+        float top = src[(y0 * w + x0) * 4 + c] * (1 - tx) +
+                    src[(y0 * w + x1) * 4 + c] * tx;
+        float bottom = src[(y1 * w + x0) * 4 + c] * (1 - tx) +
+                       src[(y1 * w + x1) * 4 + c] * tx;
+        (*dst)[(y * dw + x) * 4 + c] =
+            static_cast<unsigned char>(top * (1 - ty) + bottom * ty + 0.5f);
+      }
+    }
+  }
+}
+
+static uint16_t pack565(const float c[3]) {
+  int r = std::max(0, std::min(31, static_cast<int>(c[0] * 31 / 255 + 0.5f)));
+  int g = std::max(0, std::min(63, static_cast<int>(c[1] * 63 / 255 + 0.5f)));
+  int b = std::max(0, std::min(31, static_cast<int>(c[2] * 31 / 255 + 0.5f)));
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(uint16_t v, int c[3]) {
+  int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+  c[0] = (r << 3) | (r >> 2);
+  c[1] = (g << 2) | (g >> 4);
+  c[2] = (b << 3) | (b >> 2);
+}
+
+// Fit the two endpoints along the principal axis of the block's colors
+// and write the 8-byte color block used by both BC1 and BC3
+static void encodeColorBlock(const unsigned char px[16][4], unsigned char* out) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) mean[c] += px[i][c] / 16.0f;
+  }
+
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float r = px[i][0] - mean[0], g = px[i][1] - mean[1], b = px[i][2] - mean[2];
+    cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+    cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+  }
+
+  float axis[3] = {1, 1, 1};
+  for (int iter = 0; iter < 4; iter++) {
+    float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    float len = std::sqrt(x * x + y * y + z * z);
+    if (len < 1e-6f) break;  // flat block; keep the previous axis
+    axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+  }
+
+  float tmin = 0, tmax = 0;
+  for (int i = 0; i < 16; i++) {
+    float t = (px[i][0] - mean[0]) * axis[0] + (px[i][1] - mean[1]) * axis[1] +
+              (px[i][2] - mean[2]) * axis[2];
+    tmin = std::min(tmin, t);
+    tmax = std::max(tmax, t);
+  }
+
+  float hi[3], lo[3];
+  for (int c = 0; c < 3; c++) {
+    hi[c] = mean[c] + tmax * axis[c];
+    lo[c] = mean[c] + tmin * axis[c];
+  }
+  uint16_t c0 = pack565(hi);
+  uint16_t c1 = pack565(lo);
+  if (c0 < c1) std::swap(c0, c1);  // c0 > c1 selects four-color mode
+
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestDist = 1 << 30;
+      for (int p = 0; p < 4; p++) {
+        int dr = px[i][0] - palette[p][0];
+        int dg = px[i][1] - palette[p][1];
+        int db = px[i][2] - palette[p][2];
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < bestDist) {
+          bestDist = dist;
+          best = p;
+        }
+      }
+      indices |= static_cast<uint32_t>(best) << (2 * i);
+    }
+  }
+
+  out[0] = c0 & 0xff; out[1] = c0 >> 8;
+  out[2] = c1 & 0xff; out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// Write the 8-byte interpolated alpha block used by BC3
+static void encodeAlphaBlock(const unsigned char px[16][4], unsigned char* out) {
+  int a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    a0 = std::max(a0, static_cast<int>(px[i][3]));
+    a1 = std::min(a1, static_cast<int>(px[i][3]));
+  }
+
+  uint64_t indices = 0;
+  if (a0 != a1) {
+    // a0 > a1 selects the eight-value palette
+    int palette[8] = {a0, a1};
+    for (int p = 1; p < 7; p++) {
+      palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestDist = 256;
+      for (int p = 0; p < 8; p++) {
+        int dist = std::abs(px[i][3] - palette[p]);
+        if (dist < bestDist) {
+          bestDist = dist;
+          best = p;
+        }
+      }
+      indices |= static_cast<uint64_t>(best) << (3 * i);
+    }
+  }
+
+  out[0] = static_cast<unsigned char>(a0);
+  out[1] = static_cast<unsigned char>(a1);
+  for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+MipTexture::MipTexture() : _format(RGBA8) {
+}
+
+void MipTexture::build(const Image& image, bool compress,
+    int width, int height) {
+  _levels.clear();
+  int w = image.width();
+  int h = image.height();
+  if (w <= 0 || h <= 0) return;
+
+  std::vector<unsigned char> rgba;
+  if ((width > 0 && width != w) || (height > 0 && height != h)) {
+    width = width > 0 ? width : w;
+    height = height > 0 ? height : h;
+    resample(image.data(), w, h, &rgba, width, height);
+    w = width;
+    h = height;
+  } else {
+    rgba.assign(image.data(), image.data() + w * h * 4);
+  }
+  _format = RGBA8;
+  if (compress) {
+    _format = BC1;
+    for (size_t i = 3; i < rgba.size(); i += 4) {
+      if (rgba[i] != 255) {
+        _format = BC3;
+        break;
+      }
+    }
+  }
+
+  std::vector<unsigned char> next;
+  while (true) {
+    Level level{w, h, {}};
+    encode(rgba, &level);
+    _levels.push_back(std::move(level));
+    if (w == 1 && h == 1) break;
+
+    int nw = std::max(1, w / 2);
+    int nh = std::max(1, h / 2);
+    downsample(rgba, w, h, &next, nw, nh);
+    rgba.swap(next);
+    w = nw;
+    h = nh;
+  }
+}
+
+void MipTexture::encode(const std::vector<unsigned char>& rgba,
+    Level* level) const {
+  if (_format == RGBA8) {
+    level->data = rgba;
+    return;
+  }
+
+  int w = level->width;
+  int h = level->height;
+  int bw = (w + 3) / 4;
+  int bh = (h + 3) / 4;
+  int bytes = blockBytes(_format);
+  level->data.resize(bw * bh * bytes);
+
+  Format format = _format;
+  unsigned char* out = level->data.data();
+  auto encodeRows = [&rgba, w, h, bw, bytes, format, out](int row0, int row1) {
+    unsigned char px[16][4];
+    for (int by = row0; by < row1; by++) {
+      for (int bx = 0; bx < bw; bx++) {
+        // Blocks overhanging the edge repeat the last row and column
+        for (int i = 0; i < 16; i++) {
+          int x = std::min(bx * 4 + i % 4, w - 1);
+          int y = std::min(by * 4 + i / 4, h - 1);
+          memcpy(px[i], &rgba[(y * w + x) * 4], 4);
+        }
+        unsigned char* block = out + (by * bw + bx) * bytes;
+        if (format == BC3) {
+          encodeAlphaBlock(px, block);
+          block += 8;
+        }
+        encodeColorBlock(px, block);
+      }
+    }
+  };
+
+  int numThreads = WorkerThreads;
+  if (numThreads <= 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Small levels are not worth a thread each
+  numThreads = std::min(numThreads, std::max(1, bw * bh / 256));
+
+  if (numThreads == 1) {
+    encodeRows(0, bh);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  int rowsPerThread = (bh + numThreads - 1) / numThreads;
+  for (int row = 0; row < bh; row += rowsPerThread) {
+    workers.emplace_back(encodeRows, row, std::min(bh, row + rowsPerThread));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+bool MipTexture::loadFile(const std::string& imageFile, bool compress,
+    int width, int height) {
+  // Asking for the native size is the same as not resampling, so both
+  // share one cache file
+  int nativeWidth = 0, nativeHeight = 0;
+  if ((width > 0 || height > 0) &&
+      imageSize(imageFile, &nativeWidth, &nativeHeight) &&
+      (width <= 0 || width == nativeWidth) &&
+      (height <= 0 || height == nativeHeight)) {
+    width = 0;
+    height = 0;
+  }
+
+  // The stamp records the target size as well as the source file
+  std::string stamp = sourceStamp(imageFile);
+  if (!stamp.empty() && (width > 0 || height > 0)) {
+    stamp += "@" + std::to_string(width) + "x" + std::to_string(height);
+  }
+  std::string cacheFile = cacheFileName(imageFile, width, height);
+
+  if (!stamp.empty() && load(cacheFile, stamp) &&
+      (_format != RGBA8) == compress) {
+    return true;
+  }
+
+  Image img;
+  if (!img.load(imageFile)) {
+    _levels.clear();
+    return false;
+  }
+  build(img, compress, width, height);
+  if (!stamp.empty() && !save(cacheFile, stamp)) {
+    std::cout << "WARNING: cannot write texture cache " << cacheFile << "\n";
+  }
+  return true;
+}
+
+void MipTexture::promoteToBC3() {
+  if (_format != BC1) return;
+
+  // An opaque BC3 alpha block: a0 = a1 = 255, all indices zero
+  static const unsigned char opaque[8] = {255, 255, 0, 0, 0, 0, 0, 0};
+  for (Level& level : _levels) {
+    std::vector<unsigned char> data(level.data.size() * 2);
+    for (size_t i = 0, j = 0; i < level.data.size(); i += 8, j += 16) {
+      memcpy(&data[j], opaque, 8);
+      memcpy(&data[j + 8], &level.data[i], 8);
+    }
+    level.data.swap(data);
+  }
+  _format = BC3;
+}
+
+bool MipTexture::save(const std::string& cacheFile,
+    const std::string& stamp) const {
+  if (_levels.empty()) return false;
+
+  std::ofstream file(cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  int32_t header[] = {
+    static_cast<int32_t>(stamp.size()),
+    static_cast<int32_t>(_format),
+    static_cast<int32_t>(_levels.size())
+  };
+  file.write(CacheMagic, sizeof(CacheMagic));
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  file.write(stamp.data(), stamp.size());
+  for (const Level& level : _levels) {
+    int32_t dims[] = {
+      level.width, level.height, static_cast<int32_t>(level.data.size())
+    };
+    file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+    file.write(reinterpret_cast<const char*>(level.data.data()),
+        level.data.size());
+  }
+  return file.good();
+}
+
+bool MipTexture::load(const std::string& cacheFile, const std::string& stamp) {
+  _levels.clear();
+
+  std::ifstream file(cacheFile, std::ios::binary);
+  if (!file) return false;
+
+  char magic[sizeof(CacheMagic)];
+  int32_t header[3];
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!file || memcmp(magic, CacheMagic, sizeof(magic)) != 0 ||
+      header[0] != static_cast<int32_t>(stamp.size()) ||
+      header[1] < RGBA8 || header[1] > BC3 || header[2] <= 0) {
+    return false;
+  }
+
+  std::string fileStamp(header[0], '\0');
+  file.read(&fileStamp[0], header[0]);
+  if (!file || fileStamp != stamp) return false;
+
+  _format = static_cast<Format>(header[1]);
+  for (int i = 0; i < header[2]; i++) {
+    int32_t dims[3];
+    file.read(reinterpret_cast<char*>(dims), sizeof(dims));
+    if (!file || dims[0] <= 0 || dims[1] <= 0 || dims[2] < 0) {
+      _levels.clear();
+      return false;
+    }
+
+    Level level{dims[0], dims[1], std::vector<unsigned char>(dims[2])};
+    file.read(reinterpret_cast<char*>(level.data.data()), dims[2]);
+    if (!file) {
+      _levels.clear();
+      return false;
+    }
+    _levels.push_back(std::move(level));
+  }
+  return true;
+}
+
+void MipTexture::upload() const {
+  if (_levels.empty()) return;
+
+  glTexStorage2D(GL_TEXTURE_2D, levels(), internalFormat(_format),
+      width(), height());
+  for (int i = 0; i < levels(); i++) {
+    const Level& level = _levels[i];
+    if (_format == RGBA8) {
+      glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height,
+          GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+    } else {
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0,
+          level.width, level.height, internalFormat(_format),
+          static_cast<GLsizei>(level.data.size()), level.data.data());
+    }
+  }
+}
+
+void MipTexture::uploadLayer(int layer) const {
+  for (int i = 0; i < levels(); i++) {
+    const Level& level = _levels[i];
+    if (_format == RGBA8) {
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer,
+          level.width, level.height, 1,
+          GL_RGBA, GL_UNSIGNED_BYTE, level.data.data());
+    } else {
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer,
+          level.width, level.height, 1, internalFormat(_format),
+          static_cast<GLsizei>(level.data.size()), level.data.data());
+    }
+  }
+}
+
+void MipTexture::allocateArray(Format format, int width, int height,
+    int levels, int layers) {
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat(format),
+      width, height, layers);
+}
+
+std::string MipTexture::cacheFileName(const std::string& imageFile,
+    int width, int height) {
+  if (width > 0 || height > 0) {
+    return imageFile + "." + std::to_string(width) + "x" +
+        std::to_string(height) + ".tex";
+  }
+  return imageFile + ".tex";
+}
+
+bool MipTexture::imageSize(const std::string& imageFile,
+    int* width, int* height) {
+  int channels;
+  return stbi_info(imageFile.c_str(), width, height, &channels) != 0;
+}
+
+std::string MipTexture::sourceStamp(const std::string& imageFile) {
+  struct stat info;
+  if (stat(imageFile.c_str(), &info) != 0) return "";
+
+  std::ostringstream stamp;
+  stamp << info.st_size << ":" << static_cast<long long>(info.st_mtime);
+  return stamp.str();
+}
+
+bool MipTexture::compressionSupported() {
+  static int supported = -1;
+  if (supported == -1) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+    std::vector<GLint> formats(count);
+    if (count > 0) {
+      glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+    }
+    bool bc1 = false, bc3 = false;
+    for (GLint format : formats) {
+      if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) bc1 = true;
+      if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) bc3 = true;
+    }
+    supported = (bc1 && bc3) ? 1 : 0;
+  }
+  return supported == 1;
+}
+
+}  // namespace agl
@@ -0,0 +1,145 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_TEXTURE_CACHE_H_
+#define AGL_TEXTURE_CACHE_H_
+
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+#include "agl/image.h"
+
+namespace agl {
+
+/**
+ * @brief A full mip chain, optionally block compressed, ready for upload
+ *
+ * build() filters the mip chain on the CPU and encodes every level to BC1
+ * (opaque images) or BC3 (images with alpha), splitting the blocks across
+ * worker threads. The result can be saved next to the source image so that
+ * later runs upload the compressed levels directly without decoding the
+ * PNG.
+ *
+ * Users do not need to use this class directly.
+ * @see Renderer::loadTexture(const std::string&, const std::string&, int)
+ */
+class MipTexture {
+ public:
+  enum Format {
+    RGBA8 = 0,
+    BC1,
+    BC3
+  };
+
+  MipTexture();
+
+  /**
+   * @brief Build the mip chain for an RGBA image
+   * @param compress Encode levels to BC1/BC3 when true; keep RGBA8 otherwise
+   * @param width Resample the image to this width first (0 = keep)
+   * @param height Resample the image to this height first (0 = keep)
+   */
+  void build(const Image& image, bool compress, int width = 0, int height = 0);
+
+  /**
+   * @brief Load an image file through its cache
+   *
+   * Uses the cache file when it is up to date; otherwise decodes the image,
+   * builds the mip chain and rewrites the cache.
+   * @param width Resample the image to this width (0 = keep)
+   * @param height Resample the image to this height (0 = keep)
+   * @return Returns false if the image cannot be read
+   */
+  bool loadFile(const std::string& imageFile, bool compress,
+      int width = 0, int height = 0);
+
+  /**
+   * @brief Re-encode BC1 levels as BC3 with opaque alpha
+   *
+   * Texture array layers must share one format. This conversion is
+   * lossless because the encoder only writes four-color BC1 blocks.
+   */
+  void promoteToBC3();
+
+  /**
+   * @brief Write the levels to a cache file
+   * @param stamp Identifies the source image; see sourceStamp()
+   */
+  bool save(const std::string& cacheFile, const std::string& stamp) const;
+
+  /**
+   * @brief Read levels from a cache file
+   * @return Returns false if the file is missing, corrupt, or stale
+   */
+  bool load(const std::string& cacheFile, const std::string& stamp);
+
+  /**
+   * @brief Allocate storage for the bound texture and upload every level
+   *
+   * The texture must be bound to GL_TEXTURE_2D and not yet have storage.
+   */
+  void upload() const;
+
+  /**
+   * @brief Upload every level into one layer of the bound texture array
+   *
+   * Storage must already exist; see allocateArray().
+   */
+  void uploadLayer(int layer) const;
+
+  /**
+   * @brief Allocate storage for the bound GL_TEXTURE_2D_ARRAY
+   */
+  static void allocateArray(Format format, int width, int height,
+      int levels, int layers);
+
+  Format format() const { return _format; }
+  int width() const { return _levels.empty() ? 0 : _levels[0].width; }
+  int height() const { return _levels.empty() ? 0 : _levels[0].height; }
+  int levels() const { return static_cast<int>(_levels.size()); }
+
+  /**
+   * @brief Return the cache file used for the given image file
+   *
+   * Images resampled to another size (width or height > 0) are cached
+   * separately from the original.
+   */
+  static std::string cacheFileName(const std::string& imageFile,
+      int width = 0, int height = 0);
+
+  /**
+   * @brief Read the dimensions of an image file without decoding it
+   */
+  static bool imageSize(const std::string& imageFile, int* width, int* height);
+
+  /**
+   * @brief Return a string that changes whenever the file changes
+   *
+   * Combines the file size and modification time. Returns an empty string
+   * if the file does not exist.
+   */
+  static std::string sourceStamp(const std::string& imageFile);
+
+  /**
+   * @brief Return whether the GL driver accepts BC1/BC3 textures
+   */
+  static bool compressionSupported();
+
+  /**
+   * @brief Number of threads used to encode blocks (0 = one per core)
+   */
+  static int WorkerThreads;
+
+ private:
+  struct Level {
+    int width, height;
+    std::vector<unsigned char> data;
+  };
+
+  void encode(const std::vector<unsigned char>& rgba, Level* level) const;
+
+  Format _format;
+  std::vector<Level> _levels;
+};
+
+}  // namespace agl
+#endif  // AGL_TEXTURE_CACHE_H_
@@ -3,7 +3,13 @@
 #include "agl/window.h"
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <thread>
 #include <glm/gtc/matrix_transform.hpp>
+#include "agl/frame_arena.h"
+#include "agl/headless_context.h"
+#include "agl/profiler.h"
+#include "agl/screen_capture.h"
 
 namespace agl {
 
@@ -14,6 +20,10 @@ using glm::mat4;
 
 static Window* theInstance = 0;
 
+bool Window::Headless = false;
+float Window::UpdateRate = 120.0f;
+bool Window::ReportStartup = true;
+
 static void error_callback(int error, const char* description) {
   fputs("\n", stderr);
   fputs(description, stderr);
@@ -26,13 +36,24 @@ Window::Window() :
   _backgroundColor(0.0f),
   _elapsedTime(0.0),
   _lastx(0), _lasty(0),
-  _dt(-1.0) {
+  _dt(-1.0),
+  _inputEvents(0),
+  _lapStart(std::chrono::steady_clock::now()) {
   init();
 }
 
 Window::~Window() {
+  delete _capture;  // writes any pending screenshots
+#ifdef AGL_PROFILE
+  Profiler::finish();
+  if (!Profiler::TraceFile.empty()) Profiler::writeTrace(Profiler::TraceFile);
+#endif
   renderer.cleanup();
-  glfwTerminate();
+  if (_headless) {
+    delete _headless;
+  } else {
+    glfwTerminate();
+  }
 }
 
 void Window::background(const vec3& color) {
@@ -42,7 +63,12 @@ void Window::background(const vec3& color) {
 }
 
 void Window::noLoop() {
-  glfwSetWindowShouldClose(_window, GL_TRUE);
+  if (_headless) {
+    _closed = true;
+  } else {
+    glfwSetWindowShouldClose(_window, GL_TRUE);
+    glfwPostEmptyEvent();  // wake runThreaded()'s input thread
+  }
 }
 
 void Window::setupOrthoScene(const vec3& center, const vec3& dim) {
@@ -108,25 +134,225 @@ void Window::lookAt(const glm::vec3& camPos,
   renderer.lookAt(camPos, camLook, up);
 }
 
+double Window::lapTime() {
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double, std::milli> lap = now - _lapStart;
+  _lapStart = now;
+  return lap.count();
+}
+
+double Window::currentTime() const {
+  if (_window) return glfwGetTime();
+
+  static const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+  return time.count();
+}
+
+bool Window::shouldClose() const {
+  return _window ? glfwWindowShouldClose(_window) : _closed;
+}
+
 void Window::run() {
-  if (!_window) return;  // window wasn't initialized
+  if (!_window && !_headless) return;  // window wasn't initialized
 
-  setup();
+  {
+    AGL_PROFILE_SCOPE("Window::setup");
+    setup();
+  }
+  _startup.setup = lapTime();
 
-  while (!glfwWindowShouldClose(_window)) {
-    float time = glfwGetTime();
-    _dt = time - _elapsedTime;
-    _elapsedTime = time;
+  while (!shouldClose()) {
+    if (!needsRedraw()) {
+      waitForRedraw();
+      continue;
+    }
+    _redrawRequested = false;
+
+    update();  // user function
+    renderFrame();
+    _inputEvents = 0;
+    if (_window) glfwPollEvents();
+  }
+}
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void Window::runThreaded() {
+  if (!_window) {
+    run();
+    return;
+  }
+
+  {
+    AGL_PROFILE_SCOPE("Window::setup");
+    setup();
+  }
+  _startup.setup = lapTime();
 
+  // The context moves to the render thread until it finishes
+  _threaded = true;
+  _stopRendering = false;
+  glfwMakeContextCurrent(0);
+  std::thread renderThread(&Window::renderLoop, this);
+
+  while (!shouldClose()) {
+    bool idle = _redrawOnDemand && !_animating;
+    glfwWaitEventsTimeout(idle ? 0.5 : 1.0 / UpdateRate);
+
+    {
+      AGL_PROFILE_SCOPE("Window::update");
+      update();  // user function
+    }
+    if (_inputEvents > 0) redraw();
+    _inputEvents = 0;
+  }
+
+  _stopRendering = true;
+  redraw();
+  renderThread.join();
+  glfwMakeContextCurrent(_window);
+  _threaded = false;
+}
+
+void Window::renderLoop() {
+  glfwMakeContextCurrent(_window);
+  while (!_stopRendering) {
+    if (_resizePending.exchange(false)) {
+      applyResize(_pendingWidth, _pendingHeight);
+    }
+
+    if (!needsRedraw()) {
+      waitForRedraw();
+      continue;
+    }
+    _redrawRequested = false;
+    renderFrame();
+  }
+  glfwMakeContextCurrent(0);
+}
+
+void Window::renderFrame() {
+  AGL_PROFILE_SCOPE("Window::frame");
+  float time = currentTime();
+  _dt = time - std::max(_elapsedTime, _wakeTime);
+  _elapsedTime = time;
+
+#ifdef AGL_COUNT_ALLOCATIONS
+  size_t allocations = heapAllocationCount();
+  bool capturing = _capture && _capture->busy();
+#endif
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  {
+    AGL_PROFILE_GPU_SCOPE("Window::render");
+    renderer.beginFrame();
     renderer.identity();
-    draw();  // user function
+    {
+      AGL_PROFILE_GPU_SCOPE("Window::draw");
+      draw();  // user function
+    }
+    if (renderer.statsShown()) renderer.drawStats();
+    {
+      AGL_PROFILE_GPU_SCOPE("Renderer::flushText");
+      renderer.flushText();
+    }
     renderer.cleanupShaders();
+  }
 
+#ifdef AGL_COUNT_ALLOCATIONS
+  // Once caches have warmed up, a frame without input should not need the
+  // heap. Input handlers may legitimately allocate, so skip those frames,
+  // and threaded windows, whose input thread allocates concurrently.
+  allocations = heapAllocationCount() - allocations;
+  // Screenshots allocate their file names and PNG buffers
+  capturing = capturing || (_capture && _capture->busy());
+  if (!_threaded && _inputEvents == 0 &&
+      _frameCount > AllocationWarmupFrames && !capturing) {
+    if (allocations != 0) {
+      std::cout << "ERROR: frame " << _frameCount << " made " <<
+          allocations << " heap allocations\n";
+    }
+    assert(allocations == 0);
+  }
+  _frameCount++;
+#endif
+
+  if (_capture) _capture->update();
+  if (_window) {
+    AGL_PROFILE_SCOPE("Window::swapBuffers");
     glfwSwapBuffers(_window);
-    glfwPollEvents();
   }
+#ifdef AGL_PROFILE
+  Profiler::endFrame();
+#endif
+
+  if (_firstFrame) {
+    _firstFrame = false;
+    _startup.firstFrame = lapTime();
+    if (ReportStartup) {
+      char report[160];
+      snprintf(report, sizeof(report), "Startup: context %.1f ms, "
+          "renderer %.1f ms, setup %.1f ms, first frame %.1f ms",
+          _startup.context, _startup.renderer, _startup.setup,
+          _startup.firstFrame);
+      std::cout << report << std::endl;
+    }
+  }
+
+  if (_frameRateLimit > 0) {
+    double remaining = time + 1.0 / _frameRateLimit - currentTime();
+    if (remaining > 0) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+    }
+  }
+}
+
+bool Window::needsRedraw() const {
+  if (!_redrawOnDemand || !_window) return true;
+  if (_threaded) return _animating || _redrawRequested;
+  return _inputEvents > 0 || _animating || _redrawRequested;
+}
+
+void Window::waitForRedraw() {
+  // Pending screenshots still need update() while the window is idle
+  bool capturing = _capture && _capture->busy();
+  double timeout = capturing ? 0.005 : 0.5;
+  if (_threaded) {
+    std::unique_lock<std::mutex> lock(_redrawMutex);
+    _redrawSignal.wait_for(lock, std::chrono::duration<double>(timeout),
+        [this]() { return _redrawRequested || _stopRendering; });
+  } else {
+    glfwWaitEventsTimeout(timeout);
+  }
+  if (_capture) _capture->update();
+  _wakeTime = currentTime();
+}
+
+void Window::setRedrawOnDemand(bool onDemand) {
+  _redrawOnDemand = onDemand;
+  redraw();
+}
+
+void Window::redraw() {
+  {
+    // Taking the lock means an idle render thread is either waiting or
+    // yet to check the flag, so the notification can't be lost
+    std::lock_guard<std::mutex> lock(_redrawMutex);
+    _redrawRequested = true;
+  }
+  _redrawSignal.notify_one();
+  if (_window) glfwPostEmptyEvent();
+}
+
+void Window::setAnimating(bool animating) {
+  _animating = animating;
+}
+
+void Window::setFrameRateLimit(float fps) {
+  _frameRateLimit = fps;
+}
+
+void Window::setSwapInterval(int interval) {
+  if (_window) glfwSwapInterval(interval);
 }
 
 bool Window::screenshot(const std::string& filename) {
@@ -158,6 +384,15 @@ bool Window::screenshot(const std::string& filename) {
   return result;
 }
 
+bool Window::screenshotAsync(const std::string& filename) {
+  if (!_capture) _capture = new ScreenCapture();
+  return _capture->capture(filename);
+}
+
+bool Window::screenshotAsyncReady() {
+  return !_capture || _capture->ready();
+}
+
 float Window::height() const {
   return static_cast<float>(_windowHeight);
 }
@@ -175,17 +410,20 @@ float Window::elapsedTime() const {
 }
 
 glm::vec2 Window::mousePosition() const {
+  if (!_window) return glm::vec2(0);
   double xpos, ypos;
   glfwGetCursorPos(_window, &xpos, &ypos);
   return glm::vec2(static_cast<float>(xpos), static_cast<float>(ypos));
 }
 
 bool Window::keyIsDown(int key) const {
+  if (!_window) return false;
   int state = glfwGetKey(_window, key);
   return (state == GLFW_PRESS);
 }
 
 bool Window::mouseIsDown(int button) const {
+  if (!_window) return false;
   int state = glfwGetMouseButton(_window, button);
   return (state == GLFW_PRESS);
 }
@@ -194,11 +432,21 @@ void Window::setWindowSize(int w, int h) {
   if (_windowWidth == w && _windowHeight == h) return;
   _windowWidth = w;
   _windowHeight = h;
-  glfwSetWindowSize(_window, w, h);  
+  if (_headless) {
+    // There are no window events, so resize the pbuffer ourselves
+    if (_headless->resize(w, h)) onResize(w, h);
+  } else {
+    glfwSetWindowSize(_window, w, h);
+  }
 }
 
 void Window::init() {
+  AGL_PROFILE_SCOPE("Window::init");
   theInstance = this;
+  if (Headless) {
+    initHeadless();
+    return;
+  }
   glfwSetErrorCallback(error_callback);
 
   if (!glfwInit()) {
@@ -223,6 +471,7 @@ void Window::init() {
   glfwMakeContextCurrent(_window);
   glfwSetKeyCallback(_window, Window::onKeyboardCb);
   glfwSetFramebufferSizeCallback(_window, Window::onResizeCb);
+  glfwSetWindowRefreshCallback(_window, Window::onRefreshCb);
   glfwSetMouseButtonCallback(_window, Window::onMouseButtonCb);
   glfwSetCursorPosCallback(_window, Window::onMouseMotionCb);
   glfwSetScrollCallback(_window, Window::onScrollCb);
@@ -237,11 +486,40 @@ void Window::init() {
 
   // Initialize openGL and set default values
   glEnable(GL_MULTISAMPLE);
+  _startup.context = lapTime();
+  renderer.init();
+  background(vec3(0));
+  _startup.renderer = lapTime();
+}
+
+void Window::initHeadless() {
+  _headless = new HeadlessContext();
+  if (!_headless->init(_windowWidth, _windowHeight)) {
+    delete _headless;
+    _headless = 0;
+    return;
+  }
+
+#ifndef APPLE
+  // glewInit() loads the GL entry points (which resolve through libglvnd for
+  // EGL contexts too) before the GLX extensions, which fail without an X
+  // display, so that error is expected here
+  glewExperimental = GL_TRUE;
+  GLenum result = glewInit();
+  if (result != GLEW_OK && result != GLEW_ERROR_NO_GLX_DISPLAY) {
+    std::cout << "Cannot initialize GLEW\n";
+    return;
+  }
+#endif
+
+  _startup.context = lapTime();
   renderer.init();
   background(vec3(0));
+  _startup.renderer = lapTime();
 }
 
 void Window::onMouseMotionCb(GLFWwindow* win, double pX, double pY) {
+  theInstance->_inputEvents++;
   theInstance->onMouseMotion(static_cast<int>(pX), static_cast<int>(pY));
 }
 
@@ -256,6 +534,7 @@ void Window::onMouseMotion(int pX, int pY) {
 
 void Window::onMouseButtonCb(GLFWwindow* win,
     int button, int action, int mods) {
+  theInstance->_inputEvents++;
   theInstance->onMouseButton(button, action, mods);
 }
 
@@ -277,6 +556,7 @@ void Window::onMouseButton(int button, int action, int mods) {
 
 void Window::onKeyboardCb(GLFWwindow* w,
     int key, int scancode, int action, int mods) {
+  theInstance->_inputEvents++;
   theInstance->onKeyboard(key, scancode, action, mods);
 }
 
@@ -294,6 +574,7 @@ void Window::onKeyboard(int key, int scancode, int action, int mods) {
 }
 
 void Window::onScrollCb(GLFWwindow* win, double xoffset, double yoffset) {
+  theInstance->_inputEvents++;
   theInstance->onScroll(
     static_cast<float>(xoffset),
     static_cast<float>(yoffset));
@@ -304,10 +585,28 @@ void Window::onScroll(float xoffset, float yoffset) {
 }
 
 void Window::onResizeCb(GLFWwindow* window, int width, int height) {
+  theInstance->_inputEvents++;
   theInstance->onResize(width, height);
 }
 
+void Window::onRefreshCb(GLFWwindow* window) {
+  // The window was uncovered or needs repainting
+  theInstance->redraw();
+}
+
 void Window::onResize(int width, int height) {
+  if (_threaded) {
+    // Only the render thread may touch GL
+    _pendingWidth = width;
+    _pendingHeight = height;
+    _resizePending = true;
+    redraw();
+    return;
+  }
+  applyResize(width, height);
+}
+
+void Window::applyResize(int width, int height) {
   _windowWidth = width;
   _windowHeight = height;
   glViewport(0, 0, width, height);
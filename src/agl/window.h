@@ -3,6 +3,10 @@
 #ifndef AGL_WINDOW_H_
 #define AGL_WINDOW_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <map>
 #include "agl/agl.h"
@@ -41,6 +45,25 @@ class Window {
    */
   void run();
 
+  /**
+   * @brief Like run(), but draws on a separate render thread
+   *
+   * setup() and the input handlers run on the calling thread, followed by
+   * update() after each batch of events. draw() runs on a render thread
+   * that owns the GL context, so a slow handler never delays a frame.
+   *
+   * The two threads must not share mutable state: update() publishes
+   * what draw() needs through a SnapshotBuffer, and draw() only reads
+   * the latest snapshot. Input handlers and update() must not use
+   * renderer; draw() must not query input (keyIsDown(), mousePosition(),
+   * ...) or call setWindowSize(). resize() is called on the render thread
+   * before the next frame.
+   *
+   * Headless windows have no input, so this method calls run() for them.
+   * @see SnapshotBuffer
+   */
+  void runThreaded();
+
   /**
    * @brief Save the current screen image to a file
    *
@@ -54,6 +77,77 @@ class Window {
    */
   bool screenshot(const std::string& filename);
 
+  /**
+   * @brief Save the current screen image to a file without waiting for it
+   *
+   * @param filename image file name (should be a .png file)
+   * @return (bool) Returns false if the capture could not be started
+   *
+   * Unlike screenshot(), this call returns as soon as the GPU has been
+   * asked for the pixels. They are copied out a frame or two later and
+   * encoded on background threads, so it is cheap enough to call every
+   * frame (e.g. to record a sequence). Pending images are written when the
+   * window is destroyed.
+   */
+  bool screenshotAsync(const std::string& filename);
+
+  /**
+   * @brief Return whether screenshotAsync() can start without waiting
+   *
+   * Use it to capture several images per frame, e.g. when recording
+   * offscreen renders, for as long as the readback buffers and encoders
+   * keep up.
+   */
+  bool screenshotAsyncReady();
+
+  /**
+   * @brief Set to true before constructing a Window to render without a
+   * display
+   *
+   * Headless windows draw into an offscreen EGL surface (see
+   * HeadlessContext), so they work on machines without X or a GPU. They
+   * receive no input events, and run() loops until noLoop() is called.
+   * Requires building with the AGL_HEADLESS option.
+   *
+   * ```
+   * Window::Headless = true;
+   * MyRenderer app;  // draw() calls screenshot() and then noLoop()
+   * app.run();
+   * ```
+   */
+  static bool Headless;
+
+  /**
+   * @brief How often runThreaded() calls update() when there is no input
+   * (per second)
+   */
+  static float UpdateRate;
+
+  /**
+   * @brief Time spent in each phase of startup, in milliseconds
+   *
+   * Renderer subsystems (fonts, primitives, sprite buffers, shaders) are
+   * created the first time they are used, so their cost is part of setup
+   * or of the first frame rather than of the renderer phase.
+   */
+  struct StartupTimes {
+    double context = 0;     // window, GL context and extension loading
+    double renderer = 0;    // Renderer::init()
+    double setup = 0;       // setup()
+    double firstFrame = 0;  // until the first frame has been drawn
+  };
+
+  /**
+   * @brief Return the startup timings (complete after the first frame)
+   */
+  const StartupTimes& startupTimes() const { return _startup; }
+
+  /**
+   * @brief Set to false to not print the startup timings after the first
+   * frame
+   */
+  static bool ReportStartup;
+
  protected:
   /** @name Respond to events
    */
@@ -82,6 +176,16 @@ class Window {
    */
   virtual void draw() {}
 
+  /**
+   * @brief Override this method to update the scene from input
+   *
+   * run() calls it before each draw(). runThreaded() calls it on the input
+   * thread after each batch of events, and at least UpdateRate times per
+   * second while the window is animating or redrawing continuously.
+   * @see runThreaded()
+   */
+  virtual void update() {}
+
   /**
    * @brief Override this method to respond to mouse movement
    * @param x The current x position
@@ -217,6 +321,57 @@ class Window {
    */
   void noLoop();
 
+  /** @name Redrawing and frame rate
+   */
+  ///@{
+  /**
+   * @brief Only redraw when something may have changed
+   *
+   * By default, run() calls draw() as fast as it can. With on-demand
+   * redraws, run() sleeps in glfwWaitEventsTimeout() and only draws a
+   * frame after input (including resizes), a call to redraw(), or while
+   * setAnimating(true) is in effect. Idle applications then use no CPU or
+   * GPU time. Headless windows ignore this setting and always redraw.
+   *
+   * dt() after an idle period counts from when the window woke up, so
+   * animations don't jump.
+   * @see redraw()
+   * @see setAnimating(bool)
+   */
+  void setRedrawOnDemand(bool onDemand);
+
+  /**
+   * @brief Request another frame when redrawing on demand
+   *
+   * Call it when the scene changes for reasons other than input, e.g. when
+   * a file finishes loading. Safe to call from any thread.
+   */
+  void redraw();
+
+  /**
+   * @brief Keep redrawing every frame, e.g. while an animation plays
+   *
+   * Only matters when redrawing on demand. Call setAnimating(false) when
+   * the animation ends to let the window go idle again.
+   */
+  void setAnimating(bool animating);
+
+  /**
+   * @brief Limit how many frames run() draws per second (0 = no limit)
+   *
+   * run() sleeps for the rest of each frame's time slot. Use it instead
+   * of, or as well as, vsync to save power in continuous mode.
+   */
+  void setFrameRateLimit(float fps);
+
+  /**
+   * @brief Set how many vertical blanks to wait for before each swap
+   *
+   * 1 enables vsync and 0 disables it. Has no effect on headless windows.
+   */
+  void setSwapInterval(int interval);
+  ///@}
+
   /** 
    * @brief Set the background color
    * 
@@ -293,11 +448,21 @@ class Window {
 
  private:
   void init();
+  void initHeadless();
+  double currentTime() const;
+  bool shouldClose() const;
+  bool needsRedraw() const;
+  void waitForRedraw();
+  void renderFrame();
+  void renderLoop();
+  void applyResize(int width, int height);
+  double lapTime();
 
   static void onScrollCb(GLFWwindow* w, double xoffset, double yoffset);
   static void onMouseMotionCb(GLFWwindow* w, double x, double y);
   static void onMouseButtonCb(GLFWwindow* w, int button, int action, int mods);
   static void onResizeCb(GLFWwindow* w, int width, int height);
+  static void onRefreshCb(GLFWwindow* w);
   static void onKeyboardCb(GLFWwindow* w,
     int key, int code, int action, int mods);
 
@@ -311,12 +476,39 @@ class Window {
   Renderer renderer;
 
  private:
-  int _windowWidth, _windowHeight;
+  // Written by the render thread in runThreaded(), read by either thread
+  std::atomic<int> _windowWidth, _windowHeight;
   float _elapsedTime;
   float _dt;
   float _lastx, _lasty;
   glm::vec3 _backgroundColor;
   struct GLFWwindow* _window = 0;
+  class HeadlessContext* _headless = 0;  // used instead of _window if Headless
+  bool _closed = false;  // set by noLoop() for headless windows
+  class ScreenCapture* _capture = 0;  // created by the first screenshotAsync
+  int _inputEvents;  // input callbacks received since the last frame
+
+  // runThreaded() state
+  bool _threaded = false;
+  std::atomic<bool> _stopRendering{false};
+  std::atomic<bool> _resizePending{false};  // applied by the render thread
+  std::atomic<int> _pendingWidth{0}, _pendingHeight{0};
+  bool _redrawOnDemand = false;
+  std::atomic<bool> _animating{false};
+  std::atomic<bool> _redrawRequested{true};
+  std::mutex _redrawMutex;  // wakes an idle render thread
+  std::condition_variable _redrawSignal;
+  float _wakeTime = 0;  // when an on-demand window last stopped idling
+  float _frameRateLimit = 0;
+
+  // Startup timings, measured between calls to lapTime()
+  StartupTimes _startup;
+  std::chrono::steady_clock::time_point _lapStart;
+  bool _firstFrame = true;
+#ifdef AGL_COUNT_ALLOCATIONS
+  int _frameCount = 0;
+  static const int AllocationWarmupFrames = 10;
+#endif
 
  protected:
   inline GLFWwindow* window() const { return _window; }
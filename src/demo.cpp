@@ -2,9 +2,16 @@
 //
 
 #include <cmath>
+#include <cstdio>
 #include <string>
 #include <vector>
 #include "agl/window.h"
+#include "agl/append_list.h"
+#include "agl/bvh.h"
+#include "agl/dynamic_resolution.h"
+#include "agl/frame_graph.h"
+#include "agl/light_clusters.h"
+#include "agl/snapshot_buffer.h"
 #include <glm/glm.hpp>
 #include "plymesh.h"
 
@@ -12,12 +19,21 @@ using namespace std;
 using namespace glm;
 using namespace agl;
 
+// How a decoration is shaded. Glass is drawn with order-independent
+// transparency and doesn't cast shadows.
+enum Material
+{
+  OPAQUE,
+  GLASS
+};
+
 struct decorator
 {
   bool isModel;
   string ply;
 
   vec3 pos;
+  vec3 norm;  // surface normal where it was placed
   float rotx;
   float roty;
   float rotz;
@@ -27,8 +43,33 @@ struct decorator
   vec3 max;
 
   vec3 color;
+  int skin;  // layer in the "skins" texture array, or -1 for none
+  Material material = OPAQUE;
+};
+
+// Feature bits for the phong-pixel shader variants
+enum PhongFeatures
+{
+  TEXTURED = 1 << 0,    // sample the skins texture array
+  TINT_MASK = 1 << 1,   // replace mid-tones of the skin with diffuseColor
+  SHADOWED = 1 << 2,    // receive shadows from the ShadowMap depth texture
+  CLUSTERED = 1 << 3,   // add the lights binned by LightClusters
+  ACCUMULATE = 1 << 4,  // write the OIT targets (#define OIT), not a color
+  SKINNED = TEXTURED | TINT_MASK
 };
 
+// Texture unit for the shadow map; unit 0 holds the skins
+const int ShadowSlot = 1;
+const int RecordSlot = 2;
+const int ClusterSlot = 3;  // and the two units after it
+const int AccumSlot = 6;
+const int CoverageSlot = 7;
+const int UpscaleSlot = 8;
+const int OpaqueSlot = 9;
+
+const float GlassOpacity = 0.3f;
+const float PreviewOpacity = 0.5f;
+
 struct sect
 {
   vec3 pos;
@@ -37,6 +78,28 @@ struct sect
   vec3 norm;
 };
 
+// Everything draw() needs. update() publishes a copy after handling input,
+// so drawing never reads state that the input handlers are changing.
+struct SceneState
+{
+  AppendList<decorator> decorators;  // copies share storage, see AppendList
+  AppendList<decorator> cubes;
+  decorator preview;  // the decoration following the mouse
+  bool showPreview = false;
+
+  vec3 eyePos = vec3(0, 0, 5);
+  float azimuth = 0.0f;
+  float elevation = 0.0f;
+  float radius = 5.0f;
+
+  int placements = 0;      // decorations placed so far
+  int glassPlacements = 0;  // placed decorations made of glass
+  int recordRequests = 0;  // times T was pressed
+  bool showStats = false;
+  bool glow = false;  // placed eyes light the scene
+  bool dynamicResolution = false;
+};
+
 class Viewer : public Window {
 public:
 
@@ -45,6 +108,7 @@ public:
 
   void setup() {
     setWindowSize(_width, _height);
+    setRedrawOnDemand(true);
 
   
     _eyeMesh.load("../models/eye.ply");
@@ -60,12 +124,72 @@ public:
     _meshes.push_back("cube");
 
     
-    renderer.loadTexture("eye", "../textures/eye.png", 0);
-    renderer.loadTexture("horn", "../textures/horn.png", 0);
-    renderer.loadTexture("mouth", "../textures/mouth.png", 0);
-    renderer.loadTexture("duck", "../textures/duck_texture.png", 0);
+    // Layer order must match skinLayer()
+    renderer.loadTextureArray("skins", {
+        "../textures/eye.png",
+        "../textures/horn.png",
+        "../textures/mouth.png",
+        "../textures/duck_texture.png"}, 0);
+
+    renderer.loadShader("phong-pixel", "../shaders/phong-pixel.vs",
+        "../shaders/phong-pixel.fs",
+        {"TEXTURED", "TINT_MASK", "SHADOWED", "CLUSTERED", "OIT"});
+
+    // Compile the variants drawn every frame together, before the first
+    // frame. The glow variants compile once glow is turned on.
+    const unsigned int variants[] = {0, SKINNED, ACCUMULATE,
+        SKINNED | ACCUMULATE};
+    for (unsigned int features : variants)
+    {
+      renderer.preloadShader("phong-pixel", features | SHADOWED);
+    }
+    renderer.preloadShader("unlit", 0);
+
+    // Placed decorations only move when one is added, so their depth is
+    // cached in staticShadow and rebuilt only then. Each frame copies it
+    // and adds the preview on top.
+    _graph.exportTexture("staticShadow");
+    _staticShadowPass = &_graph.addPass("static-shadow", [this]() {
+          drawShadowCasters(false);
+        })
+        .write("staticShadow", FrameGraph::DEPTH24, ShadowSize, ShadowSize);
+    _graph.addPass("shadow", [this]() { drawShadowCasters(true); })
+        .write("shadowMap", FrameGraph::DEPTH24, ShadowSize, ShadowSize)
+        .copy("staticShadow", "shadowMap");
+    _scenePass = &_graph.addPass("scene", [this]() { drawScene(); })
+        .read("shadowMap", ShadowSlot, true)
+        .writeScreen();
+
+    // Glass and the preview are accumulated in any order (weighted blended
+    // OIT) against the depth of the opaque scene, then composited over it.
+    // With them, the scene is drawn into graph targets instead of the
+    // screen so its depth can be reused. Without them, these passes are
+    // disabled and the scene pass above runs instead.
+    _opaquePass = &_graph.addPass("opaque", [this]() { drawScene(); })
+        .read("shadowMap", ShadowSlot, true)
+        .write("sceneColor", FrameGraph::RGBA8)
+        .write("sceneDepth", FrameGraph::DEPTH24);
+    _graph.addPass("transparent", [this]() { drawTransparent(); })
+        .read("shadowMap", ShadowSlot, true)
+        .write("accum", FrameGraph::RGBA16F)
+        .write("coverage", FrameGraph::RGBA8)
+        .write("sceneDepth", FrameGraph::DEPTH24);
+    _compositePass = &_graph.addPass("composite", [this]() {
+          renderer.compositeTransparency(AccumSlot, CoverageSlot, OpaqueSlot);
+        })
+        .read("accum", AccumSlot)
+        .read("coverage", CoverageSlot)
+        .read("sceneColor", OpaqueSlot)
+        .writeScreen();
+  }
 
-    renderer.loadShader("phong-pixel", "../shaders/phong-pixel.vs", "../shaders/phong-pixel.fs");
+  int skinLayer(const string& ply) const
+  {
+    if (ply == "eye") return 0;
+    if (ply == "horn") return 1;
+    if (ply == "mouth") return 2;
+    if (ply == "duck") return 3;
+    return -1;
   }
 
   vec3 screenToWorld(const vec2& screen)
@@ -80,8 +204,11 @@ public:
     screenpos.y = 2.0f*((screenpos.y / _height) - 0.5);
 
     // Convert the particle position to world coords
-    mat4 projection = renderer.projectionMatrix();
-    mat4 view = renderer.viewMatrix();
+    // Same camera as beginLitShader(); the renderer's matrices belong to
+    // the render thread
+    mat4 projection = glm::perspective(glm::radians(FieldOfView),
+        static_cast<float>(_width) / _height, NearPlane, FarPlane);
+    mat4 view = glm::lookAt(_eyePos, lookPos, up);
     vec4 worldpos = inverse(projection * view) * screenpos;
 
     // convert from homogenous to ordinary coordinates
@@ -292,24 +419,13 @@ public:
     vec3 worldPos = screenToWorld(mousePos);
     vec3 rayDir = normalize(worldPos - _eyePos);
     sect p = cubeIntersection(_eyePos, rayDir, _min2, _max2);
-    sect q;
-    decorator c;
-    sect mint;
-    mint.t = INFINITY;
-    for (int i = 0; i < _cubes.size(); i++)
-    {
-        c = _cubes[i];
-        q = cubeIntersection(_eyePos, rayDir, c.min, c.max);
-
-        if ((q.t < mint.t) && q.hit)
-        {
-          mint = q;
-        }
-    }
-    
-    if (((mint.t < p.t) && mint.hit) || !p.hit)
+    Bvh::Hit hit;
+    if (_cubeBvh.closestHit(_eyePos, rayDir, &hit) && (!p.hit || hit.t < p.t))
     {
-      p = mint;
+      p.hit = true;
+      p.t = hit.t;
+      p.pos = _eyePos + hit.t * rayDir;
+      p.norm = hit.normal;
     }
 
     _show3 = p.hit;
@@ -370,6 +486,7 @@ public:
     decorator thing;
 
     thing.pos = _pos3;
+    thing.norm = _norm3;
     thing.rotx = _rotx3;
     thing.rotz = _rotz3;
     thing.roty = _roty3;
@@ -377,6 +494,8 @@ public:
     thing.scale = _scale3;
     thing.color = _color3;
     thing.ply = _mesh3;
+    thing.skin = skinLayer(_mesh3);
+    thing.material = _material3;
     thing.max = vec3(
         thing.pos.x + (thing.scale.x / 2.0f),
         thing.pos.y + (thing.scale.y / 2.0f),
@@ -393,12 +512,14 @@ public:
       if(!_isModel3)
       {
         _cubes.push_back(thing);
+        _cubeBvh.insert(Bvh::Box{thing.min, thing.max});
       }
       else
       {
         _decorators.push_back(thing);
       }
-
+      _placements++;
+      if (thing.material == GLASS) _glassPlacements++;
     }
   }
 
@@ -421,11 +542,7 @@ public:
 
     // _eyePos updated using new radius or angles
     
-    _eyePos = vec3(
-      _radius * sin(azimuth) * cos(elevation), 
-      _radius * sin(elevation), 
-      _radius * cos(azimuth) * cos(elevation)
-    );
+    _eyePos = orbitPosition(azimuth, elevation, _radius);
 
   }
 
@@ -470,6 +587,26 @@ public:
     {
       kDown = true;
     }
+    if (key == 't' || key == 'T')
+    {
+      _recordRequests++;
+    }
+    if (key == GLFW_KEY_F3)
+    {
+      _showStats = !_showStats;
+    }
+    if (key == 'l' || key == 'L')
+    {
+      _glow = !_glow;
+    }
+    if (key == 'm' || key == 'M')
+    {
+      _material3 = _material3 == GLASS ? OPAQUE : GLASS;
+    }
+    if (key == 'v' || key == 'V')
+    {
+      _dynamicResolution = !_dynamicResolution;
+    }
     if (key == 'e' || key == 'E')
     {
       if (_curOption == _meshes.size() - 1)
@@ -597,37 +734,23 @@ public:
     }
   }
 
-  void drawDecorators()
+  float opacity(Material material) const
+  {
+    return material == GLASS ? GlassOpacity : 1.0f;
+  }
+
+  // Draw either the skinned or the plain decorators of one material; the
+  // sets use different shader variants
+  void drawDecorators(bool skinned, Material material)
   {
-    for (int i = 0; i < _decorators.size(); i++)
+    const AppendList<decorator>& decorators = _scene->decorators;
+    for (int i = 0; i < decorators.size(); i++)
     {
-      decorator dec = _decorators[i];
-      if (dec.ply == "eye")
-      {
-        renderer.setUniform("text", true);
-        renderer.texture("Image", "eye");
-      }
-      else if (dec.ply == "horn")
-      {
-        renderer.setUniform("text", true);
-        renderer.texture("Image", "horn");
-      }
-      else if (dec.ply == "duck")
-      {
-        renderer.setUniform("text", true);
-        renderer.texture("Image", "duck");
-      }
-      else if (dec.ply == "mouth")
-      {
-        renderer.setUniform("text", true);
-        renderer.texture("Image", "mouth");
-      }
-      else
-      {
-        renderer.setUniform("text", false);
-      }
+      const decorator& dec = decorators[i];
+      if ((dec.skin >= 0) != skinned || dec.material != material) continue;
+      if (skinned) renderer.setUniform("SkinLayer", dec.skin);
       renderer.push();
-      renderer.setUniform("diffuseColor", vec4(dec.color, 1.0));
+      renderer.setUniform("diffuseColor", vec4(dec.color, opacity(material)));
       renderer.identity();
 
       renderer.translate(dec.pos);
@@ -661,13 +784,14 @@ public:
 
   }
 
-  void drawCubes()
+  void drawCubes(Material material)
   {
-    for (int i = 0; i < _cubes.size(); i++)
+    const AppendList<decorator>& cubes = _scene->cubes;
+    for (int i = 0; i < cubes.size(); i++)
     {
-      decorator c = _cubes[i];
-      renderer.setUniform("text", false);
-      renderer.setUniform("diffuseColor", vec4(c.color, 1));
+      const decorator& c = cubes[i];
+      if (c.material != material) continue;
+      renderer.setUniform("diffuseColor", vec4(c.color, opacity(material)));
       renderer.push();
       renderer.identity();
       renderer.translate(c.pos);
@@ -677,7 +801,7 @@ public:
     }
   }
 
-  void draw() 
+  void update()
   {
     _mesh3 = _meshes[_curOption];
     if (_mesh3 == "cube")
@@ -688,87 +812,339 @@ public:
     _isModel3 = true;
 
     srotcol();
-    renderer.beginShader("phong-pixel");
-    renderer.setUniform("text", false);
 
-    // renderer.setUniform() to set values in shader
+    // The window only redraws on input unless a key is held
+    setAnimating(wDown || sDown || aDown || dDown ||
+        rDown || gDown || bDown || iDown || kDown);
+
+    _state.decorators = _decorators;
+    _state.cubes = _cubes;
+    _state.preview.pos = _pos3;
+    _state.preview.rotx = _rotx3;
+    _state.preview.roty = _roty3;
+    _state.preview.rotz = _rotz3;
+    _state.preview.scale = _scale3;
+    _state.preview.color = _color3;
+    _state.preview.ply = _mesh3;
+    _state.preview.skin = skinLayer(_mesh3);
+    _state.preview.material = _material3;
+    _state.showPreview = _show3;
+    _state.eyePos = _eyePos;
+    _state.azimuth = azimuth;
+    _state.elevation = elevation;
+    _state.radius = _radius;
+    _state.placements = _placements;
+    _state.glassPlacements = _glassPlacements;
+    _state.recordRequests = _recordRequests;
+    _state.showStats = _showStats;
+    _state.glow = _glow;
+    _state.dynamicResolution = _dynamicResolution;
+    _snapshots.publish(_state);
+  }
+
+  void draw() 
+  {
+    _scene = &_snapshots.latest();
+    renderer.showStats(_scene->showStats);
+
+    // Placed decorations only change when one is added
+    _staticShadowPass->setEnabled(_scene->placements != _shadowPlacements);
+    _shadowPlacements = _scene->placements;
+
+    if (_scene->recordRequests != _recordRequestsSeen && _recordFrame < 0)
+    {
+      startRecording();
+    }
+    _recordRequestsSeen = _scene->recordRequests;
+    if (_recordFrame >= 0)
+    {
+      recordSteps();
+      return;
+    }
+
+    _cameraPos = _scene->eyePos;
+    _cameraAspect = width() / height();
+
+    // Text is drawn after end(), at the window's resolution
+    _resolution.setEnabled(_scene->dynamicResolution);
+    _resolution.begin();
+    renderView();
+    _resolution.end(renderer, UpscaleSlot);
+    if (_resolution.enabled() && _scene->showStats)
+    {
+      // Short enough for std::string's small buffer, like the stats
+      char line[16];
+      snprintf(line, sizeof(line), "scale %d%%",
+          static_cast<int>(_resolution.scale() * 100 + 0.5f));
+      renderer.text(line, 10, 25);
+      snprintf(line, sizeof(line), "gpu %.1f ms", _resolution.gpuTime());
+      renderer.text(line, 10, 25 + 1.25f * renderer.textHeight());
+    }
+  }
+
+  // Run the frame graph for the current camera
+  void renderView()
+  {
+    bool transparent = showPreview() || _scene->glassPlacements > 0;
+    _scenePass->setEnabled(!transparent);
+    _opaquePass->setEnabled(transparent);
+    _compositePass->setEnabled(transparent);
+    if (_scene->glow) updateLights();
+    _graph.execute();
+  }
+
+  // Orbit camera position for the given angles, as set by scroll()
+  vec3 orbitPosition(float azim, float elev, float radius) const
+  {
+    return vec3(
+      radius * sin(azim) * cos(elev),
+      radius * sin(elev),
+      radius * cos(azim) * cos(elev)
+    );
+  }
 
-    float aspect = ((float)width()) / height();
-    renderer.perspective(glm::radians(60.0f), 1, 0.5f, 10);
-    renderer.lookAt(_eyePos, lookPos, up);
+  void startRecording()
+  {
+    if (!_recordTextureLoaded)
+    {
+      renderer.loadRenderTexture("turntable", RecordSlot,
+          RecordWidth, RecordHeight);
+      _recordTextureLoaded = true;
+    }
+    _recordFrame = 0;
+    _recordStart = elapsedTime();
+  }
 
+  // Render as many steps as the capture buffers and encoders can take
+  // without waiting, so recording isn't held to the display's refresh
+  // rate or the frame rate limit
+  void recordSteps()
+  {
+    int steps = 0;
+    do
+    {
+      recordFrame();
+      steps++;
+    } while (_recordFrame > 0 && steps < MaxRecordSteps &&
+        screenshotAsyncReady());
+
+    // The window only shows progress so that all GPU time goes to the
+    // recording
+    int recorded = _recordFrame < 0 ? RecordFrames : _recordFrame;
+    renderer.text("Recording " + std::to_string(recorded) + "/" +
+        std::to_string(RecordFrames), 10, 25);
+    redraw();  // the next steps, or the scene once the orbit is done
+  }
+
+  // Render the next step of one full orbit into the turntable texture and
+  // queue it for saving. Steps are fixed, so the result doesn't depend on
+  // how fast frames are rendered or encoded.
+  void recordFrame()
+  {
+    float angle = _scene->azimuth +
+        2 * glm::pi<float>() * _recordFrame / RecordFrames;
+    _cameraPos = orbitPosition(angle, _scene->elevation, _scene->radius);
+    _cameraAspect = static_cast<float>(RecordWidth) / RecordHeight;
+
+    renderer.beginRenderTexture("turntable");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderView();
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), RecordPattern, _recordFrame);
+    screenshotAsync(filename);
+
+    renderer.endRenderTexture();
+
+    _recordFrame++;
+    if (_recordFrame == RecordFrames)
+    {
+      float seconds = elapsedTime() - _recordStart;
+      cout << "Recorded " << RecordFrames << " frames in " << seconds <<
+          " s (" << RecordFrames / seconds << " frames/s)" << endl;
+      _recordFrame = -1;
+    }
+  }
+
+  // Render depth from the light. The static pass draws everything that has
+  // been placed; the dynamic pass draws only the preview.
+  void drawShadowCasters(bool dynamic)
+  {
+    vec3 lightPos = -normalize(_lightDirection) * ShadowDistance;
+    renderer.beginShader("unlit");
+    renderer.ortho(-ShadowExtent, ShadowExtent, -ShadowExtent, ShadowExtent,
+        0.1f, 2 * ShadowDistance);
+    renderer.lookAt(lightPos, vec3(0), up);
+
+    // Push depths back slightly so lit surfaces don't shadow themselves
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    if (dynamic)
+    {
+      if (showPreview() && _scene->preview.material == OPAQUE) drawPreview();
+    }
+    else
+    {
+      drawOpaque();
+    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    renderer.endShader();
+  }
+
+  // Map world positions to the shadow map's [0,1] texture and depth range
+  mat4 shadowMatrix() const
+  {
+    vec3 lightPos = -normalize(_lightDirection) * ShadowDistance;
+    mat4 bias = glm::translate(mat4(1), vec3(0.5f)) *
+        glm::scale(mat4(1), vec3(0.5f));
+    mat4 projection = glm::ortho(-ShadowExtent, ShadowExtent,
+        -ShadowExtent, ShadowExtent, 0.1f, 2 * ShadowDistance);
+    return bias * projection * glm::lookAt(lightPos, vec3(0), up);
+  }
+
+  void beginLitShader(unsigned int features)
+  {
+    // Until the glow variant has compiled, draw without the glow rather
+    // than wait for the driver
+    features |= SHADOWED;
+    if (_scene->glow &&
+        renderer.shaderReady("phong-pixel", features | CLUSTERED))
+    {
+      features |= CLUSTERED;
+    }
+    renderer.beginShader("phong-pixel", features);
+    renderer.perspective(glm::radians(FieldOfView), _cameraAspect,
+        NearPlane, FarPlane);
+    renderer.lookAt(_cameraPos, lookPos, up);
+
+    // The light is fixed in the world so that shadows stay put
+    mat3 view = mat3(renderer.viewMatrix());
+    renderer.setUniform("lightDirection", view * _lightDirection);
+    renderer.setUniform("ShadowMatrix", shadowMatrix());
+    renderer.setUniform("ShadowMap", ShadowSlot);
+    if (features & CLUSTERED) _clusters.bind(renderer, ClusterSlot);
+  }
+
+  // Each placed eye is a point light in its own color (white if black),
+  // lifted off the surface it sits on
+  void updateLights()
+  {
+    _lights.clear();
+    const AppendList<decorator>& decorators = _scene->decorators;
+    for (int i = 0; i < decorators.size(); i++)
+    {
+      const decorator& dec = decorators[i];
+      if (dec.ply != "eye") continue;
+      LightClusters::Light light;
+      light.position = dec.pos + dec.norm * dec.scale.x * 2.0f;
+      light.radius = dec.scale.x * 10.0f;
+      light.color = dec.color == vec3(0) ? vec3(1) : dec.color;
+      light.intensity = 0.5f;
+      _lights.push_back(light);
+    }
+    _clusters.update(_lights, glm::lookAt(_cameraPos, lookPos, up),
+        glm::radians(FieldOfView), _cameraAspect, NearPlane, FarPlane);
+  }
+
+  void drawScene()
+  {
+    beginLitShader(0);
     renderer.setUniform("diffuseColor", vec4(1,1,1,1));
     renderer.identity();
-    renderer.setUniform("text", false);
     renderer.translate(_pos2);
     renderer.cube();
 
+    drawCubes(OPAQUE);
+    drawDecorators(false, OPAQUE);
+    renderer.endShader();
 
+    // Skinned meshes share one variant and one texture array bind
+    beginLitShader(SKINNED);
+    renderer.texture("Skins", "skins");
+    drawDecorators(true, OPAQUE);
+    renderer.endShader();
+  }
 
-    // The preview mesh
-    renderer.setUniform("diffuseColor", vec4(_color3, 0.5));
+  // The central cube and every opaque decoration, with the current shader
+  void drawOpaque()
+  {
     renderer.identity();
-    renderer.translate(_pos3);
-    renderer.rotate(_rotx3, vec3(0.0, 0.0, 1.0));
-    renderer.rotate(_rotz3, vec3(1.0, 0.0, 0.0));
-    renderer.rotate(_roty3, vec3(0.0, 1.0, 0.0));
-    renderer.scale(_scale3);
-    if (_show3)
-    {
-      renderer.setUniform("text", true);
-      if (_mesh3 == "eye")
-      {
-        renderer.texture("Image", "eye");
-      }
-      else if (_mesh3 == "horn")
-      {
-        renderer.texture("Image", "horn");
-      }
-      else if(_mesh3 == "duck")
-      {
-        renderer.texture("Image", "duck");
-      }
-      else if (_mesh3 == "mouth")
-      {
-        renderer.texture("Image", "mouth");
-      }
-      else
-      {
-        renderer.setUniform("text", false);
-      }
-
-      renderer.push();
-      if (_mesh3 == "eye")
-      {
-        renderer.mesh(_eyeMesh);
-      }
-      else if (_mesh3 == "horn")
-      {
-        renderer.mesh(_hornMesh);
-      }
-      else if (_mesh3 == "nose")
-      {
-        renderer.mesh(_noseMesh);
-      }
-      else if (_mesh3 == "duck")
-      {
-        renderer.mesh(_duckMesh);
-      }
-      else if (_mesh3 == "mouth")
-      {
-        renderer.mesh(_mouthMesh);
-      }
-      else
-      {
-        renderer.cube();
-      }
-      renderer.pop();
-    }
+    renderer.translate(_pos2);
+    renderer.cube();
+    drawCubes(OPAQUE);
+    drawDecorators(false, OPAQUE);
+    drawDecorators(true, OPAQUE);
+  }
 
-    drawCubes();
-    drawDecorators();
+  // Glass and the preview, unsorted
+  void drawTransparent()
+  {
+    glDepthMask(GL_FALSE);
+    renderer.blendMode(OIT);
+
+    bool previewSkinned = _scene->preview.skin >= 0;
+    beginLitShader(ACCUMULATE);
+    if (showPreview() && !previewSkinned) drawPreview();
+    drawCubes(GLASS);
+    drawDecorators(false, GLASS);
+    renderer.endShader();
 
+    beginLitShader(SKINNED | ACCUMULATE);
+    renderer.texture("Skins", "skins");
+    if (showPreview() && previewSkinned) drawPreview();
+    drawDecorators(true, GLASS);
     renderer.endShader();
+
+    renderer.blendMode(DEFAULT);
+    glDepthMask(GL_TRUE);
+  }
+
+  // The preview is left out of recordings
+  bool showPreview() const
+  {
+    return _scene->showPreview && _recordFrame < 0;
+  }
+
+  // The preview mesh
+  void drawPreview()
+  {
+    const decorator& preview = _scene->preview;
+    if (preview.skin >= 0) renderer.setUniform("SkinLayer", preview.skin);
+    renderer.setUniform("diffuseColor", vec4(preview.color,
+        std::min(PreviewOpacity, opacity(preview.material))));
+    renderer.identity();
+    renderer.translate(preview.pos);
+    renderer.rotate(preview.rotx, vec3(0.0, 0.0, 1.0));
+    renderer.rotate(preview.rotz, vec3(1.0, 0.0, 0.0));
+    renderer.rotate(preview.roty, vec3(0.0, 1.0, 0.0));
+    renderer.scale(preview.scale);
+
+    renderer.push();
+    if (preview.ply == "eye")
+    {
+      renderer.mesh(_eyeMesh);
+    }
+    else if (preview.ply == "horn")
+    {
+      renderer.mesh(_hornMesh);
+    }
+    else if (preview.ply == "nose")
+    {
+      renderer.mesh(_noseMesh);
+    }
+    else if (preview.ply == "duck")
+    {
+      renderer.mesh(_duckMesh);
+    }
+    else if (preview.ply == "mouth")
+    {
+      renderer.mesh(_mouthMesh);
+    }
+    else
+    {
+      renderer.cube();
+    }
+    renderer.pop();
   }
 
 protected:
@@ -816,10 +1192,11 @@ protected:
   float _rotz3 = 0.0f;
   float _roty3 = 0.0f;
   vec3 _norm3;
-  bool _show3;
+  bool _show3 = false;
   vec3 _color3 = vec3(0.0f, 0.0f, 0.0f);
+  Material _material3 = OPAQUE;  // M key
   string _mesh3;
-  bool _isModel3;
+  bool _isModel3 = true;
 
   bool _selected1 = false;
   bool _selected2 = false;
@@ -827,16 +1204,73 @@ protected:
   decorator eye;
   decorator cube;
 
-  std::vector<decorator> _decorators;
-  std::vector<decorator> _cubes;
+  AppendList<decorator> _decorators;
+  AppendList<decorator> _cubes;
+  Bvh _cubeBvh;  // boxes of _cubes, for picking
   std::vector<string> _meshes;
 
+  // Directional light, in world space
+  vec3 _lightDirection = vec3(-1.0f, -0.25f, 0.0f);
+  static constexpr int ShadowSize = 2048;
+  static constexpr float ShadowExtent = 3.0f;    // half-width of the light's view
+  static constexpr float ShadowDistance = 10.0f;  // light distance from origin
+
+  static constexpr float FieldOfView = 60.0f;  // degrees
+  static constexpr float NearPlane = 0.5f;
+  static constexpr float FarPlane = 10.0f;
+
+  // Camera used by the scene passes
+  vec3 _cameraPos = vec3(0, 0, 5);
+  float _cameraAspect = 1.0f;
+
+  // Turntable recording (T key): one orbit in RecordFrames steps, rendered
+  // offscreen independently of the window size
+  static constexpr int RecordWidth = 1920;
+  static constexpr int RecordHeight = 1080;
+  static constexpr int RecordFrames = 240;
+  static constexpr int MaxRecordSteps = 8;  // per draw(), to show progress
+  const char* RecordPattern = "turntable-%04d.qoi";
+  int _recordFrame = -1;  // frame being recorded, or -1
+  bool _recordTextureLoaded = false;
+  float _recordStart = 0.0f;
+
+  FrameGraph _graph;
+  FrameGraph::Pass* _staticShadowPass = nullptr;
+  int _shadowPlacements = -1;  // placements in the cached staticShadow
+  FrameGraph::Pass* _scenePass = nullptr;
+  FrameGraph::Pass* _opaquePass = nullptr;
+  FrameGraph::Pass* _compositePass = nullptr;
+
+  // Input handlers edit the members above; draw() only reads _scene, the
+  // latest snapshot published by update()
+  int _placements = 0;
+  int _glassPlacements = 0;
+  int _recordRequests = 0;
+  bool _showStats = false;
+  SceneState _state;
+  SnapshotBuffer<SceneState> _snapshots;
+  const SceneState* _scene = nullptr;
+  int _recordRequestsSeen = 0;
+
+  // Glowing eyes (L key), binned into clusters every frame
+  bool _glow = false;
+  LightClusters _clusters;
+  std::vector<LightClusters::Light> _lights;
+
+  // Scales the scene to fit its GPU time into a frame (V key)
+  bool _dynamicResolution = false;
+  DynamicResolution _resolution;
+
   int _curOption = 0;
 };
 
 int main(int argc, char** argv)
 {
+  // --threaded handles input and draws on separate threads
+  bool threaded = argc > 1 && string(argv[1]) == "--threaded";
+
   Viewer viewer;
-  viewer.run();
+  if (threaded) viewer.runThreaded();
+  else viewer.run();
   return 0;
 }
@@ -5,6 +5,7 @@
 //--------------------------------------------------
 
 #include "plymesh.h"
+#include "agl/profiler.h"
 #include <iostream>
 #include <fstream>
 
@@ -39,6 +40,7 @@ namespace agl {
    }
 
    bool PLYMesh::load(const std::string& filename) {
+      AGL_PROFILE_SCOPE("PLYMesh::load");
       if (_positions.size() != 0) {
          std::cout << "WARNING: Cannot load different files with the same PLY mesh\n";
          return false;
@@ -0,0 +1,293 @@
+// Bryn Mawr College, alinen, 2020
+//
+// Renders scene files to PNG images without a display.
+//
+//   render-batch [-j workers] [-o outputDir] scene1.scene scene2.scene ...
+//
+// Scenes are split between worker processes, each with its own headless
+// context. Each scene is saved as <outputDir>/<scene name>.png.
+//
+// Scene files are plain text, one item per line ('#' starts a comment):
+//
+//   size 512 512                 image size (default 512x512)
+//   camera 0 0 5  0 0 0          eye position and look-at point
+//   background 0.1 0.1 0.1
+//   cube  px py pz  sx sy sz  r g b  [rotx roty rotz]
+//   eye   px py pz  sx sy sz  r g b  [rotx roty rotz]
+//
+// Objects may be any of the demo's meshes: cube, eye, horn, nose, duck
+// and mouth; other names are errors. Rotations are in radians.
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "agl/window.h"
+#include "plymesh.h"
+#include "osutils.h"
+
+using namespace std;
+using namespace glm;
+using namespace agl;
+
+struct SceneObject
+{
+  string mesh;
+  vec3 pos;
+  vec3 scale;
+  vec3 color;
+  vec3 rot;  // applied in the demo's order: x, z, then y
+};
+
+struct Scene
+{
+  int width = 512;
+  int height = 512;
+  vec3 eye = vec3(0, 0, 5);
+  vec3 look = vec3(0, 0, 0);
+  vec3 background = vec3(0);
+  vector<SceneObject> objects;
+};
+
+// Objects a scene can contain; all but the cube are PLY models
+static const char* MeshNames[] =
+    {"cube", "eye", "horn", "nose", "duck", "mouth"};
+
+static bool loadScene(const string& filename, Scene* scene)
+{
+  ifstream file(filename);
+  if (!file)
+  {
+    cout << "ERROR: Cannot open scene " << filename << endl;
+    return false;
+  }
+
+  string line;
+  int lineNum = 0;
+  while (getline(file, line))
+  {
+    lineNum++;
+    size_t comment = line.find('#');
+    if (comment != string::npos) line.erase(comment);
+
+    istringstream in(line);
+    string key;
+    if (!(in >> key)) continue;
+
+    if (key == "size")
+    {
+      in >> scene->width >> scene->height;
+    }
+    else if (key == "camera")
+    {
+      in >> scene->eye.x >> scene->eye.y >> scene->eye.z >>
+          scene->look.x >> scene->look.y >> scene->look.z;
+    }
+    else if (key == "background")
+    {
+      in >> scene->background.r >> scene->background.g >> scene->background.b;
+    }
+    else
+    {
+      if (find(begin(MeshNames), end(MeshNames), key) == end(MeshNames))
+      {
+        cout << "ERROR: " << filename << ":" << lineNum <<
+            ": unknown object '" << key << "'" << endl;
+        return false;
+      }
+
+      SceneObject obj;
+      obj.mesh = key;
+      obj.rot = vec3(0);
+      in >> obj.pos.x >> obj.pos.y >> obj.pos.z >>
+          obj.scale.x >> obj.scale.y >> obj.scale.z >>
+          obj.color.r >> obj.color.g >> obj.color.b;
+
+      // The rotation is optional, but must be complete if given
+      if (in && !in.eof()) in >> ws;
+      if (in && !in.eof())
+      {
+        in >> obj.rot.x >> obj.rot.y >> obj.rot.z;
+      }
+      scene->objects.push_back(obj);
+    }
+
+    if (in.fail())
+    {
+      cout << "ERROR: " << filename << ":" << lineNum <<
+          ": cannot parse '" << line << "'" << endl;
+      return false;
+    }
+  }
+  return scene->width > 0 && scene->height > 0;
+}
+
+class BatchRenderer : public Window {
+public:
+  BatchRenderer(const vector<string>& scenes, const string& outputDir) :
+    Window(),
+    _scenes(scenes),
+    _outputDir(outputDir) {
+  }
+
+  void setup() {
+    _meshes["eye"].load("../models/eye.ply");
+    _meshes["horn"].load("../models/horn.ply");
+    _meshes["nose"].load("../models/nose.ply");
+    _meshes["duck"].load("../models/rubberDucky.ply");
+    _meshes["mouth"].load("../models/mouth.ply");
+
+    renderer.loadShader("phong-pixel", "../shaders/phong-pixel.vs",
+        "../shaders/phong-pixel.fs");
+
+    if (_scenes.empty()) noLoop();
+  }
+
+  // Renders one scene per frame
+  void draw() {
+    const string& filename = _scenes[_next];
+    Scene scene;
+    if (loadScene(filename, &scene))
+    {
+      setWindowSize(scene.width, scene.height);
+      background(scene.background);
+      drawScene(scene);
+
+      string image = _outputDir + "/" + PruneName(filename) + ".png";
+      if (screenshot(image)) _rendered++;
+      else cout << "ERROR: Cannot save " << image << endl;
+    }
+
+    _next++;
+    if (_next >= static_cast<int>(_scenes.size())) noLoop();
+  }
+
+  void drawScene(const Scene& scene) {
+    renderer.beginShader("phong-pixel");
+    renderer.perspective(radians(60.0f),
+        static_cast<float>(scene.width) / scene.height, 0.5f, 10);
+    renderer.lookAt(scene.eye, scene.look, vec3(0, 1, 0));
+
+    for (const SceneObject& obj : scene.objects)
+    {
+      renderer.setUniform("diffuseColor", vec4(obj.color, 1));
+      renderer.identity();
+      renderer.translate(obj.pos);
+      renderer.rotate(obj.rot.x, vec3(0, 0, 1));
+      renderer.rotate(obj.rot.z, vec3(1, 0, 0));
+      renderer.rotate(obj.rot.y, vec3(0, 1, 0));
+      renderer.scale(obj.scale);
+
+      auto mesh = _meshes.find(obj.mesh);
+      if (mesh != _meshes.end()) renderer.mesh(mesh->second);
+      else renderer.cube();
+    }
+    renderer.endShader();
+  }
+
+  int rendered() const { return _rendered; }
+
+protected:
+  vector<string> _scenes;
+  string _outputDir;
+  map<string, PLYMesh> _meshes;
+  int _next = 0;
+  int _rendered = 0;
+};
+
+// Render every numWorkers'th scene, starting at worker, and return how many
+// images were saved
+static int renderScenes(const vector<string>& scenes, int worker,
+    int numWorkers, const string& outputDir)
+{
+  vector<string> mine;
+  for (size_t i = worker; i < scenes.size(); i += numWorkers)
+  {
+    mine.push_back(scenes[i]);
+  }
+
+  Window::Headless = true;
+  BatchRenderer batch(mine, outputDir);
+  batch.run();
+  return batch.rendered();
+}
+
+int main(int argc, char** argv)
+{
+  int numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  string outputDir = ".";
+  vector<string> scenes;
+  for (int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) numWorkers = atoi(argv[++i]);
+    else if (arg == "-o" && i + 1 < argc) outputDir = argv[++i];
+    else scenes.push_back(arg);
+  }
+
+  if (scenes.empty())
+  {
+    cout << "usage: render-batch [-j workers] [-o outputDir] "
+        "scene1.scene ...\n";
+    return 1;
+  }
+  numWorkers = std::max(1, std::min(numWorkers,
+      static_cast<int>(scenes.size())));
+
+  // Each worker is a separate process with its own context, so llvmpipe
+  // (or the GPU driver) sees independent command streams. Workers report
+  // their image count back through a pipe.
+  auto start = chrono::steady_clock::now();
+  vector<int> pipes;
+  for (int worker = 0; worker < numWorkers; worker++)
+  {
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+      cout << "ERROR: Cannot create a pipe for worker " << worker << endl;
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(fds[0]);
+      int count = renderScenes(scenes, worker, numWorkers, outputDir);
+      ssize_t written = write(fds[1], &count, sizeof(count));
+      close(fds[1]);
+      _exit(written == sizeof(count) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0)
+    {
+      cout << "ERROR: Cannot start worker " << worker << endl;
+      close(fds[0]);
+      continue;
+    }
+    pipes.push_back(fds[0]);
+  }
+
+  int rendered = 0;
+  for (int fd : pipes)
+  {
+    int count = 0;
+    if (read(fd, &count, sizeof(count)) == sizeof(count)) rendered += count;
+    close(fd);
+  }
+  while (wait(nullptr) > 0) {}
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "Rendered " << rendered << "/" << scenes.size() << " images in " <<
+      elapsed.count() << " s with " << numWorkers << " workers (" <<
+      rendered / elapsed.count() << " images/s)" << endl;
+  return rendered == static_cast<int>(scenes.size()) ? 0 : 1;
+}